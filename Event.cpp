@@ -7,6 +7,10 @@
 
 #include "MMUtil+.h"
 #include <stdexcept>
+#include <limits.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 using namespace std;
 
 namespace MM {
@@ -120,6 +124,66 @@ void Event::Reset()
       throw os_error(rc, "Failed to reset event semaphore.");
 }
 
+#elif defined(__linux__)
+
+/*****************************************************************************
+*
+*  Event class
+*  Futex with the states reset, set and reset with waiters. Set enters the
+*  kernel only if a thread waits. The destructor switches to the state
+*  destroyed and waits until the waiting threads left the futex.
+*
+*****************************************************************************/
+
+Event::Event() : State(0), WaitCount(0)
+{}
+
+Event::~Event()
+{	if (__atomic_exchange_n(&State, 3, __ATOMIC_SEQ_CST) == 2)
+		Futex::Wake(&State, INT_MAX);
+	// The waiting threads still access State.
+	while (__atomic_load_n(&WaitCount, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+bool Event::Wait(long ms)
+{	int c = __atomic_load_n(&State, __ATOMIC_ACQUIRE);
+	if (c == 1)
+		return true;
+	struct timespec deadline;
+	if (ms != -1)
+		Futex::Deadline(deadline, ms);
+	__atomic_add_fetch(&WaitCount, 1, __ATOMIC_SEQ_CST);
+	bool ret = true;
+	while (c != 1)
+	{	if (c == 3)
+		{	__atomic_sub_fetch(&WaitCount, 1, __ATOMIC_RELEASE);
+			throw interrupt_exception("Event semaphore destroyed while waiting for it to be posted.");
+		}
+		// announce the waiter, c is updated if this fails
+		if (c == 0 && !__atomic_compare_exchange_n(&State, &c, 2, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+			continue;
+		if (!Futex::Wait(&State, 2, ms == -1 ? NULL : &deadline))
+		{	ret = false;
+			break;
+		}
+		c = __atomic_load_n(&State, __ATOMIC_ACQUIRE);
+	}
+	__atomic_sub_fetch(&WaitCount, 1, __ATOMIC_RELEASE);
+	return ret;
+}
+
+void Event::Set()
+{	if (__atomic_exchange_n(&State, 1, __ATOMIC_RELEASE) == 2)
+		Futex::Wake(&State, INT_MAX);
+}
+
+void Event::Reset()
+{	// Keep the waiters flag.
+	int c = 1;
+	__atomic_compare_exchange_n(&State, &c, 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
 #else
 
 // use pthreads
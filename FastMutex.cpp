@@ -10,6 +10,9 @@
 
 
 #include "MMUtil+.h"
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 
 namespace MM {
@@ -71,6 +74,43 @@ bool FastMutex::Release()
 
 #endif
 
+#elif defined(__linux__)
+/*****************************************************************************
+*
+*  high speed mutual exclusive section class
+*  Futex with the states free, owned and contended (U. Drepper, "Futexes Are
+*  Tricky"). Request and Release without contention are one atomic
+*  operation each. Only a contended mutex enters the kernel.
+*
+*****************************************************************************/
+
+bool FastMutex::Request(long ms)
+{	int c = 0;
+	if (__atomic_compare_exchange_n(&State, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return true;
+	if (ms == 0)
+		return false;
+	struct timespec deadline;
+	if (ms != -1)
+		Futex::Deadline(deadline, ms);
+	// Mark the mutex contended, so the owner wakes us up.
+	if (c != 2)
+		c = __atomic_exchange_n(&State, 2, __ATOMIC_ACQUIRE);
+	while (c != 0)
+	{	if (!Futex::Wait(&State, 2, ms == -1 ? NULL : &deadline))
+			return false;
+		c = __atomic_exchange_n(&State, 2, __ATOMIC_ACQUIRE);
+	}
+	return true;
+}
+
+bool FastMutex::Release()
+{	int c = __atomic_exchange_n(&State, 0, __ATOMIC_RELEASE);
+	if (c == 2)
+		Futex::Wake(&State, 1);
+	return c != 0;
+}
+
 #else
 // use pthreads
 FastMutex::FastMutex() : Mutex((const pthread_mutexattr_t*)NULL)
@@ -1,5 +1,6 @@
 #include "IOinterface.h"
 #include "buffer2.h"
+#include "uring.h"
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -10,11 +11,21 @@
 #define HF_STDOUT 1
 
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
+#include <algorithm>
 #include <memory>
+#include <deque>
 #include <sstream>
 #include <MMUtil+.h>
 
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
 #ifdef __OS2__
 #define INCL_BASE
 #include <os2.h>
@@ -51,6 +62,17 @@ struct FileServices
 	~FileServices();
 	#ifdef __OS2__
 	bool isPipe(const char* name);
+	#else
+	// Direct I/O (-o) transfers only aligned blocks. Unaligned requests go
+	// through one aligned block buffer.
+	bool Direct;     // HF is open with O_DIRECT
+	char* Block;     // aligned block buffer or NULL
+	size_t BlockPos; // start of the pending data in Block
+	size_t BlockLen; // end of the pending data in Block
+	// Open a file in the configured cache mode. Sets HF to -1 on error.
+	void Open(const char* name, int flags);
+	// Continue without O_DIRECT, e.g. at the unaligned end of the stream.
+	void EndDirect();
 	#endif
 };
 
@@ -73,13 +95,28 @@ class FileInput : public IInput, protected FileServices
 	FileInput(const char* src) : IInput(src) {}
 	virtual void Initialize();
 	virtual size_t ReadData(void* dst, size_t len);
+ private:
+	#ifndef __OS2__
+	size_t Read(void* dst, size_t len);
+	#endif
 };
 
 class TcpipInput : public IInput, protected TcpipServices
 {public:
 	TcpipInput(const char* src) : IInput(src) { Parse(src); }
+	// input from an accepted connection
+	TcpipInput(int socket, const sockaddr_in& addr);
 	virtual void Initialize();
 	virtual size_t ReadData(void* dst, size_t len);
+	virtual void Shutdown();
+};
+
+class TcpipListener : public IListener, protected TcpipServices
+{public:
+	TcpipListener(const char* src) : IListener(src) { Parse(src); }
+	virtual void Initialize();
+	virtual IInput* Accept();
+	virtual void Shutdown();
 };
 
 // output interface classes
@@ -88,6 +125,11 @@ class FileOutput : public IOutput, protected FileServices
 	FileOutput(const char* dst) : IOutput(dst) {}
 	virtual void Initialize();
 	virtual size_t WriteData(const void* src, size_t len);
+	#ifndef __OS2__
+	virtual void Finish();
+ private:
+	size_t Write(const void* src, size_t len);
+	#endif
 };
 
 class TcpipOutput : public IOutput, protected TcpipServices
@@ -98,6 +140,62 @@ class TcpipOutput : public IOutput, protected TcpipServices
 	virtual size_t WriteData(const void* src, size_t len);
 };
 
+#ifdef __linux__
+// asynchronous file class
+class AsyncFile : public IAsyncFile, protected FileServices
+{	struct Transfer
+	{	char* Data;
+		size_t Len;
+		uint64_t Pos;    // file position
+		int Result;      // bytes or negative errno value
+		bool Done;
+	};
+	const bool Output;
+	Uring Ring;
+	deque<Transfer> Queue; // transfers in flight in file order
+	uint64_t Tag;    // tag of Queue.front()
+	uint64_t Pos;    // file position of the next transfer
+	uint64_t End;    // end of the input file
+ public:
+	AsyncFile(const char* name, bool output, unsigned depth) : IAsyncFile(name), Output(output), Ring(depth), Tag(0), Pos(0), End(0) {}
+	virtual void Initialize();
+	virtual void Register(void* mem, size_t len) { Ring.Register(mem, len); }
+	virtual unsigned getPending() const { return Queue.size(); }
+	virtual uint64_t Available();
+	virtual void Submit(void* data, size_t len);
+	virtual size_t Complete(void*& data);
+	virtual void Finish();
+};
+
+// pipe output class
+class PipeOutput : public IPipeOutput, protected FileServices
+{	int Notify; // inotify of the reads from the pipe or -1
+ public:
+	PipeOutput(const char* dst) : IPipeOutput(dst), Notify(-1) {}
+	~PipeOutput();
+	virtual void Initialize();
+	virtual size_t SpliceData(const void* data, size_t len);
+	virtual size_t Unread();
+	virtual void Wait();
+};
+
+// splice endpoint classes
+class SpliceFile : public ISpliceEnd, protected FileServices
+{	const bool Output;
+ public:
+	SpliceFile(const char* name, bool output) : ISpliceEnd(name), Output(output) {}
+	virtual void Initialize();
+	virtual int getHandle() const { return HF; }
+};
+
+class SpliceSocket : public ISpliceEnd, protected TcpipServices
+{public:
+	SpliceSocket(const char* name) : ISpliceEnd(name) { Parse(name); }
+	virtual void Initialize() { TcpipServices::Initialize(); }
+	virtual int getHandle() const { return Socket; }
+};
+#endif
+
 
 using namespace MM;
 
@@ -129,7 +227,7 @@ bool FileServices::isPipe(const char* name)
 
 #else
 // generic implementation
-FileServices::FileServices() : HF(-1)
+FileServices::FileServices() : HF(-1), Direct(false), Block(NULL), BlockPos(0), BlockLen(0)
 {}
 
 FileServices::~FileServices()
@@ -137,6 +235,40 @@ FileServices::~FileServices()
 	{	if (close(HF) != 0)
 			lerr << "Internal error " << errno << " while closing file handle " << HF << endl;
 	}
+	free(Block);
+}
+
+void FileServices::Open(const char* name, int flags)
+{	if (DirectIO)
+	{
+		#ifdef O_DIRECT
+		HF = open(name, flags|O_DIRECT, 0666);
+		if (HF != -1)
+		{	void* block;
+			int rc = posix_memalign(&block, BufferAlignment, BufferAlignment);
+			if (rc != 0)
+				throw os_error(rc, "Failed to allocate the block buffer for direct I/O.");
+			Block = (char*)block;
+			Direct = true;
+			return;
+		}
+		if (errno != EINVAL)
+			return;
+		#endif
+		// The file system does not support O_DIRECT.
+		lerr << "Direct I/O is not supported for " << name << ", using normal I/O." << endl;
+	}
+	HF = open(name, EnableCache ? flags : flags|O_SYNC, 0666);
+}
+
+void FileServices::EndDirect()
+{
+	#ifdef O_DIRECT
+	int flags = fcntl(HF, F_GETFL);
+	if (flags == -1 || fcntl(HF, F_SETFL, flags & ~O_DIRECT) == -1)
+		throw os_error(errno, "Failed to switch off direct I/O.");
+	#endif
+	Direct = false;
 }
 
 #endif
@@ -170,12 +302,12 @@ void TcpipServices::Parse(const char* url)
 		if (hp == NULL)
 			throw os_error(h_errno, stringf("The hosname %s cannot be resolved.", host.c_str()));
 		IsServer = false;
-		Addr.sin_addr.s_addr = *(u_long*)hp->h_addr;
+		memcpy(&Addr.sin_addr.s_addr, hp->h_addr, sizeof Addr.sin_addr.s_addr);
 	}
 	// port
 	++cp;
-	size_t len;
-	if (sscanf(cp, "%hi%n", &Addr.sin_port, &len) == 1 && len == strlen(cp))
+	int len = -1;
+	if (sscanf(cp, "%hu%n", &Addr.sin_port, &len) == 1 && len == (int)strlen(cp))
 		// numeric port
 		Addr.sin_port = ::htons(Addr.sin_port);
 	 else
@@ -223,7 +355,7 @@ string TcpipServices::ConnectString() const
 
 string TcpipServices::IP2string(u_long ip)
 {	ip = ::ntohl(ip);
-	return stringf("%d.%d.%d.%d", ip>>24, (ip>>16) & 0xff, (ip>>8) & 0xff, ip & 0xff);
+	return stringf("%u.%u.%u.%u", (unsigned)(ip>>24), (unsigned)(ip>>16) & 0xff, (unsigned)(ip>>8) & 0xff, (unsigned)ip & 0xff);
 }
 
 // input interface functions
@@ -274,32 +406,111 @@ void FileInput::Initialize()
 		HF = HF_STDIN;
 	 else
 	{	// ordinary file
-		HF = open(Src, EnableCache ? O_RDONLY : O_RDONLY|O_SYNC);
+		Open(Src, O_RDONLY);
 		if (HF == -1) 
 			throw os_error(errno, stringf("Failed to open %s for input.", Src));
 	}
 }
 
 size_t FileInput::ReadData(void* dst, size_t len)
-{	len = read(HF, dst, len);
-	if (len == (size_t)-1)
+{	if (BlockPos < BlockLen)
+	{	// rest of the last block
+		len = min(len, BlockLen - BlockPos);
+		memcpy(dst, Block + BlockPos, len);
+		BlockPos += len;
+		return len;
+	}
+	if (Direct)
+	{	if (((uintptr_t)dst & (BufferAlignment-1)) == 0 && len >= BufferAlignment)
+			len &= ~(size_t)(BufferAlignment-1);
+		 else
+		{	// read a whole block and pass the requested part
+			BlockLen = Read(Block, BufferAlignment);
+			BlockPos = min(len, BlockLen);
+			memcpy(dst, Block, BlockPos);
+			return BlockPos;
+		}
+	}
+	return Read(dst, len);
+}
+
+size_t FileInput::Read(void* dst, size_t len)
+{	ssize_t r = read(HF, dst, len);
+	if (r == -1 && errno == EINVAL && Direct)
+	{	lerr << "Direct I/O failed for " << Src << ", using normal I/O." << endl;
+		EndDirect();
+		r = read(HF, dst, len);
+	}
+	if (r == -1)
 		throw os_error(errno, "Failed to read from input stream.");
-	return len;
+	if (Direct && (size_t)r < len)
+		// End of the file. The file position is no longer aligned.
+		EndDirect();
+	return r;
 }
 
 #endif
 
+TcpipInput::TcpipInput(int socket, const sockaddr_in& addr)
+ : IInput("")
+{	IsServer = false;
+	Addr = addr;
+	Socket = socket;
+}
+
 void TcpipInput::Initialize()
-{	TcpipServices::Initialize();
+{	if (Socket == -1) // not yet connected
+		TcpipServices::Initialize();
 }
 
 size_t TcpipInput::ReadData(void* dst, size_t len)
-{	int r = ::recv(Socket, dst, len, 0);
+{	ssize_t r = ::recv(Socket, dst, len, 0);
 	if (r == -1)
 		throw os_error(sock_errno(), "Error while receiving data from "+ConnectString()+".");
 	return r;
 }
 
+void TcpipInput::Shutdown()
+{	if (Socket != -1)
+		::shutdown(Socket, 2); // both directions, recv returns 0
+}
+
+
+// listener functions
+
+IListener* IListener::Factory(const char* src)
+{	if (strncmp(src, TCPIPPREFIX, 8) == 0 && src[8] == ':')
+		return new TcpipListener(src+8);
+	 else
+		return NULL;
+}
+
+void TcpipListener::Initialize()
+{	Socket = ::socket(PF_INET, SOCK_STREAM, 0);
+	if (Socket == -1)
+		throw os_error(sock_errno(), "Failed to create socket.");
+	int on = 1;
+	::setsockopt(Socket, SOL_SOCKET, SO_REUSEADDR, (char*)&on, sizeof on);
+	if (::bind(Socket, (sockaddr*)&Addr, sizeof Addr))
+		throw os_error(sock_errno(), "Failed to bind "+ConnectString()+".");
+	if (::listen(Socket, SOMAXCONN))
+		throw os_error(sock_errno(), "Failed to listen on "+ConnectString()+".");
+}
+
+IInput* TcpipListener::Accept()
+{	sockaddr_in addr;
+	socklen_t len = sizeof addr;
+	int new_sock = ::accept(Socket, (sockaddr*)&addr, &len);
+	if (new_sock == -1)
+		throw os_error(sock_errno(), "Failed to accept connection on "+ConnectString()+".");
+	return new TcpipInput(new_sock, addr);
+}
+
+void TcpipListener::Shutdown()
+{	if (Socket != -1)
+		::shutdown(Socket, 2); // accept fails
+}
+
 
 // output worker functions
 
@@ -350,17 +561,58 @@ void FileOutput::Initialize()
 		HF = HF_STDOUT;
 	 else
 	{	// ordinary file
-		HF = open(Dst, EnableCache ? O_CREAT|O_TRUNC|O_WRONLY : O_CREAT|O_TRUNC|O_WRONLY|O_SYNC);
+		Open(Dst, O_CREAT|O_TRUNC|O_WRONLY);
 		if (HF == -1) 
 			throw os_error(errno, stringf("Failed to open %s for output.", Dst));
 	}
 }
 
 size_t FileOutput::WriteData(const void* src, size_t len)
-{	len = write(HF, src, len);
-	if (len == (size_t)-1)
+{	if (Direct)
+	{	if (BlockLen == 0 && ((uintptr_t)src & (BufferAlignment-1)) == 0 && len >= BufferAlignment)
+			len &= ~(size_t)(BufferAlignment-1);
+		 else
+		{	// collect a whole block
+			len = min(len, BufferAlignment - BlockLen);
+			memcpy(Block + BlockLen, src, len);
+			BlockLen += len;
+			if (BlockLen == BufferAlignment)
+			{	for (size_t done = 0; done < BlockLen; )
+					done += Write(Block + done, BlockLen - done);
+				BlockLen = 0;
+			}
+			return len;
+		}
+	}
+	return Write(src, len);
+}
+
+void FileOutput::Finish()
+{	if (BlockLen)
+	{	// The unaligned end of the stream cannot be written with O_DIRECT.
+		if (Direct)
+			EndDirect();
+		for (size_t done = 0; done < BlockLen; )
+			done += Write(Block + done, BlockLen - done);
+		BlockLen = 0;
+	}
+	// O_DIRECT bypasses the cache but does not imply O_SYNC.
+	if (Block && fdatasync(HF) != 0)
+		throw os_error(errno, stringf("Failed to flush %s.", Dst));
+}
+
+size_t FileOutput::Write(const void* src, size_t len)
+{	ssize_t r = write(HF, src, len);
+	if (r == -1 && errno == EINVAL && Direct)
+	{	lerr << "Direct I/O failed for " << Dst << ", using normal I/O." << endl;
+		EndDirect();
+		r = write(HF, src, len);
+	}
+	if (r == -1)
 		throw os_error(errno, "Failed to write to output stream.");
-	return len;
+	if (r == 0 && len)
+		throw runtime_error("Failed to write to the output stream because the destination does not accept more data.");
+	return r;
 }
 
 #endif
@@ -370,10 +622,231 @@ void TcpipOutput::Initialize()
 }
 
 size_t TcpipOutput::WriteData(const void* src, size_t len)
-{	int r = ::send(Socket, (char*)src, len, 0);
+{	ssize_t r = ::send(Socket, (char*)src, len, 0);
 	if (r == -1)
 		throw os_error(sock_errno(), "Error while sending data to "+ConnectString()+".");
 	return r;
 }
 
 
+// asynchronous file functions
+
+#ifdef __linux__
+IAsyncFile* IAsyncFile::Factory(const char* name, bool output, unsigned depth)
+{	if (strcmp(name, "-") == 0 || strncmp(name, TCPIPPREFIX, 8) == 0)
+		return NULL;
+	struct stat st;
+	if (stat(name, &st) == 0 ? !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode) : !output)
+		return NULL; // e.g. a named pipe
+	try
+	{	return new AsyncFile(name, output, depth);
+	} catch (const runtime_error& e)
+	{	static bool once = false;
+		if (!once)
+			lerr << e.what() << " Using synchronous I/O." << endl;
+		once = true;
+		return NULL;
+	}
+}
+
+void AsyncFile::Initialize()
+{	Open(Name, Output ? O_CREAT|O_TRUNC|O_WRONLY : O_RDONLY);
+	if (HF == -1)
+		throw os_error(errno, stringf(Output ? "Failed to open %s for output." : "Failed to open %s for input.", Name));
+	if (!Output)
+		Available();
+}
+
+uint64_t AsyncFile::Available()
+{	if (Pos >= End)
+	{	// The file might have grown.
+		off_t end = lseek(HF, 0, SEEK_END);
+		if (end == (off_t)-1)
+			throw os_error(errno, stringf("Failed to get the size of %s.", Name));
+		End = end;
+	}
+	return End > Pos ? End - Pos : 0;
+}
+
+void AsyncFile::Submit(void* data, size_t len)
+{	// Unaligned transfers, e.g. at the end of the file, continue without O_DIRECT.
+	if (Direct && (((uintptr_t)data | len | Pos) & (BufferAlignment-1)))
+		EndDirect();
+	Transfer t = { (char*)data, len, Pos, 0, false };
+	Queue.push_back(t);
+	Ring.Queue(Output, HF, data, len, Pos, Tag + Queue.size() - 1);
+	Pos += len;
+}
+
+size_t AsyncFile::Complete(void*& data)
+{	Transfer& t = Queue.front();
+	while (!t.Done)
+	{	uint64_t tag;
+		int result = Ring.Wait(tag);
+		Transfer& c = Queue[tag - Tag];
+		c.Result = result;
+		c.Done = true;
+	}
+	if (t.Result == -EINVAL && Block)
+	{	// The device rejected the direct transfer, repeat it without O_DIRECT.
+		if (Direct)
+		{	lerr << "Direct I/O failed for " << Name << ", using normal I/O." << endl;
+			EndDirect();
+		}
+		t.Result = 0;
+	}
+	if (t.Result < 0)
+		throw os_error(-t.Result, Output ? "Failed to write to output stream." : "Failed to read from input stream.");
+	// Finish a short transfer synchronously.
+	for (size_t done = t.Result; done < t.Len; )
+	{	ssize_t r = Output ? pwrite(HF, t.Data + done, t.Len - done, t.Pos + done)
+			: pread(HF, t.Data + done, t.Len - done, t.Pos + done);
+		if (r == -1)
+			throw os_error(errno, Output ? "Failed to write to output stream." : "Failed to read from input stream.");
+		if (r == 0)
+			throw runtime_error(Output ? "Failed to write to the output stream because the destination does not accept more data."
+				: stringf("%s was truncated while it was read.", Name));
+		done += r;
+	}
+	data = t.Data;
+	size_t len = t.Len;
+	Queue.pop_front();
+	++Tag;
+	return len;
+}
+
+void AsyncFile::Finish()
+{	// O_DIRECT bypasses the cache but does not imply O_SYNC.
+	if (Output && Block && fdatasync(HF) != 0)
+		throw os_error(errno, stringf("Failed to flush %s.", Name));
+}
+
+#else
+IAsyncFile* IAsyncFile::Factory(const char*, bool, unsigned)
+{	return NULL;
+}
+#endif
+
+
+// pipe output functions
+
+#ifdef __linux__
+IPipeOutput* IPipeOutput::Factory(const char* dst)
+{	struct stat st;
+	if (strcmp(dst, "-") == 0 ? fstat(HF_STDOUT, &st) != 0 : strncmp(dst, TCPIPPREFIX, 8) == 0 || stat(dst, &st) != 0)
+		return NULL;
+	return S_ISFIFO(st.st_mode) ? new PipeOutput(dst) : NULL;
+}
+
+void PipeOutput::Initialize()
+{	if (strcmp(Dst, "-") == 0)
+		HF = HF_STDOUT;
+	 else
+	{	HF = open(Dst, O_WRONLY);
+		if (HF == -1)
+			throw os_error(errno, stringf("Failed to open %s for output.", Dst));
+	}
+	// A larger pipe takes larger requests at once.
+	int size = fcntl(HF, F_GETPIPE_SZ);
+	if (size != -1 && size < RequestSize)
+		fcntl(HF, F_SETPIPE_SZ, (int)min(RequestSize, (int64_t)1 << 30)); // may fail, e.g. above the user limit
+	// The reader of the pipe causes IN_ACCESS events. Without them Wait polls.
+	Notify = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (Notify != -1 && inotify_add_watch(Notify, stringf("/proc/self/fd/%i", HF).c_str(), IN_ACCESS) == -1)
+	{	close(Notify);
+		Notify = -1;
+	}
+}
+
+PipeOutput::~PipeOutput()
+{	if (Notify != -1)
+		close(Notify);
+}
+
+size_t PipeOutput::SpliceData(const void* data, size_t len)
+{	iovec iov;
+	iov.iov_base = (void*)data;
+	iov.iov_len = len;
+	// No SPLICE_F_GIFT, the fifo reuses the memory.
+	ssize_t r = vmsplice(HF, &iov, 1, 0);
+	if (r == -1)
+		throw os_error(errno, "Failed to write to output stream.");
+	return r;
+}
+
+size_t PipeOutput::Unread()
+{	int len;
+	if (ioctl(HF, FIONREAD, &len) != 0)
+		throw os_error(errno, "Failed to query the output pipe.");
+	return len;
+}
+
+void PipeOutput::Wait()
+{	// The pipe itself signals consumed data only if it was full. Older
+	// kernels do not report splice from the pipe to inotify, so the wait
+	// is limited.
+	pollfd pfd[2];
+	pfd[0].fd = HF;
+	pfd[0].events = 0; // errors only
+	pfd[1].fd = Notify;
+	pfd[1].events = POLLIN;
+	if (poll(pfd, Notify != -1 ? 2 : 1, Notify != -1 ? 100 : 1) == -1 && errno != EINTR)
+		throw os_error(errno, "Failed to wait for the reader of the output pipe.");
+	if (pfd[0].revents & POLLERR)
+		throw os_error(EPIPE, "The reader closed the output pipe.");
+	if (Notify != -1 && (pfd[1].revents & POLLIN))
+	{	// discard the events, Unread tells the progress
+		char buf[4096];
+		while (read(Notify, buf, sizeof buf) > 0);
+	}
+}
+
+#else
+IPipeOutput* IPipeOutput::Factory(const char*)
+{	return NULL;
+}
+#endif
+
+
+// splice endpoint functions
+
+#ifdef __linux__
+ISpliceEnd* ISpliceEnd::Factory(const char* name, bool output)
+{	if (strncmp(name, TCPIPPREFIX, 8) == 0)
+		return new SpliceSocket(name+8);
+	struct stat st;
+	if (strcmp(name, "-") == 0)
+	{	const int fd = output ? HF_STDOUT : HF_STDIN;
+		if (fstat(fd, &st) != 0)
+			return NULL;
+		// splice cannot append
+		int flags = fcntl(fd, F_GETFL);
+		if (output && (flags == -1 || (flags & O_APPEND)))
+			return NULL;
+		if (S_ISSOCK(st.st_mode))
+			return new SpliceFile(name, output);
+	} else if (stat(name, &st) != 0)
+	{	// a new output file
+		if (!output || errno != ENOENT)
+			return NULL;
+		st.st_mode = S_IFREG;
+	}
+	// Terminals and most other character devices do not support splice.
+	return S_ISREG(st.st_mode) || S_ISBLK(st.st_mode) || S_ISFIFO(st.st_mode) ? new SpliceFile(name, output) : NULL;
+}
+
+void SpliceFile::Initialize()
+{	if (strcmp(Name, "-") == 0)
+		HF = Output ? HF_STDOUT : HF_STDIN;
+	 else
+	{	Open(Name, Output ? O_CREAT|O_TRUNC|O_WRONLY : O_RDONLY);
+		if (HF == -1)
+			throw os_error(errno, stringf(Output ? "Failed to open %s for output." : "Failed to open %s for input.", Name));
+	}
+}
+
+#else
+ISpliceEnd* ISpliceEnd::Factory(const char*, bool)
+{	return NULL;
+}
+#endif
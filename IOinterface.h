@@ -2,6 +2,7 @@
 #define __IOinterface_h
 
 #include <stdlib.h>
+#include <stdint.h>
 
 
 // input interface class
@@ -14,6 +15,24 @@ class IInput
 	static IInput* Factory(const char* src);
 	virtual void Initialize() = 0;
 	virtual size_t ReadData(void* dst, size_t len) = 0;
+	// Let a blocking ReadData of another thread return, if supported.
+	virtual void Shutdown() {}
+};
+
+// input that accepts several connections, e.g. a listening socket
+class IListener
+{protected:
+	const char* Src;
+	IListener(const char* src) : Src(src) {}
+ public:
+	virtual ~IListener() {};
+	// Returns NULL if src cannot accept more than one connection.
+	static IListener* Factory(const char* src);
+	virtual void Initialize() = 0;
+	// Wait for the next connection and return it as initialized input.
+	virtual IInput* Accept() = 0;
+	// Let a blocking Accept of another thread fail.
+	virtual void Shutdown() = 0;
 };
 
 // output interface class
@@ -26,6 +45,108 @@ class IOutput
 	static IOutput* Factory(const char* dst);
 	virtual void Initialize() = 0;
 	virtual size_t WriteData(const void* dst, size_t len) = 0;
+	// Called after the last data of the stream.
+	virtual void Finish() {}
+};
+
+// file with several transfers in flight, io_uring on Linux (-q)
+class IAsyncFile
+{protected:
+	const char* Name;
+	IAsyncFile(const char* name) : Name(name) {}
+ public:
+	// maximum length of a single transfer
+	enum { MaxTransfer = 1 << 30 };
+	virtual ~IAsyncFile() {};
+	// Returns NULL if name is no file or block device or if the platform
+	// does not support asynchronous I/O.
+	static IAsyncFile* Factory(const char* name, bool output, unsigned depth);
+	virtual void Initialize() = 0;
+	// Register the memory of the transfers, e.g. the fifo buffer. Optional.
+	virtual void Register(void* mem, size_t len) = 0;
+	// Number of the transfers in flight.
+	virtual unsigned getPending() const = 0;
+	// Bytes of the input file after the transfers in flight.
+	virtual uint64_t Available() = 0;
+	// Start the transfer of len bytes at data. The transfers are at
+	// consecutive file positions in the order they are started. A read
+	// must not exceed Available().
+	virtual void Submit(void* data, size_t len) = 0;
+	// Wait for the oldest transfer in flight and return its data and length.
+	// The transfer is always complete.
+	virtual size_t Complete(void*& data) = 0;
+	// Called after the last data of the stream.
+	virtual void Finish() {}
+};
+
+// output to a pipe that references the data instead of copying it (-z)
+class IPipeOutput
+{protected:
+	const char* Dst;
+	IPipeOutput(const char* dst) : Dst(dst) {}
+ public:
+	virtual ~IPipeOutput() {};
+	// Returns NULL if dst is no pipe or if the platform does not support
+	// vmsplice.
+	static IPipeOutput* Factory(const char* dst);
+	virtual void Initialize() = 0;
+	// Pass up to len bytes at data to the pipe. The pipe references the
+	// memory until the reader of the pipe has consumed the data.
+	// Returns the number of bytes passed.
+	virtual size_t SpliceData(const void* data, size_t len) = 0;
+	// Number of bytes in the pipe that the reader has not yet consumed.
+	virtual size_t Unread() = 0;
+	// Wait until the reader consumed data, at most a moment. Throws if the
+	// reader closed the pipe.
+	virtual void Wait() = 0;
+};
+
+// endpoint of a splice relay, a file, block device, pipe or socket (-f=splice)
+class ISpliceEnd
+{protected:
+	const char* Name;
+	ISpliceEnd(const char* name) : Name(name) {}
+ public:
+	virtual ~ISpliceEnd() {};
+	// Returns NULL if name cannot be spliced or if the platform does not
+	// support splice.
+	static ISpliceEnd* Factory(const char* name, bool output);
+	virtual void Initialize() = 0;
+	// File descriptor to splice from or to.
+	virtual int getHandle() const = 0;
+	// Called after the last data of the stream.
+	virtual void Finish() {}
+};
+
+// in-place processing of the data in the fifo (filters.cpp)
+class IFilter
+{protected:
+	const char* Spec;
+	IFilter(const char* spec) : Spec(spec) {}
+ public:
+	virtual ~IFilter() {};
+	static IFilter* Factory(const char* spec);
+	// The filter gets multiples of this number of bytes except for the end
+	// of the stream.
+	virtual size_t Granularity() const { return 1; }
+	virtual void Initialize() {}
+	// Process the next len bytes of the stream in place.
+	virtual void ProcessData(void* data, size_t len) = 0;
+	// Called after the last data of the stream.
+	virtual void Finish() {}
+};
+
+// record boundaries of the stream (framing.cpp)
+class IFraming
+{protected:
+	const char* Spec;
+	IFraming(const char* spec) : Spec(spec) {}
+ public:
+	virtual ~IFraming() {};
+	static IFraming* Factory(const char* spec);
+	// Length of the complete records at the start of data. data must start
+	// at a record boundary. Returns 0 if the first record is incomplete.
+	virtual size_t Whole(const void* data, size_t len) const = 0;
 };
 
 #endif
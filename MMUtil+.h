@@ -31,6 +31,7 @@
 
 #else
 #include <pthread.h>
+#include <time.h>
 #endif
 
 namespace MM {
@@ -179,6 +180,27 @@ class Interlock : public MutexBase
 // TODO: not supported so far
 #endif
 
+#ifdef __linux__
+/*****************************************************************************
+*
+*  futex system call wrapper
+*
+*  The Linux implementations of FastMutex, Notification and Event wait at a
+*  32 bit word with the futex system call. Timeouts are absolute times of
+*  CLOCK_MONOTONIC, so changes of the system time do not affect them.
+*
+*****************************************************************************/
+struct Futex
+{	// Absolute CLOCK_MONOTONIC time ms milliseconds from now.
+	static void Deadline(struct timespec& ts, long ms);
+	// Wait as long as *addr == val, until deadline unless it is NULL.
+	// The function may return spuriously. It returns false at the deadline.
+	static bool Wait(volatile int* addr, int val, const struct timespec* deadline);
+	// Wake up to count threads that wait at addr.
+	static void Wake(volatile int* addr, int count);
+};
+#endif
+
 /*****************************************************************************
 *
 *  generic mutual exclusive section class
@@ -275,6 +297,17 @@ class FastMutex : public Mutex
 };
 #endif
 
+#elif defined(__linux__)
+// futex, not recursive
+class FastMutex : public MutexBase
+{private:
+	volatile int State; // 0 = free, 1 = owned, 2 = owned and maybe waiters
+ public:
+	             FastMutex() : State(0) {}
+	virtual bool Request(long ms = -1);
+	virtual bool Release();
+};
+
 #else
 // use pthreads
 class FastMutex : public Mutex
@@ -307,19 +340,33 @@ class Notification
 	//#error TODO:
 	#elif defined(__OS2__)
 	typedef HEV handle_t;
+	#elif defined(__linux__)
+	typedef volatile int handle_t; // futex, incremented by each notification
 	#else
 	typedef pthread_cond_t handle_t;
 	#endif
  protected:
+	#ifdef __linux__
+	MM::SmartPointer::own_ptr<MutexBase> Mux;
+	#else
 	MM::SmartPointer::own_ptr<Mutex> Mux;
+	#endif
 	handle_t    Handle;
-	#ifdef __OS2__
+	#if defined(__OS2__) || defined(__linux__)
 	int         WaitCount;
 	#endif
+	#ifdef __linux__
+	volatile int Destroyed; // the destructor releases the waiting threads
+	#endif
 
  public:
 	            Notification();
+	#ifdef __linux__
+	// The futex implementation works with any mutex, e.g. a FastMutex.
+	explicit    Notification(MutexBase& mutex);
+	#else
 	explicit    Notification(Mutex& mutex);
+	#endif
 	#if defined(_WIN32) || defined (__OS2__) // pthreads do not support public, named mutex objects for IPC
 	explicit    Notification(const char* name);// Creates a _named_ notification.
 	            Notification(const char* name, Mutex& mutex);// Creates a _named_ notification.
@@ -371,6 +418,14 @@ class Event
 	            Event();
 	explicit    Event(const char* name);
 
+#elif defined(__linux__)
+class Event
+{protected:
+	volatile int State; // futex, 0 = reset, 1 = set, 2 = reset with waiters, 3 = destroyed
+	int         WaitCount;
+ public:
+	            Event();
+
 #else   
 class Event : protected Notification
 {protected:
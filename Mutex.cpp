@@ -125,7 +125,15 @@ bool Mutex::Request(long ms)
 	if (ms == -1)
 		rc = pthread_mutex_lock(&Handle);
 	 else
-	{	const struct timespec d = {ms / 1000, ms % 1000 * 1000000};
+	{	// pthread_mutex_timedlock takes an absolute CLOCK_REALTIME time.
+		struct timespec d;
+		clock_gettime(CLOCK_REALTIME, &d);
+		d.tv_sec += ms / 1000;
+		d.tv_nsec += ms % 1000 * 1000000;
+		if (d.tv_nsec >= 1000000000)
+		{	d.tv_nsec -= 1000000000;
+			++d.tv_sec;
+		}
 		rc = pthread_mutex_timedlock(&Handle, &d);
 	}
 	return rc == 0;
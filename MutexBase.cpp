@@ -10,6 +10,13 @@
 
 #include "MMUtil+.h"
 
+#ifdef __linux__
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
 namespace MM {
 namespace IPC {
 
@@ -93,4 +100,34 @@ Interlock Interlock::Instance; // singleton
 
 #endif
 
+
+#ifdef __linux__
+/*****************************************************************************
+*
+*  futex system call wrapper
+*
+*****************************************************************************/
+
+void Futex::Deadline(struct timespec& ts, long ms)
+{	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += ms % 1000 * 1000000;
+	if (ts.tv_nsec >= 1000000000)
+	{	ts.tv_nsec -= 1000000000;
+		++ts.tv_sec;
+	}
+}
+
+bool Futex::Wait(volatile int* addr, int val, const struct timespec* deadline)
+{	// Unlike FUTEX_WAIT FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC time.
+	if (syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, val, deadline, NULL, FUTEX_BITSET_MATCH_ANY) == 0)
+		return true;
+	return errno != ETIMEDOUT; // EAGAIN: *addr != val, EINTR: signal
+}
+
+void Futex::Wake(volatile int* addr, int count)
+{	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+#endif
+
 }} // end namespace
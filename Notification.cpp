@@ -0,0 +1,84 @@
+/*****************************************************************************
+*
+*  Notification.cpp - platform specific wrapper of notification semaphore
+*
+*  Only the Linux implementation is part of this package. The others are
+*  in MMUtil+.
+*
+*****************************************************************************/
+
+
+#include "MMUtil+.h"
+#include <limits.h>
+#include <sched.h>
+
+namespace MM {
+namespace IPC {
+
+#ifdef __linux__
+/*****************************************************************************
+*
+*  Notification class
+*  The futex is a counter that each notification increments. A waiting
+*  thread sleeps as long as the counter has the value that it read while it
+*  owned the mutex, so no notification after that point is lost. Notify
+*  enters the kernel only if a thread waits. The destructor wakes all
+*  waiting threads and waits until they left the futex.
+*
+*****************************************************************************/
+
+Notification::Notification()
+ : Mux(new FastMutex())
+ , Handle(0)
+ , WaitCount(0)
+ , Destroyed(0)
+{}
+
+Notification::Notification(MutexBase& mutex)
+ : Mux(mutex)
+ , Handle(0)
+ , WaitCount(0)
+ , Destroyed(0)
+{}
+
+Notification::~Notification()
+{	__atomic_store_n(&Destroyed, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&Handle, 1, __ATOMIC_SEQ_CST);
+	Futex::Wake(&Handle, INT_MAX);
+	// The waiting threads still access Handle and Destroyed.
+	while (__atomic_load_n(&WaitCount, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+bool Notification::Wait(long ms)
+{	if (__atomic_load_n(&Destroyed, __ATOMIC_ACQUIRE))
+		return false;
+	struct timespec deadline;
+	if (ms != -1)
+		Futex::Deadline(deadline, ms);
+	const int seq = __atomic_load_n(&Handle, __ATOMIC_ACQUIRE);
+	__atomic_add_fetch(&WaitCount, 1, __ATOMIC_SEQ_CST);
+	Mux->Release();
+	bool ret = Futex::Wait(&Handle, seq, ms == -1 ? NULL : &deadline)
+		&& !__atomic_load_n(&Destroyed, __ATOMIC_ACQUIRE);
+	__atomic_sub_fetch(&WaitCount, 1, __ATOMIC_RELEASE);
+	Mux->Request();
+	return ret;
+}
+
+bool Notification::Notify()
+{	__atomic_add_fetch(&Handle, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&WaitCount, __ATOMIC_SEQ_CST))
+		Futex::Wake(&Handle, 1);
+	return true;
+}
+
+bool Notification::NotifyAll()
+{	__atomic_add_fetch(&Handle, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&WaitCount, __ATOMIC_SEQ_CST))
+		Futex::Wake(&Handle, INT_MAX);
+	return true;
+}
+#endif
+
+}} // end namespace
@@ -6,7 +6,7 @@
 #include <stdlib.h>
 
 class PerfCount
-{	uint32_t Loops;
+{	uint64_t Loops;
 	uint64_t BytesSoFar;
 	uint64_t StartTime;
 	int32_t Freq;
@@ -18,7 +18,7 @@ class PerfCount
 	void Update(size_t bytes);
 	void TimeCheck() const        { if (!tvalid) TimeUpdate(); }
 	uint64_t getBytes() const     { return BytesSoFar; }
-	uint32_t getBlocks() const    { return Loops; }
+	uint64_t getBlocks() const    { return Loops; }
 	double getSeconds() const     { TimeCheck(); return (double)Elapsed / Freq; }
 	double getRate() const;
 	double getBlockRate() const;
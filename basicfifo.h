@@ -0,0 +1,1048 @@
+#ifndef __basicfifo_h
+#define __basicfifo_h
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+
+#include <MMUtil+.h>
+
+#include "storage.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#if !defined(__OS2__) && !defined(_WIN32)
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+/*****************************************************************************
+*
+*  basicfifo.h - compile time configurable fifo buffer
+*
+*  BasicFIFO<StoragePolicy, SyncPolicy, WaitPolicy> is the core of the fifo
+*  buffers without any virtual function. All functions are defined inline,
+*  so an application that uses a concrete instantiation directly gets the
+*  request and commit calls compiled into its own loops. The policies select
+*  the memory of the ring buffer, the synchronization of the two sides and
+*  the way a side waits for the other one at a water mark. The wait
+*  policies that sleep record the wakeup latency in the statistics.
+*  The public functions have the same semantics as the Drain and Source
+*  interfaces in fifo.h. Up to slots requests may be outstanding at each
+*  side. They may be committed in any order. The data becomes visible to
+*  the other side when all older requests of the same side are committed
+*  as well. Only the most recent outstanding request may be committed with
+*  a length less than requested.
+*  Each side must be used by only one thread at a time.
+*  With DynamicStorage and MutexSync the buffer can be resized while the
+*  data flows. The water marks can be changed at any time. They can also
+*  be given in seconds of output at the measured rate of the reader, and
+*  the time that data waits for the high water mark can be limited.
+*  For real time streams the fifo can be lossy: a full buffer drops the
+*  oldest data instead of blocking the writer and an empty buffer passes a
+*  fill pattern at a fixed rate instead of blocking the reader.
+*  This header does not need any other part of buffer2 except for
+*  DynamicStorage (storage.cpp) and the IPC classes of MMUtil used by
+*  MutexSync and CondVarWait.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+// Statistics of all fifo implementations.
+struct FIFOStatistics
+{  uint64_t EmptyCount;
+   uint64_t FullCount;
+   uint64_t SplitCount; // Requests that are split at the end of the buffer
+                        // or would have been split if the buffer was not mirrored.
+   double AllocTime;    // Seconds to allocate the buffer memory.
+   double PrefaultTime; // Seconds to prefault the buffer memory.
+   uint64_t ResidentSize;     // Bytes of buffer memory currently allocated.
+   uint64_t PeakResidentSize; // Maximum of ResidentSize so far.
+   uint64_t SpillBytes;       // Bytes written to the spill file.
+   uint64_t PeakSpillSize;    // Maximum amount of data in the spill file.
+   int SpillError;            // Error code of the first failed write to the spill file.
+   uint64_t CompressIn;       // Bytes passed to the compressor.
+   uint64_t CompressOut;      // Bytes stored for them, raw blocks included.
+   uint64_t RawBlocks;        // Blocks stored raw because they did not shrink.
+   double CompressTime;       // CPU seconds to compress.
+   double DecompressTime;     // CPU seconds to decompress.
+   uint64_t SpinWakeups;      // Waits that ended while spinning.
+   uint64_t SleepWakeups;     // Waits that ended after sleeping.
+   uint64_t WakeLatency;      // Nanoseconds from the wakeup by the other side until
+                              // the waiting side runs, sum over all wakeups.
+   uint64_t MaxWakeLatency;   // Maximum nanoseconds of a single wakeup.
+   uint64_t SpinTime;         // Nanoseconds spent spinning.
+   double OutputRate;         // Measured bytes per second of the reader for the
+                              // time based water marks, 0 if not measured.
+   uint64_t BytesIn;          // Bytes committed by the writer.
+   uint64_t BytesOut;         // Bytes committed by the reader.
+   double FullTime;           // Seconds the writer waited at a full buffer.
+   double EmptyTime;          // Seconds the reader waited at an empty buffer.
+   uint64_t DroppedBytes;     // Unread bytes dropped to make room for the writer.
+   uint64_t FillBytes;        // Bytes of the fill pattern passed to the reader.
+   FIFOStatistics() : EmptyCount(0), FullCount(0), SplitCount(0), AllocTime(0), PrefaultTime(0), ResidentSize(0), PeakResidentSize(0)
+   , SpillBytes(0), PeakSpillSize(0), SpillError(0), CompressIn(0), CompressOut(0), RawBlocks(0), CompressTime(0), DecompressTime(0)
+   , SpinWakeups(0), SleepWakeups(0), WakeLatency(0), MaxWakeLatency(0), SpinTime(0), OutputRate(0)
+   , BytesIn(0), BytesOut(0), FullTime(0), EmptyTime(0), DroppedBytes(0), FillBytes(0) {}
+};
+
+// ********** Storage policies
+// A storage policy owns the memory of the ring buffer. It is constructed
+// from its Arg type.
+
+// Ring buffer of N bytes inside the fifo object, no heap allocation at all.
+template <size_t N>
+class StaticStorage
+{private:
+   char Buffer[N];
+ public:
+   typedef int Arg;
+   explicit StaticStorage(Arg = 0)      {}
+   char* begin()                        { return Buffer; }
+   size_t size() const                  { return N; }
+   bool isMirrored() const              { return false; }
+   double getAllocTime() const          { return 0; }
+   double getPrefaultTime() const       { return 0; }
+};
+
+// Ring buffer of a size chosen at run time on the heap.
+class VectorStorage
+{private:
+   std::vector<char> Buffer;
+ public:
+   typedef size_t Arg;
+   explicit VectorStorage(Arg size) : Buffer(size) {}
+   char* begin()                        { return &Buffer[0]; }
+   size_t size() const                  { return Buffer.size(); }
+   bool isMirrored() const              { return false; }
+   double getAllocTime() const          { return 0; }
+   double getPrefaultTime() const       { return 0; }
+};
+
+// Ring buffer in a Storage object, i.e. any memory type of storage.h.
+// The policy takes the ownership of the storage object.
+class DynamicStorage
+{private:
+   std::auto_ptr<Storage> Buffer;
+ public:
+   typedef Storage* Arg;
+   explicit DynamicStorage(Arg storage) : Buffer(storage) {}
+   // Replace the storage and return the previous one to the caller.
+   Storage* Replace(Arg storage)        { Storage* old = Buffer.release(); Buffer.reset(storage); return old; }
+   char* begin()                        { return Buffer->begin(); }
+   size_t size() const                  { return Buffer->size(); }
+   bool isMirrored() const              { return Buffer->isMirrored(); }
+   double getAllocTime() const          { return Buffer->getAllocTime(); }
+   double getPrefaultTime() const       { return Buffer->getPrefaultTime(); }
+};
+
+// ********** Synchronization policies
+// A sync policy provides the Guard that is held by the fifo operations.
+// Serialized is true if the Guard excludes all other operations.
+// The stream positions are always exchanged by atomic loads and stores
+// because the wait policies check them without the guard.
+
+// No lock at all. The sides only exchange their stream positions with
+// acquire/release semantics.
+struct LockFreeSync
+{  enum { Serialized = false };
+   class Guard
+   {public:
+      explicit Guard(LockFreeSync&) {}
+      bool Request()                    { return true; }
+      bool Release()                    { return true; }
+   };
+   static void Increment(volatile uint64_t& value)
+   {  __atomic_add_fetch(&value, 1, __ATOMIC_RELAXED);
+   }
+};
+
+// All operations of both sides are serialized by a mutex.
+struct MutexSync : public IPC::FastMutex
+{  enum { Serialized = true };
+   typedef IPC::Lock Guard;
+   static void Increment(volatile uint64_t& value)
+   {  ++value;
+   }
+};
+
+// ********** Wait policies
+// A wait policy is the place where one side of the fifo waits for the
+// other side. Park returns when (owner.*ready)() is true or when Wake is
+// called or at the deadline, a WaitClock time unless 0. It may return
+// spuriously. Wake wakes the owner of the spot if and only if it is parked
+// and returns true in this case.
+// Park may count its wakeups in stat. Both sides and Resize may do so at
+// the same time, so the counters are updated atomically.
+
+// Monotonic time in nanoseconds for the wakeup statistics.
+// Always 0 if the platform has no suitable clock.
+inline uint64_t WaitClock()
+{
+   #if !defined(__OS2__) && !defined(_WIN32)
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+   #else
+   return 0;
+   #endif
+}
+
+// Count a wakeup of a wait that started at start. stamp is the time of the
+// last Wake call. It does not belong to this wait if it is older.
+inline void CountWakeup(volatile FIFOStatistics& stat, bool slept, uint64_t start, uint64_t stamp)
+{  __atomic_add_fetch(slept ? &stat.SleepWakeups : &stat.SpinWakeups, 1, __ATOMIC_RELAXED);
+   if (stamp == 0 || stamp < start)
+      return;
+   const uint64_t now = WaitClock();
+   const uint64_t latency = now > stamp ? now - stamp : 0;
+   __atomic_add_fetch(&stat.WakeLatency, latency, __ATOMIC_RELAXED);
+   uint64_t max = __atomic_load_n(&stat.MaxWakeLatency, __ATOMIC_RELAXED);
+   while (latency > max && !__atomic_compare_exchange_n(&stat.MaxWakeLatency, &max, latency, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Busy waiting. Lowest latency, but the waiting side burns a CPU core.
+class SpinWait
+{public:
+   template <class O>
+   void Park(const O& owner, bool (O::*ready)() const, volatile FIFOStatistics&, uint64_t deadline = 0)
+   {  for (unsigned i = 1; !(owner.*ready)(); ++i)
+      {
+         #if defined(__i386__) || defined(__x86_64__)
+         __builtin_ia32_pause();
+         #endif
+         if ((i & 1023) == 0)
+         {
+            #if !defined(__OS2__) && !defined(_WIN32)
+            sched_yield();
+            #endif
+            if (deadline && WaitClock() >= deadline)
+               return;
+         }
+      }
+   }
+   bool Wake()
+   {  return false;
+   }
+};
+
+// Notification object that is not touched unless a thread is parked.
+// The notification uses its own mutex, a FastMutex on Linux.
+class CondVarWait
+{private:
+   volatile int      Parked; // The owner is about to sleep or sleeping.
+   volatile unsigned Wakeup; // Sequence counter incremented by each wakeup.
+   volatile uint64_t Stamp;  // Time of the last wakeup.
+   IPC::Notification Event;
+ public:
+   CondVarWait() : Parked(0), Wakeup(0), Stamp(0) {}
+   template <class O>
+   void Park(const O& owner, bool (O::*ready)() const, volatile FIFOStatistics& stat, uint64_t deadline = 0)
+   {  const uint64_t start = WaitClock();
+      IPC::Lock lc(Event);
+      unsigned seq = Wakeup;
+      __atomic_store_n(&Parked, 1, __ATOMIC_SEQ_CST);
+      // The ready condition uses acquire loads. They must not pass the store.
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (!(owner.*ready)() && seq == Wakeup && (!deadline || start < deadline))
+      {  // The notification takes a relative timeout in ms.
+         if (Event.Wait(deadline ? (long)((deadline - start + 999999) / 1000000) : -1))
+            CountWakeup(stat, true, start, Stamp);
+      }
+      Parked = 0;
+   }
+   bool Wake()
+   {  if (!__atomic_load_n(&Parked, __ATOMIC_RELAXED) || !__atomic_exchange_n(&Parked, 0, __ATOMIC_SEQ_CST))
+         return false;
+      IPC::Lock lc(Event);
+      Stamp = WaitClock();
+      ++Wakeup;
+      Event.NotifyAll();
+      return true;
+   }
+};
+
+#ifdef __linux__
+// Futex on Linux. The kernel is only entered by a thread that really waits
+// and by the thread that wakes it.
+class FutexWait
+{private:
+   volatile int      Parked; // The owner is about to sleep or sleeping.
+   volatile unsigned Wakeup; // Sequence counter incremented by each wakeup.
+   volatile uint64_t Stamp;  // Time of the last wakeup.
+ public:
+   FutexWait() : Parked(0), Wakeup(0), Stamp(0) {}
+   template <class O>
+   void Park(const O& owner, bool (O::*ready)() const, volatile FIFOStatistics& stat, uint64_t deadline = 0)
+   {  const uint64_t start = WaitClock();
+      unsigned seq = __atomic_load_n(&Wakeup, __ATOMIC_ACQUIRE);
+      __atomic_store_n(&Parked, 1, __ATOMIC_SEQ_CST);
+      // Dekker style handshake with Wake: either we see the state change of
+      // the other side here or the other side sees Parked and changes Wakeup.
+      // This requires a full fence, the ready condition uses acquire loads.
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (!(owner.*ready)() && (!deadline || start < deadline))
+      {  // The timeout of FUTEX_WAIT is relative and measured by CLOCK_MONOTONIC.
+         struct timespec timeout;
+         timeout.tv_sec = (deadline - start) / 1000000000U;
+         timeout.tv_nsec = (deadline - start) % 1000000000U;
+         if (syscall(SYS_futex, &Wakeup, FUTEX_WAIT_PRIVATE, seq, deadline ? &timeout : NULL, NULL, 0) == 0)
+            CountWakeup(stat, true, start, __atomic_load_n(&Stamp, __ATOMIC_RELAXED));
+      }
+      __atomic_store_n(&Parked, 0, __ATOMIC_RELAXED);
+   }
+   bool Wake()
+   {  if (!__atomic_load_n(&Parked, __ATOMIC_RELAXED) || !__atomic_exchange_n(&Parked, 0, __ATOMIC_SEQ_CST))
+         return false;
+      __atomic_store_n(&Stamp, WaitClock(), __ATOMIC_RELAXED);
+      __atomic_add_fetch(&Wakeup, 1, __ATOMIC_RELEASE);
+      syscall(SYS_futex, &Wakeup, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+      return true;
+   }
+};
+#else
+// no futex on this platform
+typedef CondVarWait FutexWait;
+#endif
+
+// Spin then sleep. The waiting side polls the wakeup condition with a pause
+// instruction for a limited time before it sleeps in a FutexWait. So a
+// short wait costs no system call at both sides and the latency is that of
+// a memory access. The time limit adapts to the recent waits: it is twice
+// the moving average of the waits that took less than MaxSpin, each longer
+// wait halves it. So a side that always waits long hardly spins at all.
+// On a single CPU the other side cannot continue while this one spins, so
+// it sleeps immediately as FutexWait.
+// The spin time is counted in the statistics to compare it with the latency.
+class AdaptiveWait
+{private:
+   enum
+   {  MinSpin = 1000,     // spin time limits in ns
+      MaxSpin = 100000
+   };
+   const bool        Spin;     // Spinning makes sense on this machine.
+   volatile int      Spinning; // The owner polls the wakeup condition.
+   volatile uint64_t Stamp;    // Time of the last Wake while spinning.
+   uint64_t          AvgWait;  // Moving average of the short waits in ns.
+   FutexWait         Sleep;
+ public:
+   AdaptiveWait()
+    #if !defined(__OS2__) && !defined(_WIN32)
+    : Spin(sysconf(_SC_NPROCESSORS_ONLN) > 1)
+    #else
+    : Spin(false) // no clock to limit the spinning
+    #endif
+    , Spinning(0), Stamp(0), AvgWait(MinSpin) {}
+   template <class O>
+   void Park(const O& owner, bool (O::*ready)() const, volatile FIFOStatistics& stat, uint64_t deadline = 0)
+   {  if (!Spin)
+      {  Sleep.Park(owner, ready, stat, deadline);
+         return;
+      }
+      const uint64_t start = WaitClock();
+      uint64_t limit = std::min<uint64_t>(std::max<uint64_t>(2 * AvgWait, MinSpin), MaxSpin);
+      if (deadline)
+      {  if (start >= deadline)
+            return;
+         limit = std::min(limit, deadline - start);
+      }
+      __atomic_store_n(&Spinning, 1, __ATOMIC_SEQ_CST);
+      bool done;
+      uint64_t now = start;
+      for (unsigned i = 1; !(done = (owner.*ready)()); ++i)
+      {
+         #if defined(__i386__) || defined(__x86_64__)
+         __builtin_ia32_pause();
+         #endif
+         // The clock is slower than the condition, do not ask it each time.
+         if ((i & 15) == 0 && (now = WaitClock()) - start >= limit)
+            break;
+      }
+      __atomic_store_n(&Spinning, 0, __ATOMIC_RELAXED);
+      if (done)
+      {  now = WaitClock();
+         CountWakeup(stat, false, start, __atomic_load_n(&Stamp, __ATOMIC_RELAXED));
+      }
+      __atomic_add_fetch(&stat.SpinTime, now - start, __ATOMIC_RELAXED);
+      if (!done)
+      {  Sleep.Park(owner, ready, stat, deadline);
+         now = WaitClock();
+      }
+      const uint64_t waited = now - start;
+      if (waited < MaxSpin)
+         AvgWait += ((int64_t)waited - (int64_t)AvgWait) / 8;
+       else
+         AvgWait /= 2;
+   }
+   bool Wake()
+   {  if (__atomic_load_n(&Spinning, __ATOMIC_RELAXED))
+         __atomic_store_n(&Stamp, WaitClock(), __ATOMIC_RELAXED);
+      return Sleep.Wake();
+   }
+};
+
+// ********** The fifo
+
+template <class StoragePolicy, class SyncPolicy, class WaitPolicy>
+class BasicFIFO
+{public:
+   typedef typename StoragePolicy::Arg StorageArg;
+   typedef FIFOStatistics Statistics;
+ private:   // internal types
+   enum
+   {  CacheLineSize = 64,
+      RatePeriod = 250000000, // ns of reading per sample of the output rate
+      FillPeriod = 10000000 // ns of data per chunk of the fill pattern
+   };
+   typedef typename SyncPolicy::Guard Guard;
+   // phases of Resize
+   enum ResizeState
+   {  Running,              // no resize in progress
+      StopWriter,           // no new write requests
+      StopBoth              // no new requests at all
+   };
+   // outstanding request
+   struct Request
+   {  uint64_t Pos;        // stream position of the request
+      size_t Len;          // length of the request
+      bool Done;           // request is committed
+   };
+   // queue of outstanding requests in the order they were issued
+   class RequestQueue
+   {private:
+      std::vector<Request> Slots;
+      size_t Head;
+      size_t Count;
+    public:
+      explicit RequestQueue(size_t slots) : Slots(slots), Head(0), Count(0) {}
+      bool empty() const        { return Count == 0; }
+      bool full() const         { return Count == Slots.size(); }
+      size_t size() const       { return Count; }
+      // i-th outstanding request, 0 is the oldest one
+      Request& operator[](size_t i) { return Slots[(Head + i) % Slots.size()]; }
+      void push_back(uint64_t pos, size_t len)
+      {  Request& req = Slots[(Head + Count++) % Slots.size()];
+         req.Pos = pos;
+         req.Len = len;
+         req.Done = false;
+      }
+      void pop_front()          { Head = (Head + 1) % Slots.size(); --Count; }
+      void clear()              { Count = 0; }
+      // Find the outstanding request at pos or return -1.
+      size_t find(uint64_t pos)
+      {  for (size_t i = 0; i < Count; ++i)
+         {  const Request& req = (*this)[i];
+            if (req.Pos == pos && !req.Done)
+               return i;
+         }
+         return (size_t)-1;
+      }
+   };
+   // One side of the fifo. Only the owning side writes Count and ReqCount.
+   struct Cursor
+   {  volatile uint64_t Count;    // Committed stream position.
+      volatile uint64_t ReqCount; // End of the outstanding requests.
+      RequestQueue Req;           // Outstanding requests.
+      WaitPolicy Spot;            // Owner waits here.
+      explicit Cursor(unsigned slots) : Count(0), ReqCount(0), Req(slots) {}
+   };
+
+ private:   // internal quasi-constant objects
+   StoragePolicy Buffer;
+   char* BufferBegin;
+   size_t BufferSize;
+   size_t LowWaterMark;
+   size_t HighWaterMark;
+ private:   // internal state, each side on its own cache line
+   char Pad0[CacheLineSize];
+   Cursor Wr;
+   char Pad1[CacheLineSize];
+   Cursor Rd;
+   char Pad2[CacheLineSize];
+   bool volatile EOS; // end of stream flag
+   bool volatile Die; // destroy-flag
+   int volatile Resizing; // ResizeState
+   size_t volatile WrMin; // free space the parked writer waits for
+   size_t ResizeTarget;   // size of the new storage
+ private:   // time based limits in WaitClock units, 0 = off
+   uint64_t HighWaterTime;       // high water mark in time of output
+   uint64_t LowWaterTime;        // low water mark in time of output
+   volatile uint64_t MaxLatency; // maximum time data waits for the high water mark
+   volatile uint64_t DataTime;   // time of the last commit into the empty buffer
+   // measurement of the output rate, reader side only
+   double OutputRate;     // bytes per ns, 0 = unknown
+   uint64_t RateStart;    // start of the current period or 0 while the reader waits
+   uint64_t RateCount;    // Rd.Count at RateStart
+   uint64_t RateBytes;    // bytes read in the completed periods of this sample
+   uint64_t RateTime;     // duration of these periods
+ private:   // lossy operation
+   bool volatile DropOldest;   // a full buffer drops data instead of blocking the writer
+   std::vector<char> FillData; // fill pattern repeated to one chunk, empty = off
+   size_t FillPattern;    // length of the pattern
+   double FillRate;       // bytes per ns
+   uint64_t FillDue;      // time of the next chunk, reader side only
+   size_t FillReq;        // length of the outstanding fill request or 0
+   bool Filling;          // the reader gets fill until ReaderReady
+ private:   // internal semaphores
+   SyncPolicy Sync;
+   WaitPolicy ResizeSpot; // Resize waits here
+ private:   // statistics
+   Statistics Stat;
+
+ public:    // public interface
+   // Constructor for a fifo in the storage given by arg.
+   // slots is the maximum number of outstanding requests at each side.
+   BasicFIFO(StorageArg arg, double highwater, double lowwater, unsigned slots = 1)
+    : Buffer(arg)
+    , BufferBegin(Buffer.begin())
+    , BufferSize(Buffer.size())
+    , Wr(slots)
+    , Rd(slots)
+    , EOS(false)
+    , Die(false)
+    , Resizing(Running)
+    , WrMin(1)
+    , ResizeTarget(0)
+    , HighWaterTime(0)
+    , LowWaterTime(0)
+    , MaxLatency(0)
+    , DataTime(0)
+    , OutputRate(0)
+    , RateStart(0)
+    , RateCount(0)
+    , RateBytes(0)
+    , RateTime(0)
+    , DropOldest(false)
+    , FillPattern(0)
+    , FillRate(0)
+    , FillDue(0)
+    , FillReq(0)
+    , Filling(false)
+   {  if (slots == 0)
+         throw std::invalid_argument("The fifo requires at least one request slot.");
+      LowWaterMark = Part2Bytes(lowwater);
+      HighWaterMark = Part2Bytes(highwater);
+      Stat.AllocTime = Buffer.getAllocTime();
+      Stat.PrefaultTime = Buffer.getPrefaultTime();
+      Stat.ResidentSize = Stat.PeakResidentSize = BufferSize;
+   }
+   ~BasicFIFO()
+   {  Store(Die, true);
+      Wr.Spot.Wake();
+      Rd.Spot.Wake();
+      ResizeSpot.Wake();
+   }
+
+   volatile const Statistics& getStatistics() const { return Stat; }
+   // Buffer size in bytes.
+   size_t getSize()
+   {  Guard lc(Sync);
+      return BufferSize;
+   }
+   // Committed data in the buffer.
+   size_t getLevel() const
+   {  return (size_t)(Load(Wr.Count) - Load(Rd.Count));
+   }
+   // Current water marks in bytes.
+   size_t getHighWaterMark() const { return HighWaterMark; }
+   size_t getLowWaterMark() const  { return LowWaterMark; }
+
+   // Change the water marks. The levels are relative to the buffer size.
+   // This turns off the time based water marks.
+   void SetWaterMarks(double highwater, double lowwater)
+   {  {  Guard lc(Sync);
+         size_t high = Part2Bytes(highwater);
+         LowWaterMark = Part2Bytes(lowwater);
+         HighWaterMark = high;
+         HighWaterTime = LowWaterTime = 0;
+      }
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      // The wakeup conditions have changed.
+      if (WriterReady())
+         Wr.Spot.Wake();
+      if (ReaderReady())
+         Rd.Spot.Wake();
+   }
+   // Set the water marks in seconds of output, i.e. the time the reader
+   // needs for the data at its measured rate, and the maximum time data
+   // waits in the buffer for the high water mark. The reader is released
+   // when the first data that it has not seen yet is that old. 0 turns a
+   // limit off. Until the rate is known the water marks in bytes apply.
+   void SetTimeLimits(double highsecs, double lowsecs, double maxlatency)
+   {  if (highsecs < 0 || lowsecs < 0 || maxlatency < 0)
+         throw std::invalid_argument("The time limits of the fifo must not be negative.");
+      if (WaitClock() == 0)
+         throw std::runtime_error("The time limits of the fifo are not supported on this platform.");
+      {  Guard lc(Sync);
+         HighWaterTime = (uint64_t)(highsecs * 1E9 + .5);
+         LowWaterTime = (uint64_t)(lowsecs * 1E9 + .5);
+         Store(MaxLatency, (uint64_t)(maxlatency * 1E9 + .5));
+         ApplyOutputRate();
+      }
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      Wr.Spot.Wake();
+      Rd.Spot.Wake();
+   }
+   // Let a full buffer drop the oldest unread data instead of blocking the
+   // writer. The data that the reader has requested is kept. The writer
+   // still waits if the reader has requested all data, or if the reader
+   // and the writer both have outstanding requests. This requires a
+   // serialized sync policy.
+   void SetOverflow(bool dropoldest)
+   {  (void)sizeof(char[SyncPolicy::Serialized ? 1 : -1]); // the writer moves the read position
+      Store(DropOldest, dropoldest);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      Wr.Spot.Wake();
+   }
+   // Pass the pattern of len bytes to the reader at rate bytes per second
+   // instead of blocking it while the buffer is empty or until the data
+   // reaches the high water mark again. The chunks are multiples of the
+   // pattern. rate = 0 turns this off.
+   void SetUnderrun(const void* pattern, size_t len, double rate)
+   {  if (rate < 0 || (rate && len == 0))
+         throw std::invalid_argument("The fill pattern must not be empty and the fill rate must not be negative.");
+      if (rate && WaitClock() == 0)
+         throw std::runtime_error("The fill pattern of the fifo is not supported on this platform.");
+      {  Guard lc(Sync);
+         if (FillReq)
+            throw std::logic_error("The fill pattern cannot be changed while the reader uses it.");
+         FillData.clear();
+         FillRate = rate / 1E9;
+         FillPattern = len;
+         Filling = false;
+         if (rate)
+         {  size_t chunk = std::max<size_t>((size_t)(rate * FillPeriod / 1E9) / len, 1) * len;
+            for (size_t i = 0; i < chunk; i += len)
+               FillData.insert(FillData.end(), (const char*)pattern, (const char*)pattern + len);
+         }
+      }
+      Rd.Spot.Wake();
+   }
+   // Replace the storage by the one given by arg without losing data.
+   // This requires a storage policy with Replace and a serialized sync
+   // policy. First the writer is stopped until the data fits into the new
+   // storage and has no outstanding requests. Then the reader is stopped
+   // until it has no outstanding requests. A side that waits in a request
+   // must not have other outstanding requests. The data is copied while both
+   // sides wait. The water marks keep their relative level.
+   // Returns false and discards the new storage if the stream ends before.
+   bool Resize(StorageArg arg)
+   {  (void)sizeof(char[SyncPolicy::Serialized ? 1 : -1]); // requires a serialized sync policy
+      std::auto_ptr<Storage> storage(arg);
+      Guard lc(Sync);
+      if (Resizing != Running)
+         throw std::logic_error("The fifo is already being resized.");
+      ResizeTarget = storage->size();
+      for (int phase = StopWriter; phase <= StopBoth; ++phase)
+      {  Store(Resizing, phase);
+         bool (BasicFIFO::*ready)() const = phase == StopWriter ? &BasicFIFO::WriterStopped : &BasicFIFO::ReaderStopped;
+         while (!(this->*ready)())
+         {  lc.Release();
+            ResizeSpot.Park(*this, ready, Stat);
+            lc.Request();
+         }
+         if (Load(EOS) || Load(Die))
+         {  Store(Resizing, (int)Running);
+            lc.Release();
+            Wr.Spot.Wake();
+            Rd.Spot.Wake();
+            return false;
+         }
+      }
+      // copy the data to the same stream positions in the new ring
+      const size_t size = storage->size();
+      char* const dst = storage->begin();
+      for (uint64_t pos = Rd.Count; pos != Wr.Count; )
+      {  size_t from = (size_t)(pos % BufferSize);
+         size_t to = (size_t)(pos % size);
+         size_t len = (size_t)std::min<uint64_t>(Wr.Count - pos, std::min(BufferSize - from, size - to));
+         memcpy(dst + to, BufferBegin + from, len);
+         pos += len;
+      }
+      LowWaterMark = (size_t)((double)LowWaterMark * size / BufferSize + .5);
+      HighWaterMark = (size_t)((double)HighWaterMark * size / BufferSize + .5);
+      delete Buffer.Replace(storage.release());
+      BufferBegin = Buffer.begin();
+      BufferSize = size;
+      ApplyOutputRate();
+      Stat.ResidentSize = BufferSize;
+      if (Stat.PeakResidentSize < BufferSize)
+         Stat.PeakResidentSize = BufferSize;
+      Store(Resizing, (int)Running);
+      lc.Release();
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      Wr.Spot.Wake();
+      Rd.Spot.Wake();
+      return true;
+   }
+
+   // @see Drain::RequestWrite, Drain::RequestWriteMin
+   // A minimum length above 1 requires a mirrored storage.
+   void RequestWrite(void*& data, size_t& len, size_t min = 1)
+   {  Guard lc(Sync);
+      if (Wr.Req.full())
+         throw std::logic_error("The number of outstanding write requests exceeds the slots of the fifo.");
+      if (min > len || (min > 1 && !Buffer.isMirrored()))
+         throw std::logic_error("The minimum length of a write request must not exceed the requested length and requires a mirrored buffer.");
+      for (;;)
+      {  if (Load(EOS) || Load(Die))
+         {  len = 0;
+            return;
+         }
+         if (Load(Resizing) != Running)
+         {  lc.Release();
+            Wr.Spot.Park(*this, &BasicFIFO::ResizeDone, Stat);
+            lc.Request();
+            continue;
+         }
+         if (min > BufferSize)
+            throw std::logic_error("The minimum length of a write request exceeds the buffer size.");
+         size_t rem = BufferSize - (size_t)(Wr.ReqCount - Load(Rd.Count));
+         if (rem > 0 && rem >= min)
+         {  if (len > rem)
+               len = rem;
+            len = ClipAtEnd(Wr.ReqCount, len);
+            data = BufferBegin + Wr.ReqCount % BufferSize;
+            Wr.Req.push_back(Wr.ReqCount, len);
+            Store(Wr.ReqCount, Wr.ReqCount + len);
+            return;
+         }
+         if (SyncPolicy::Serialized && Load(DropOldest) && Wr.Count != Rd.ReqCount && (Rd.Req.empty() || Wr.Req.empty()))
+         {  size_t drop = (size_t)std::min<uint64_t>(len, Wr.Count - Rd.ReqCount);
+            if (Rd.Req.empty())
+            {  // Drop the oldest data as if the reader had read it.
+               Store(Rd.Count, Rd.Count + drop);
+               Store(Rd.ReqCount, Rd.Count);
+               RateCount += drop; // no output
+            } else
+               DropBehindReader(drop);
+            Stat.DroppedBytes += drop;
+            continue;
+         }
+         ++Stat.FullCount;
+         Store(WrMin, min);
+         lc.Release();
+         if (min > 1)
+         {  // The reader may wait for a high water mark that the level cannot reach.
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (ReaderReady())
+               Rd.Spot.Wake();
+         }
+         const uint64_t start = WaitClock();
+         Wr.Spot.Park(*this, &BasicFIFO::WriterReady, Stat);
+         Stat.FullTime += (WaitClock() - start) / 1E9;
+         lc.Request();
+         Store(WrMin, (size_t)1);
+      }
+   }
+   // @see Drain::CommitWrite
+   void CommitWrite(void* data, size_t len)
+   {  bool first = false;
+      {  Guard lc(Sync);
+         // With a latency limit the first data after the reader ran dry starts the clock.
+         if (Load(MaxLatency) && Load(Rd.ReqCount) == Wr.Count)
+         {  Store(DataTime, WaitClock());
+            first = true;
+         }
+         len = CommitRequest(Wr, data, len);
+         Stat.BytesIn += len; // only written by the writer
+      }
+      if (len != 0 && (first || ReaderReady()))
+         Rd.Spot.Wake();
+      if (Load(Resizing) != Running)
+         ResizeSpot.Wake();
+   }
+   // @see Drain::EndWrite
+   void EndWrite()
+   {  {  Guard lc(Sync);
+         Store(EOS, true); // end of stream marker
+         // cancel outstanding requests
+         Wr.Req.clear();
+         Store(Wr.ReqCount, Wr.Count);
+      }
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      Rd.Spot.Wake(); // notify the other side regardless of the high water mark.
+      ResizeSpot.Wake();
+   }
+   // @see Source::RequestRead
+   void RequestRead(void*& data, size_t& len)
+   {  Guard lc(Sync);
+      if (Rd.Req.full() || FillReq)
+         throw std::logic_error("The number of outstanding read requests exceeds the slots of the fifo.");
+      for (;;)
+      {  if (Load(Resizing) == StopBoth && !Load(Die))
+         {  lc.Release();
+            Rd.Spot.Park(*this, &BasicFIFO::ResizeDone, Stat);
+            lc.Request();
+            continue;
+         }
+         size_t rem = (size_t)(Load(Wr.Count) - Rd.ReqCount);
+         if (rem > 0 && (!Filling || FillDone()))
+         {  Filling = false;
+            if (len > rem)
+               len = rem;
+            len = ClipAtEnd(Rd.ReqCount, len);
+            data = BufferBegin + Rd.ReqCount % BufferSize;
+            Rd.Req.push_back(Rd.ReqCount, len);
+            Store(Rd.ReqCount, Rd.ReqCount + len);
+            return;
+         }
+         if (Load(Die))
+         {  len = 0;
+            return;
+         }
+         if (Load(EOS))
+         {  // The writer might have committed data before it set the EOS flag.
+            if (Load(Wr.Count) == Rd.ReqCount)
+            {  len = 0;
+               return;
+            }
+            continue;
+         }
+         if (!Filling)
+            ++Stat.EmptyCount;
+         MeasureOutput(true);
+         if (FillRate && Rd.Req.empty())
+         {  if (Fill(data, len))
+               return;
+            lc.Release();
+            Rd.Spot.Park(*this, &BasicFIFO::ReaderReady, Stat, FillDue);
+            lc.Request();
+            continue;
+         }
+         lc.Release();
+         const uint64_t start = WaitClock();
+         ParkReader();
+         Stat.EmptyTime += (WaitClock() - start) / 1E9;
+         lc.Request();
+      }
+   }
+   // @see Source::CommitRead
+   void CommitRead(void* data, size_t len)
+   {  {  Guard lc(Sync);
+         if (FillReq && data == &FillData[0])
+         {  if (len > FillReq)
+               throw std::logic_error("Cannot commit a larger buffer than requested.");
+            Stat.FillBytes += len; // only written by the reader
+            FillDue -= (uint64_t)((FillReq - len) / FillRate); // not passed on
+            FillReq = 0;
+            return;
+         }
+         len = CommitRequest(Rd, data, len);
+         Stat.BytesOut += len; // only written by the reader
+         MeasureOutput(false);
+      }
+      if (len != 0 && WriterReady())
+         Wr.Spot.Wake();
+      if (Load(Resizing) != Running)
+         ResizeSpot.Wake();
+   }
+   // @see Source::EndRead
+   void EndRead()
+   {  {  Guard lc(Sync);
+         Store(EOS, true); // end of stream marker
+         // cancel outstanding requests
+         Rd.Req.clear();
+         Store(Rd.ReqCount, Rd.Count);
+         FillReq = 0;
+      }
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      Wr.Spot.Wake(); // notify the other side regardless of the low water mark.
+      ResizeSpot.Wake();
+   }
+
+ private:
+   template <typename T>
+   static T Load(const volatile T& v)
+   {  return __atomic_load_n(&v, __ATOMIC_ACQUIRE);
+   }
+   template <typename T>
+   static void Store(volatile T& v, T value)
+   {  __atomic_store_n(&v, value, __ATOMIC_RELEASE);
+   }
+   size_t Part2Bytes(double part)
+   {  if (part < 0.0 || part > 1.0)
+         throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+      return (size_t)(BufferSize * part +.5);
+   }
+   // Wakeup conditions of the parked threads.
+   bool WriterReady() const
+   {  uint64_t rd = Load(Rd.Count);
+      return (BufferSize - (size_t)(Load(Wr.ReqCount) - rd) >= Load(WrMin) && (size_t)(Load(Wr.Count) - rd) <= LowWaterMark)
+         || (Load(DropOldest) && Load(Rd.ReqCount) == rd)
+         || Load(EOS) || Load(Die);
+   }
+   bool ReaderReady() const
+   {  uint64_t wr = Load(Wr.Count);
+      return (wr != Load(Rd.ReqCount) && ((size_t)(wr - Load(Rd.Count)) >= HighWaterMark || Load(WrMin) > 1))
+         || Load(EOS) || Load(Die);
+   }
+   // Conditions of the phases of Resize.
+   bool WriterStopped() const
+   {  uint64_t wr = Load(Wr.Count);
+      return (Load(Wr.ReqCount) == wr && (size_t)(wr - Load(Rd.Count)) <= ResizeTarget)
+         || Load(EOS) || Load(Die);
+   }
+   bool ReaderStopped() const
+   {  return Load(Rd.ReqCount) == Load(Rd.Count) || Load(EOS) || Load(Die);
+   }
+   bool ResizeDone() const
+   {  return Load(Resizing) == Running || Load(Die);
+   }
+   bool ReaderHasData() const
+   {  return Load(Wr.Count) != Load(Rd.ReqCount) || Load(EOS) || Load(Die);
+   }
+   // Park the reader until ReaderReady. With a latency limit it first waits
+   // for any data and then until the limit of this data expires at most.
+   void ParkReader()
+   {  uint64_t latency = Load(MaxLatency);
+      if (!latency)
+      {  Rd.Spot.Park(*this, &BasicFIFO::ReaderReady, Stat);
+         return;
+      }
+      while (latency && !ReaderReady())
+      {  if (!ReaderHasData())
+            Rd.Spot.Park(*this, &BasicFIFO::ReaderHasData, Stat);
+          else
+         {  const uint64_t deadline = Load(DataTime) + latency;
+            if (WaitClock() >= deadline)
+               return;
+            Rd.Spot.Park(*this, &BasicFIFO::ReaderReady, Stat, deadline);
+         }
+         latency = Load(MaxLatency);
+      }
+   }
+   // The reader may leave the fill pattern for the data: the high water mark
+   // is reached or the data waited for the latency limit.
+   bool FillDone() const
+   {  if (ReaderReady())
+         return true;
+      const uint64_t latency = Load(MaxLatency);
+      return latency && WaitClock() >= Load(DataTime) + latency;
+   }
+   // Pass the next chunk of the fill pattern if it is due.
+   bool Fill(void*& data, size_t& len)
+   {  const uint64_t now = WaitClock();
+      // Do not catch up on the time the reader spent elsewhere.
+      if (FillDue + FillPeriod < now)
+         FillDue = now;
+      if (FillDue > now)
+         return false;
+      Filling = true;
+      if (len > FillData.size())
+         len = FillData.size();
+       else if (len > FillPattern)
+         len -= len % FillPattern;
+      data = &FillData[0];
+      FillReq = len;
+      FillDue += (uint64_t)(len / FillRate);
+      return true;
+   }
+   // Measure the output rate while the reader runs, i.e. between the waits
+   // of the reader. A sample covers at least RatePeriod of reading except
+   // for the first one, that ends at the first wait.
+   void MeasureOutput(bool waiting)
+   {  if (!HighWaterTime && !LowWaterTime)
+         return;
+      const uint64_t now = WaitClock();
+      if (RateStart)
+      {  RateTime += now - RateStart;
+         RateBytes += Rd.Count - RateCount;
+      }
+      RateStart = waiting ? 0 : now;
+      RateCount = Rd.Count;
+      if (RateTime && RateBytes && (RateTime >= RatePeriod || (waiting && OutputRate == 0)))
+      {  const double rate = (double)RateBytes / RateTime;
+         OutputRate = OutputRate == 0 ? rate : (3 * OutputRate + rate) / 4;
+         Stat.OutputRate = OutputRate * 1E9;
+         RateBytes = RateTime = 0;
+         ApplyOutputRate();
+      }
+   }
+   // Derive the water marks from the time limits once the output rate is known.
+   void ApplyOutputRate()
+   {  if (OutputRate == 0)
+         return;
+      if (HighWaterTime)
+         HighWaterMark = (size_t)std::min<double>(HighWaterTime * OutputRate, BufferSize);
+      if (LowWaterTime)
+         LowWaterMark = (size_t)std::min<double>(LowWaterTime * OutputRate, BufferSize);
+   }
+   // Drop len bytes of committed data behind the outstanding read requests.
+   // The younger data moves down, so the writer continues at a lower stream
+   // position. Requires that the writer has no outstanding requests.
+   void DropBehindReader(size_t len)
+   {  const uint64_t end = Wr.Count - len;
+      for (uint64_t pos = Rd.ReqCount; pos != end; )
+      {  size_t to = (size_t)(pos % BufferSize);
+         size_t from = (size_t)((pos + len) % BufferSize);
+         size_t n = (size_t)std::min<uint64_t>(end - pos, std::min(BufferSize - to, BufferSize - from));
+         memmove(BufferBegin + to, BufferBegin + from, n);
+         pos += n;
+      }
+      Store(Wr.Count, end);
+      Store(Wr.ReqCount, end);
+   }
+   // Clip a request of len bytes at stream position pos to the end of the
+   // buffer unless the storage is mirrored.
+   size_t ClipAtEnd(uint64_t pos, size_t len)
+   {  size_t rem = BufferSize - (size_t)(pos % BufferSize);
+      if (len > rem)
+      {  SyncPolicy::Increment(Stat.SplitCount); // counted by both sides
+         if (!Buffer.isMirrored())
+            len = rem;
+      }
+      return len;
+   }
+   // Commit the outstanding request at data of side with length len.
+   // Returns the number of bytes that are completed in sequence by this call.
+   // The new committed position is published before the function returns.
+   size_t CommitRequest(Cursor& side, void* data, size_t len)
+   {  size_t i = (size_t)-1;
+      if (data >= BufferBegin && data < BufferBegin + BufferSize)
+      {  // map the pointer back to the stream position
+         uint64_t pos = side.Count - side.Count % BufferSize + ((char*)data - BufferBegin);
+         if (pos < side.Count)
+            pos += BufferSize;
+         i = side.Req.find(pos);
+      }
+      if (i == (size_t)-1)
+         throw std::logic_error("Cannot commit a buffer that is not requested before.");
+      Request& req = side.Req[i];
+      if (len > req.Len)
+         throw std::logic_error("Cannot commit a larger buffer than requested.");
+      if (len < req.Len)
+      {  if (i != side.Req.size() - 1)
+            throw std::logic_error("Only the most recent outstanding request can be committed with a smaller length.");
+         // give back the remaining part of the request
+         Store(side.ReqCount, req.Pos + len);
+         req.Len = len;
+      }
+      req.Done = true;
+      // collect the completed requests in sequence
+      size_t done = 0;
+      while (!side.Req.empty() && side.Req[0].Done)
+      {  done += side.Req[0].Len;
+         side.Req.pop_front();
+      }
+      if (done)
+      {  Store(side.Count, side.Count + done);
+         __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      }
+      return done;
+   }
+};
+
+}} // end namespace
+
+#endif
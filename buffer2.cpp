@@ -1,6 +1,17 @@
 #include "IOinterface.h"
 #include "buffer2.h"
 #include "fifo.h"
+#include "spscfifo.h"
+#include "segfifo.h"
+#include "spillfifo.h"
+#include "compressfifo.h"
+#include "persistfifo.h"
+#include "teefifo.h"
+#include "stagefifo.h"
+#include "splicefifo.h"
+#if !defined(__OS2__) && !defined(_WIN32)
+#include "shmfifo.h"
+#endif
 #include "PerfCount.h"
 
 #include <stdint.h>
@@ -8,6 +19,8 @@
 #include <climits>
 #include <cctype>
 #include <string>
+#include <vector>
+#include <deque>
 #include <memory>
 
 #ifdef __OS2__
@@ -15,6 +28,15 @@
 #else
 // use pthreads
 #include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 #endif
 
 using namespace std;
@@ -22,17 +44,41 @@ using namespace MM;
 using namespace MM::FIFO;
 using namespace MM::IPC;
 
-int BufferSize = 65536;
-int RequestSize = -1;
-int PipeSize = 8192;
+int64_t BufferSize = 65536;
+int64_t RequestSize = -1;
+int64_t PipeSize = 8192;
 unsigned BufferAlignment = 1U << 14; // MUST be a power of 2
 
-int iHighWaterMark = 0;
+int64_t iHighWaterMark = 0;
 double dHighWaterMark = -1; // invalid
-int iLowWaterMark = -1; // invalid
+int64_t iLowWaterMark = -1; // invalid
 double dLowWaterMark = 1;
 
+FIFOType FIFOImpl = FT_Static;
+int64_t SegmentSize = -1; // auto
+const char* FIFOPath = NULL; // spill directory or fifo file
+long SyncInterval = 1000; // ms
+Storage::Type MemoryType = Storage::Heap;
+bool PrefaultMemory = false;
+unsigned PrefaultThreads = 0; // auto
+bool LockMemory = false;
+bool LimitToCGroup = false;
+int64_t DetachLag = 0; // block
+MergeType MergeMode = MT_Sequential;
+unsigned MaxConnections = 0; // unlimited
+
+const char* ControlPath = NULL; // control socket
+double HighWaterTime = 0; // seconds of output, 0 = bytes
+double LowWaterTime = 0;
+double MaxLatency = 0; // seconds, 0 = no limit
+bool AutoWaterMarks = false;
+bool DropOldest = false; // lossy at a full buffer
+int64_t FillRate = 0; // bytes per second, 0 = block at an empty buffer
+vector<unsigned char> FillPattern(1, 0);
+unsigned QueueDepth = 0; // io_uring transfers in flight, 0 = synchronous I/O
+bool ZeroCopy = false; // vmsplice to a pipe
 bool EnableCache = false;
+bool DirectIO = false;
 #ifdef __OS2__
 bool AdvantageInput = false;
 bool AdvantageOutput = false;
@@ -46,6 +92,22 @@ volatile const MM::FIFO::FIFO::Statistics* FIFOstat;
 
 MM::IPC::Mutex LogMtx;
 
+// inputs from -i
+static vector<const char*> MoreInputs;
+// filters from -t
+static vector<const char*> Filters;
+// record framing from -e
+static const char* FramingSpec = NULL;
+static const IFraming* Framing = NULL;
+// fifo memory for the registered buffers of -q
+static void* FIFOMemory = NULL;
+static size_t FIFOMemorySize = 0;
+// regions of the fifo that a pipe may reference at once (-z)
+static const unsigned ZeroCopySlots = 16;
+static bool MergeInputs = false;
+
+#define SHMPREFIX "shm:"
+
 // worker base class
 class Worker
 {protected:
@@ -57,63 +119,137 @@ class Worker
 	int getResult() { return Result; }
 };
 
+#ifdef __OS2__
+static void runWorker(void* param)
+{	(*reinterpret_cast<Worker*>(param))();
+}
+#else
+// pthreads wont a return value
+static void* runWorker(void* param)
+{	(*reinterpret_cast<Worker*>(param))();
+	return NULL;
+}
+#endif
+
 // input worker class
 class InputWorker : public Worker
-{	Drain& Dst;
-	auto_ptr<IInput> Src;
+{	auto_ptr<IInput> Src;
+ protected:
+	Drain& Dst;
+	auto_ptr<PerfCount> Stats;
+	double NextStat;
+	size_t StatBytes;
+ protected:
+	explicit InputWorker(Drain& dst) : Dst(dst), NextStat(StatsUpdate), StatBytes(0) {}
+	// Count len bytes for the input statistics and print them from time to time.
+	void UpdateStats(size_t len);
+	void PrintStats();
+	// Copy the data from src to the fifo until the end of src.
+	// Returns false if the output side stopped working.
+	bool Transfer(IInput& src);
+	// Like Transfer, but commit only complete records (-e).
+	bool TransferRecords(IInput& src);
+	// The data transfer within the error handling of operator().
+	virtual void Run();
  public:
-	InputWorker(Drain& dst, IInput* src) : Dst(dst), Src(src) {}
+	InputWorker(Drain& dst, IInput* src) : Src(src), Dst(dst), NextStat(StatsUpdate), StatBytes(0) {}
 	virtual void operator()();
 };
 
-void InputWorker::operator()()
-{	try
-	{	// initialize input
-		Src->Initialize();
+void InputWorker::UpdateStats(size_t len)
+{	Stats->Update(len);
+	StatBytes += len;
+	if (StatBytes > StatusBytes)
+	{	StatBytes = 0;
+		double secs = Stats->getSeconds();
+		if (secs >= NextStat)
+		{	NextStat = secs + StatsUpdate;
+			PrintStats();
+		}
+	}
+}
 
-		auto_ptr<PerfCount> stats;
-		double nextstat = StatsUpdate;
-		size_t statbytes = 0;
-		if (EnableInputStats)
-			stats.reset(new PerfCount());
+void InputWorker::PrintStats()
+{	double secs = Stats->getSeconds();
+	lerr << "Input: " << Stats->getBytes()/1024 << " kiB at " << Stats->getBytes()/secs/1024. << " kiB/s, " << Stats->getAvgBlockSize()/1024. << " kiB/blk.; "
+		"Fifo " << FIFOstat->FullCount << " times full, " << FIFOstat->EmptyCount << " times empty  \r";
+}
 
-		// data transfer loop
-		for(;;)
-		{	void* buf;
-			size_t len = RequestSize;
-			//lerr << stringf("before Drain.Request(%p,%lu)", buf, len) << endl;
-			Dst.RequestWrite(buf, len);
-			//lerr << stringf("Drain.Request(%p,%lu)", buf, len) << endl;
-			if (len == 0)
-			{	lerr << "Closing input and discarding buffer because the output side stopped working." << endl;
-				break;
-			}
-			// read from interface
-			len = Src->ReadData(buf, len);
-			if (len == 0)
-				break;
-			Dst.CommitWrite(buf, len);
-			//lerr << stringf("Drain.Commit(%p,%lu)", buf, len) << endl;
-
-			if (EnableInputStats)
-			{	stats->Update(len);
-				statbytes += len;
-				if (statbytes > StatusBytes)
-				{	statbytes = 0;
-					double secs = stats->getSeconds();
-					if (secs >= nextstat)
-					{	nextstat = secs + StatsUpdate;
-						lerr << "Input: " << stats->getBytes()/1024 << " kiB at " << stats->getBytes()/secs/1024. << " kiB/s, " << stats->getAvgBlockSize()/1024. << " kiB/blk.; "
-							"Fifo " << FIFOstat->FullCount << " times full, " << FIFOstat->EmptyCount << " times empty  \r";
-					}
-				}
-			}
+bool InputWorker::Transfer(IInput& src)
+{	if (Framing)
+		return TransferRecords(src);
+	// data transfer loop
+	for(;;)
+	{	void* buf;
+		size_t len = RequestSize;
+		//lerr << stringf("before Drain.Request(%p,%lu)", buf, len) << endl;
+		Dst.RequestWrite(buf, len);
+		//lerr << stringf("Drain.Request(%p,%lu)", buf, len) << endl;
+		if (len == 0)
+		{	lerr << "Closing input and discarding buffer because the output side stopped working." << endl;
+			return false;
+		}
+		// read from interface
+		len = src.ReadData(buf, len);
+		if (len == 0)
+		{	Dst.CommitWrite(buf, 0); // give back the request for the next input
+			return true;
 		}
+		Dst.CommitWrite(buf, len);
+		//lerr << stringf("Drain.Commit(%p,%lu)", buf, len) << endl;
+
 		if (EnableInputStats)
-		{	double secs = stats->getSeconds();
-			lerr << "Input: " << stats->getBytes()/1024 << " kiB at " << stats->getBytes()/secs/1024. << " kiB/s, " << stats->getAvgBlockSize()/1024. << " kiB/blk.; "
-				"Fifo " << FIFOstat->FullCount << " times full, " << FIFOstat->EmptyCount << " times empty  \r";
+			UpdateStats(len);
+	}
+}
+
+bool InputWorker::TransferRecords(IInput& src)
+{	// The incomplete record at the end of a read is kept back and copied
+	// in front of the next read. The fifo memory is mirrored, so the free
+	// space is contiguous.
+	vector<char> tail;
+	for(;;)
+	{	if (tail.size() >= (size_t)BufferSize)
+			throw runtime_error("A record exceeds the buffer size.");
+		void* buf;
+		size_t len = (size_t)min((int64_t)tail.size() + RequestSize, BufferSize);
+		// Wait for space beyond the incomplete record.
+		Dst.RequestWriteMin(buf, len, tail.size() + 1);
+		if (len == 0)
+		{	lerr << "Closing input and discarding buffer because the output side stopped working." << endl;
+			return false;
+		}
+		if (tail.size())
+			memmove(buf, &tail[0], tail.size());
+		size_t rlen = src.ReadData((char*)buf + tail.size(), len - tail.size());
+		if (rlen == 0)
+		{	// The end of the input ends the last record.
+			Dst.CommitWrite(buf, tail.size());
+			return true;
 		}
+		len = tail.size() + rlen;
+		size_t whole = Framing->Whole(buf, len);
+		tail.assign((char*)buf + whole, (char*)buf + len);
+		Dst.CommitWrite(buf, whole);
+
+		if (EnableInputStats)
+			UpdateStats(rlen);
+	}
+}
+
+void InputWorker::Run()
+{	// initialize input
+	Src->Initialize();
+	Transfer(*Src);
+}
+
+void InputWorker::operator()()
+{	try
+	{	if (EnableInputStats)
+			Stats.reset(new PerfCount());
+		Run();
+		if (EnableInputStats)
+			PrintStats();
 	} catch (const interrupt_exception&)
 	{	// no-op
 	} catch (const runtime_error& e)
@@ -130,112 +266,646 @@ void InputWorker::operator()()
 	Src.reset(); // free and close input interface
 }
 
+// input worker that merges several inputs into one fifo (-j)
+class MergeWorker : public InputWorker
+{	class Producer;
+	const vector<const char*> Inputs;
+	IPC::Mutex DrainMtx;   // serializes the producers in framed mode
+	SimpleDrain Out;
+	bool volatile Stopped; // the output side stopped working
+	// Protected by DrainMtx in framed mode.
+	vector<Producer*> Producers;
+	auto_ptr<IListener> Listener;
+ public:
+	MergeWorker(Drain& dst, const vector<const char*>& inputs) : InputWorker(dst), Inputs(inputs), Out(dst), Stopped(false) {}
+ protected:
+	virtual void Run();
+ private:
+	void RunSequential();
+	void RunFramed();
+	// Write one frame of stream id to the fifo. len = 0 is the end of the stream.
+	void Emit(uint32_t id, const void* data, size_t len);
+	// Set Stopped and interrupt the blocking calls of the listener and the
+	// producers. The caller must hold DrainMtx.
+	void Stop();
+	// Wait for the producers to finish, all of them or only the finished ones.
+	void JoinProducers(bool all);
+};
+
+// Reads one input of the framed mode in its own thread.
+class MergeWorker::Producer : public Worker
+{	MergeWorker& Parent;
+	auto_ptr<IInput> Src;
+	const uint32_t Id;
+ public:
+	bool volatile Done;
+	#ifdef __OS2__
+	TID Thread;
+	#else
+	pthread_t Thread;
+	#endif
+	Producer(MergeWorker& parent, IInput* src, uint32_t id) : Parent(parent), Src(src), Id(id), Done(false) {}
+	virtual void operator()();
+	// Let a blocking read return. The caller must hold Parent.DrainMtx.
+	void Shutdown() { if (Src.get()) Src->Shutdown(); }
+};
+
+void MergeWorker::Producer::operator()()
+{	try
+	{	Src->Initialize();
+		vector<char> buf(RequestSize);
+		// Stop may have missed the input before it was connected.
+		while (!Parent.Stopped)
+		{	size_t len = Src->ReadData(&buf[0], buf.size());
+			if (len == 0)
+				break;
+			Parent.Emit(Id, &buf[0], len);
+		}
+	} catch (const runtime_error& e)
+	{	lerr << "Error reading data of stream " << Id << ": " << e.what() << endl;
+		Result = 10;
+	} catch (const exception& e)
+	{	lerr << "Error in input worker of stream " << Id << ": " << e.what() << endl;
+		Result = 19;
+	}
+	try
+	{	Parent.Emit(Id, NULL, 0);
+	} catch (...)
+	{}
+	{	Lock lc(Parent.DrainMtx);
+		Src.reset();
+	}
+	Done = true;
+}
+
+void MergeWorker::Run()
+{	if (MergeMode == MT_Framed)
+		RunFramed();
+	 else
+		RunSequential();
+}
+
+void MergeWorker::RunSequential()
+{	for (vector<const char*>::const_iterator ip = Inputs.begin(); ip != Inputs.end(); ++ip)
+	{	auto_ptr<IListener> listener(IListener::Factory(*ip));
+		if (listener.get())
+		{	listener->Initialize();
+			for (unsigned n = 0; MaxConnections == 0 || n < MaxConnections; ++n)
+			{	auto_ptr<IInput> src(listener->Accept());
+				if (!Transfer(*src))
+					return;
+			}
+		} else
+		{	auto_ptr<IInput> src(IInput::Factory(*ip));
+			src->Initialize();
+			if (!Transfer(*src))
+				return;
+		}
+	}
+}
+
+void MergeWorker::Emit(uint32_t id, const void* data, size_t len)
+{	// frame header: stream id and length, 32 bit big endian each
+	unsigned char head[8];
+	for (int i = 0; i < 4; ++i)
+	{	head[i] = (unsigned char)(id >> (24 - 8*i));
+		head[4+i] = (unsigned char)(len >> (24 - 8*i));
+	}
+	Lock lc(DrainMtx);
+	if (Stopped)
+		return;
+	if (Out.write(head, sizeof head) || Out.write(data, len))
+	{	lerr << "Closing inputs and discarding buffer because the output side stopped working." << endl;
+		Stop();
+		return;
+	}
+	if (EnableInputStats)
+		UpdateStats(len);
+}
+
+void MergeWorker::Stop()
+{	Stopped = true;
+	if (Listener.get())
+		Listener->Shutdown();
+	for (size_t i = 0; i < Producers.size(); ++i)
+		Producers[i]->Shutdown();
+}
+
+void MergeWorker::JoinProducers(bool all)
+{	for (size_t i = 0; i < Producers.size(); )
+		if (all || Producers[i]->Done)
+		{
+			#ifdef __OS2__
+			DosWaitThread(&Producers[i]->Thread, DCWW_WAIT);
+			#else
+			pthread_join(Producers[i]->Thread, NULL);
+			#endif
+			if (Producers[i]->getResult() != 0)
+				Result = Producers[i]->getResult();
+			Lock lc(DrainMtx);
+			delete Producers[i];
+			Producers.erase(Producers.begin() + i);
+		} else
+			++i;
+}
+
+void MergeWorker::RunFramed()
+{	uint32_t id = 0;
+	try
+	{	// Start a producer for each input or each connection of a listening input.
+		for (vector<const char*>::const_iterator ip = Inputs.begin(); ip != Inputs.end() && !Stopped; ++ip)
+		{	{	// Stop cannot interrupt the listener before it listens.
+				Lock lc(DrainMtx);
+				if (Stopped)
+					break;
+				Listener.reset(IListener::Factory(*ip));
+				if (Listener.get())
+					Listener->Initialize();
+			}
+			for (unsigned n = 0; !Stopped && (Listener.get() ? MaxConnections == 0 || n < MaxConnections : n < 1); ++n)
+			{	auto_ptr<Producer> prod(new Producer(*this, Listener.get() ? Listener->Accept() : IInput::Factory(*ip), id++));
+				Lock lc(DrainMtx);
+				if (Stopped)
+					break;
+				#ifdef __OS2__
+				int tid = _beginthread(runWorker, NULL, 65536, (Worker*)prod.get());
+				if (tid == -1)
+					throw runtime_error("Failed to start input worker thread.");
+				prod->Thread = tid;
+				#else
+				int rc = pthread_create(&prod->Thread, NULL, runWorker, (Worker*)prod.get());
+				if (rc != 0)
+					throw os_error(rc, "Failed to start input worker thread.");
+				#endif
+				Producers.push_back(prod.release());
+				lc.Release();
+				// reap finished producers of a long running server
+				JoinProducers(false);
+			}
+			Lock lc(DrainMtx);
+			Listener.reset();
+		}
+	} catch (...)
+	{	bool stopped;
+		{	Lock lc(DrainMtx);
+			stopped = Stopped;
+			Stop(); // let the other producers stop
+			Listener.reset();
+		}
+		JoinProducers(true);
+		// Accept fails after Stop, this is no error.
+		if (!stopped)
+			throw;
+	}
+	// wait for the remaining producers
+	JoinProducers(true);
+}
+
+// Pause of the output workers (control channel)
+class OutputGate
+{	Mutex Mtx;
+	Notification Resume;
+	bool volatile Paused;
+ public:
+	OutputGate() : Resume(Mtx), Paused(false) {}
+	bool isPaused() const { return Paused; }
+	void Set(bool paused)
+	{	Lock lc(Mtx);
+		Paused = paused;
+		if (!paused)
+			Resume.NotifyAll();
+	}
+	// Wait as long as the output is paused.
+	void Pass()
+	{	if (Paused)
+		{	Lock lc(Mtx);
+			while (Paused && Resume.Wait());
+		}
+	}
+};
+static OutputGate OutputPause;
+
 // output worker class
 class OutputWorker : public Worker
-{	Source& Src;
-	auto_ptr<IOutput> Dst;
+{	auto_ptr<IOutput> Dst;
+ protected:
+	Source& Src;
+	auto_ptr<PerfCount> Stats;
+	double NextStat;
+	size_t StatBytes;
+ protected:
+	explicit OutputWorker(Source& src) : Src(src), NextStat(StatsUpdate), StatBytes(0) {}
+	// Count len bytes for the output statistics and print them from time to time.
+	void UpdateStats(size_t len);
+	void PrintStats();
+	// The data transfer within the error handling of operator().
+	virtual void Run();
  public:
-	OutputWorker(Source& src, IOutput* dst) : Src(src), Dst(dst) {}
+	OutputWorker(Source& src, IOutput* dst) : Dst(dst), Src(src), NextStat(StatsUpdate), StatBytes(0) {}
 	void operator()();
 };
 
+void OutputWorker::UpdateStats(size_t len)
+{	Stats->Update(len);
+	StatBytes += len;
+	if (StatBytes > StatusBytes)
+	{	StatBytes = 0;
+		double secs = Stats->getSeconds();
+		if (secs >= NextStat)
+		{	NextStat = secs + StatsUpdate;
+			PrintStats();
+		}
+	}
+}
+
+void OutputWorker::PrintStats()
+{	double secs = Stats->getSeconds();
+	lerr << "Output: " << Stats->getBytes()/1024 << " kiB at " << Stats->getBytes()/secs/1024. << " kiB/s, " << Stats->getAvgBlockSize()/1024. << " kiB/blk.; "
+		"Fifo " << FIFOstat->FullCount << " times full, " << FIFOstat->EmptyCount << " times empty  \r";
+}
+
+void OutputWorker::Run()
+{	// initialize output
+	Dst->Initialize();
+
+	// data transfer loop
+	size_t request = RequestSize;
+	for(;;)
+	{	void* buf;
+		size_t len = request;
+		OutputPause.Pass();
+		//lerr << stringf("before Source.Request(%p,%lu)", buf, len) << endl;
+		Src.RequestRead(buf, len);
+		//lerr << stringf("Source.Request(%p,%lu)", buf, len) << endl;
+		if (len == 0)
+			break;
+		if (Framing)
+		{	// Write only complete records. The fifo holds only complete
+			// records except for the end of the stream.
+			size_t whole = Framing->Whole(buf, len);
+			if (whole == 0 && len == request && request < (size_t)BufferSize)
+			{	// The first record is larger than the request.
+				Src.CommitRead(buf, 0);
+				request = (size_t)min((int64_t)request * 2, BufferSize);
+				continue;
+			}
+			if (whole)
+				len = whole;
+			for (size_t done = 0; done < len; )
+			{	size_t wlen = Dst->WriteData((char*)buf + done, len - done);
+				if (wlen == 0)
+					throw runtime_error("Failed to write to the output stream because the destination does not accept more data.");
+				done += wlen;
+			}
+		} else
+			len = Dst->WriteData(buf, len);
+		if (len == 0)
+			throw runtime_error("Failed to write to the output stream because the destination does not accept more data.");
+		Src.CommitRead(buf, len);
+		//lerr << stringf("Source.Commit(%p,%lu)", buf, len) << endl;
+		if (EnableOutputStats)
+			UpdateStats(len);
+	}
+	Dst->Finish();
+}
+
 void OutputWorker::operator()()
 {	try
-	{	// initialize output
-		Dst->Initialize();
-		
-		auto_ptr<PerfCount> stats;
-		double nextstat = StatsUpdate;
-		size_t statbytes = 0;
+	{	if (EnableOutputStats)
+			Stats.reset(new PerfCount());
+		Run();
 		if (EnableOutputStats)
-			stats.reset(new PerfCount());
+			PrintStats();
+	} catch (const interrupt_exception&)
+	{	// no-op
+	} catch (const runtime_error& e)
+	{	lerr << "Error writing data: " << e.what() << endl;
+		Result = 11;
+	} catch (const logic_error& e)
+	{	lerr << "Error in output worker: " << e.what() << endl;
+		Result = 19;
+	} catch (...)
+	{	lerr << "Unhandled exception in output worker." << endl;
+		Result = 28;
+	}
+	Src.EndRead(); // End of output signal
+}
 
-		// data transfer loop
-		for(;;)
+#if !defined(__OS2__) && !defined(_WIN32)
+// input worker with several reads in flight (-q)
+class AsyncInputWorker : public InputWorker
+{	auto_ptr<IAsyncFile> Src;
+	Control& Ctl;
+ public:
+	AsyncInputWorker(Drain& dst, Control& ctl, IAsyncFile* src) : InputWorker(dst), Src(src), Ctl(ctl) {}
+ protected:
+	virtual void Run();
+};
+
+void AsyncInputWorker::Run()
+{	Src->Initialize();
+	Src->Register(FIFOMemory, FIFOMemorySize);
+	// The output cannot see the data behind a read in flight. So the input
+	// must not wait in the fifo while reads are in flight. A new request
+	// is made only if the fifo has space besides the requests in flight.
+	size_t inflight = 0;
+	for(;;)
+	{	uint64_t avail;
+		while ( Src->getPending() < QueueDepth && (avail = Src->Available()) != 0
+			&& (Src->getPending() == 0 || Ctl.getSize() - Ctl.getLevel() > inflight) )
 		{	void* buf;
-			size_t len = RequestSize;
-			//lerr << stringf("before Source.Request(%p,%lu)", buf, len) << endl;
+			size_t len = (size_t)min(min((uint64_t)RequestSize, avail), (uint64_t)IAsyncFile::MaxTransfer);
+			Dst.RequestWrite(buf, len);
+			if (len == 0)
+			{	lerr << "Closing input and discarding buffer because the output side stopped working." << endl;
+				return;
+			}
+			Src->Submit(buf, len);
+			inflight += len;
+		}
+		if (Src->getPending() == 0)
+			return; // end of the input
+		void* buf;
+		size_t len = Src->Complete(buf);
+		inflight -= len;
+		Dst.CommitWrite(buf, len);
+		if (EnableInputStats)
+			UpdateStats(len);
+	}
+}
+
+// output worker with several writes in flight (-q)
+class AsyncOutputWorker : public OutputWorker
+{	auto_ptr<IAsyncFile> Dst;
+	Control& Ctl;
+ public:
+	AsyncOutputWorker(Source& src, Control& ctl, IAsyncFile* dst) : OutputWorker(src), Dst(dst), Ctl(ctl) {}
+ protected:
+	virtual void Run();
+};
+
+void AsyncOutputWorker::Run()
+{	Dst->Initialize();
+	Dst->Register(FIFOMemory, FIFOMemorySize);
+	// Like the input the output must not wait in the fifo while writes
+	// are in flight. A new request is made only if the fifo has data
+	// besides the requests in flight.
+	size_t inflight = 0;
+	bool eos = false;
+	for(;;)
+	{	while ( !eos && Dst->getPending() < QueueDepth
+			&& (Dst->getPending() == 0 || Ctl.getLevel() > inflight) )
+		{	void* buf;
+			size_t len = (size_t)min(RequestSize, (int64_t)IAsyncFile::MaxTransfer);
+			OutputPause.Pass();
 			Src.RequestRead(buf, len);
-			//lerr << stringf("Source.Request(%p,%lu)", buf, len) << endl;
 			if (len == 0)
+			{	eos = true;
 				break;
-			len = Dst->WriteData(buf, len);
-			if (len == 0)
-				throw runtime_error("Failed to write to the output stream because the destination does not accept more data.");
-			Src.CommitRead(buf, len);
-			//lerr << stringf("Source.Commit(%p,%lu)", buf, len) << endl;
+			}
+			Dst->Submit(buf, len);
+			inflight += len;
+		}
+		if (Dst->getPending() == 0)
+			break; // end of the stream
+		void* buf;
+		size_t len = Dst->Complete(buf);
+		inflight -= len;
+		Src.CommitRead(buf, len);
+		if (EnableOutputStats)
+			UpdateStats(len);
+	}
+	Dst->Finish();
+}
+
+// output worker that passes the fifo memory to a pipe (-z)
+class SpliceOutputWorker : public OutputWorker
+{	auto_ptr<IPipeOutput> Dst;
+	Control& Ctl;
+ public:
+	SpliceOutputWorker(Source& src, Control& ctl, IPipeOutput* dst) : OutputWorker(src), Dst(dst), Ctl(ctl) {}
+ protected:
+	virtual void Run();
+};
+
+void SpliceOutputWorker::Run()
+{	Dst->Initialize();
+	// The pipe references the regions until its reader has consumed them.
+	// So they are committed only then. Like -q the output must not wait in
+	// the fifo while it holds regions that the input waits for.
+	deque<pair<void*, size_t> > held;
+	size_t heldbytes = 0;
+	for(;;)
+	{	// commit the regions that the reader has consumed
+		const size_t unread = Dst->Unread();
+		while (!held.empty() && heldbytes - held.front().second >= unread)
+		{	Src.CommitRead(held.front().first, held.front().second);
+			heldbytes -= held.front().second;
 			if (EnableOutputStats)
-			{	stats->Update(len);
-				statbytes += len;
-				if (statbytes > StatusBytes)
-				{	statbytes = 0;
-					double secs = stats->getSeconds();
-					if (secs >= nextstat)
-					{	nextstat = secs + StatsUpdate;
-						lerr << "Output: " << stats->getBytes()/1024 << " kiB at " << stats->getBytes()/secs/1024. << " kiB/s, " << stats->getAvgBlockSize()/1024. << " kiB/blk.; "
-							"Fifo " << FIFOstat->FullCount << " times full, " << FIFOstat->EmptyCount << " times empty  \r";
-			}	}	}
+				UpdateStats(held.front().second);
+			held.pop_front();
+		}
+		if (held.size() == ZeroCopySlots || (!held.empty() && Ctl.getLevel() <= heldbytes))
+		{	Dst->Wait();
+			continue;
+		}
+		void* buf;
+		size_t len = RequestSize;
+		OutputPause.Pass();
+		Src.RequestRead(buf, len);
+		if (len == 0)
+			break;
+		for (size_t done = 0; done < len; )
+			done += Dst->SpliceData((char*)buf + done, len - done);
+		held.push_back(make_pair(buf, len));
+		heldbytes += len;
+	}
+	// The input has ended, so nothing overwrites the regions in the pipe.
+	for (; !held.empty(); held.pop_front())
+	{	Src.CommitRead(held.front().first, held.front().second);
+		if (EnableOutputStats)
+			UpdateStats(held.front().second);
+	}
+}
+
+// input worker that splices into the pipes of the fifo (-f=splice)
+class RelayInputWorker : public InputWorker
+{	auto_ptr<ISpliceEnd> Src;
+	SpliceFIFO& FIFO;
+ public:
+	RelayInputWorker(SpliceFIFO& fifo, ISpliceEnd* src) : InputWorker(fifo.getDrain()), Src(src), FIFO(fifo) {}
+ protected:
+	virtual void Run();
+};
+
+void RelayInputWorker::Run()
+{	Src->Initialize();
+	const int fd = Src->getHandle();
+	for(;;)
+	{	size_t len = RequestSize;
+		if (!FIFO.SpliceIn(fd, len))
+		{	lerr << "Closing input and discarding buffer because the output side stopped working." << endl;
+			return;
 		}
+		if (len == 0)
+			return; // end of the input
+		if (EnableInputStats)
+			UpdateStats(len);
+	}
+}
+
+// output worker that splices from the pipes of the fifo (-f=splice)
+class RelayOutputWorker : public OutputWorker
+{	auto_ptr<ISpliceEnd> Dst;
+	SpliceFIFO& FIFO;
+ public:
+	RelayOutputWorker(SpliceFIFO& fifo, ISpliceEnd* dst) : OutputWorker(fifo.getSource()), Dst(dst), FIFO(fifo) {}
+ protected:
+	virtual void Run();
+};
+
+void RelayOutputWorker::Run()
+{	Dst->Initialize();
+	const int fd = Dst->getHandle();
+	for(;;)
+	{	OutputPause.Pass();
+		size_t len = FIFO.SpliceOut(fd, RequestSize);
+		if (len == 0)
+			break; // end of the stream
 		if (EnableOutputStats)
-		{	double secs = stats->getSeconds();
-			lerr << "Output: " << stats->getBytes()/1024 << " kiB at " << stats->getBytes()/secs/1024. << " kiB/s, " << stats->getAvgBlockSize()/1024. << " kiB/blk.; "
-				"Fifo " << FIFOstat->FullCount << " times full, " << FIFOstat->EmptyCount << " times empty  \r";
+			UpdateStats(len);
+	}
+	Dst->Finish();
+}
+#endif
+
+// processing stage worker class (-t)
+class StageWorker : public Worker
+{	Stage& Src;
+	auto_ptr<IFilter> Filter;
+ public:
+	StageWorker(Stage& src, IFilter* filter) : Src(src), Filter(filter) {}
+	void operator()();
+};
+
+void StageWorker::operator()()
+{	try
+	{	Filter->Initialize();
+		for (;;)
+		{	void* buf;
+			size_t len = RequestSize;
+			Src.RequestProcess(buf, len);
+			if (len == 0)
+				break;
+			Filter->ProcessData(buf, len);
+			Src.CommitProcess(buf, len);
 		}
+		Filter->Finish();
 	} catch (const interrupt_exception&)
 	{	// no-op
 	} catch (const runtime_error& e)
-	{	lerr << "Error writing data: " << e.what() << endl;
-		Result = 11;
+	{	lerr << "Error processing data: " << e.what() << endl;
+		Result = 12;
 	} catch (const logic_error& e)
-	{	lerr << "Error in output worker: " << e.what() << endl;
+	{	lerr << "Error in processing worker: " << e.what() << endl;
 		Result = 19;
 	} catch (...)
-	{	lerr << "Unhandled exception in output worker." << endl;
+	{	lerr << "Unhandled exception in processing worker." << endl;
 		Result = 28;
 	}
-	Src.EndRead(); // End of output signal
+	Src.EndProcess(); // End of stage signal
 }
 
-#ifdef __OS2__
-static void runInputWorker(void* param)
-{	(*reinterpret_cast<InputWorker*>(param))();
-}
-#else
-// pthreads wont a return value
-static void* runInputWorker(void* param)
-{	(*reinterpret_cast<InputWorker*>(param))();
-	return NULL;
-}
-#endif
+// owner of a list of workers
+template <class W>
+struct WorkerList : public vector<W*>
+{	~WorkerList()
+	{	for (typename vector<W*>::iterator it = this->begin(); it != this->end(); ++it)
+			delete *it;
+	}
+};
 
-static long parseint(const char* src)
-{	long ret;
-	size_t l = (size_t)-1;
+static int64_t parseint(const char* src)
+{	long long ret;
+	int l = -1;
 	char unit[2] = "";
-	if (sscanf(src, "=%li%n%1s%n", &ret, &l, unit, &l) == 0 || l != strlen(src))
+	if (sscanf(src, "=%lli%n%1s%n", &ret, &l, unit, &l) == 0 || l != (int)strlen(src))
 		throw syntax_error(stringf("'=' followed by an integer value expected. Found '%s'", src));
+	int shift;
 	switch (toupper(unit[0]))
 	{default:
 		throw syntax_error(stringf("The unit '%c' is invalid at the integer constant '%s'", unit[0], src+1));
 	 case 'K':
-		ret *= 1024; break;
+		shift = 10; break;
 	 case 'M':
-		ret *= 1024*1024; break;
+		shift = 20; break;
 	 case 'G':
-		ret *= 1024*1024*1024; break;
-	 case 0:;
+		shift = 30; break;
+	 case 'T':
+		shift = 40; break;
+	 case 0:
+		shift = 0;
 	}
-	return ret;
+	if (ret > (INT64_MAX >> shift) || ret < (INT64_MIN >> shift))
+		throw syntax_error(stringf("The integer constant '%s' is out of range.", src+1));
+	return (int64_t)ret << shift;
 }
 
 static double parsedouble(const char* src)
 {	double ret;
-	size_t l = (size_t)-1;
-	if (sscanf(src, "=%lf%n", &ret, &l) == 0 || l != strlen(src))
+	int l = -1;
+	if (sscanf(src, "=%lf%n", &ret, &l) == 0 || l != (int)strlen(src))
 		throw syntax_error(stringf("'=' followed by an floating-point value expected. Found '%s'", src));
 	return ret;
 }
 
+// true if the argument of -h or -l is a time
+static bool istime(const char* src)
+{	size_t len = strlen(src);
+	return len > 1 && src[len-1] == 's';
+}
+
+// Parse '=' followed by a time with the unit s or ms. Returns seconds.
+static double parsetime(const char* src)
+{	size_t len = strlen(src);
+	double scale = 1;
+	if (len > 3 && strcmp(src + len - 2, "ms") == 0)
+	{	scale = 1E-3;
+		len -= 2;
+	} else if (len > 2 && src[len-1] == 's')
+		--len;
+	 else
+		throw syntax_error(stringf("The time %s requires the unit s or ms.", src+1));
+	double ret = parsedouble(string(src, len).c_str()) * scale;
+	if (ret < 0)
+		throw syntax_error(stringf("The time %s must not be negative.", src+1));
+	return ret;
+}
+
+// Parse '=' followed by one of the keywords in the NULL terminated list
+// values. The comparison is case insensitive. Returns the index of the match.
+static int parseenum(const char* src, const char* const* values)
+{	if (*src != '=')
+		throw syntax_error(stringf("'=' followed by a keyword expected. Found '%s'", src));
+	const string key = MM::toupper(string(src+1));
+	for (const char* const* vp = values; *vp; ++vp)
+		if (key == *vp)
+			return vp - values;
+	throw syntax_error(stringf("The keyword '%s' is invalid in this context.", src+1));
+}
+
+#if defined(__OS2__) || defined (_WIN32)
+static void slash2backslash(char* cp)
+{	while (*cp)
+	{	if (*cp == '/')
+			*cp = '\\';
+		++cp;
+	}
+}
+#else
+#define slash2backslash(x)
+#endif
+
 static void parseoption(char* cp)
 {	switch (tolower(cp[1]))
 	{case 'b':
@@ -254,7 +924,21 @@ static void parseoption(char* cp)
 			throw syntax_error("The pipe buffer size must be positive.");
 		return;
 	 case 'h':
-		if (cp[1+strlen(cp+2)] == '%')
+		HighWaterTime = 0;
+		AutoWaterMarks = false;
+		#if !defined(__OS2__) && !defined(_WIN32)
+		if (strcmp(cp+2, "=auto") == 0)
+		{	AutoWaterMarks = true;
+			// start point until the rates are known
+			dHighWaterMark = .5;
+			return;
+		}
+		#endif
+		if (istime(cp+2))
+		{	HighWaterTime = parsetime(cp+2);
+			// Until the output rate is known wait for a full buffer.
+			dHighWaterMark = 1;
+		} else if (cp[1+strlen(cp+2)] == '%')
 		{	cp[1+strlen(cp+2)] = 0;
 			dHighWaterMark = parsedouble(cp+2) / 100;
 			if (dHighWaterMark < 0 || dHighWaterMark > 100)
@@ -265,7 +949,11 @@ static void parseoption(char* cp)
 		}
 		return;
 	 case 'l':
-		if (cp[1+strlen(cp+2)] == '%')
+		LowWaterTime = 0;
+		if (istime(cp+2))
+		{	LowWaterTime = parsetime(cp+2);
+			dLowWaterMark = 1;
+		} else if (cp[1+strlen(cp+2)] == '%')
 		{	cp[1+strlen(cp+2)] = 0;
 			dLowWaterMark = parsedouble(cp+2) / 100;
 			if (dLowWaterMark < 0 || dLowWaterMark > 100)
@@ -278,6 +966,155 @@ static void parseoption(char* cp)
 	 case 'c':
 		EnableCache = true;
 		return;
+	 case 'o':
+		DirectIO = true;
+		return;
+	 case 'f':
+	{	static const char* const types[] = { "LOCK", "SPSC", "SEG", "SPILL", "PERSIST", "LZ4", "LOWLAT", "SPLICE", NULL };
+		char* arg = strchr(cp+2, ':');
+		if (arg)
+			*arg++ = 0;
+		FIFOImpl = (FIFOType)parseenum(cp+2, types);
+		if (FIFOImpl == FT_Spill || FIFOImpl == FT_Persistent)
+		{	if (arg == NULL || *arg == 0)
+				throw syntax_error(FIFOImpl == FT_Spill
+					? "-f=spill requires the directory of the spill file, e.g. -f=spill:/tmp."
+					: "-f=persist requires the name of the fifo file, e.g. -f=persist:/var/tmp/fifo.");
+			FIFOPath = arg;
+		} else if (arg)
+			throw syntax_error(stringf("The fifo type %s does not take an argument.", cp+3));
+		return;
+	}
+	 case 'y':
+	{	int64_t interval = parseint(cp+2);
+		if (interval < 1 || interval > LONG_MAX)
+			throw syntax_error("The sync interval must be positive.");
+		SyncInterval = (long)interval;
+		return;
+	}
+	 case 'j':
+	{	static const char* const types[] = { "SEQ", "FRAME", NULL };
+		char* arg = strchr(cp+2, ':');
+		if (arg)
+			*arg++ = 0;
+		MergeMode = (MergeType)parseenum(cp+2, types);
+		MergeInputs = true;
+		if (arg)
+		{	int64_t n;
+			*--arg = '='; // parseint expects '='
+			n = parseint(arg);
+			if (n < 0 || n > UINT_MAX)
+				throw syntax_error("The number of connections is out of range.");
+			MaxConnections = (unsigned)n;
+		}
+		return;
+	}
+	 case 'i':
+		if (cp[2] != '=' || cp[3] == 0)
+			throw syntax_error("-i requires an input, e.g. -i=tcpip://:4711.");
+		slash2backslash(cp+3);
+		MoreInputs.push_back(cp+3);
+		MergeInputs = true;
+		return;
+	 case 't':
+		if (cp[2] != '=' || cp[3] == 0)
+			throw syntax_error("-t requires a filter, e.g. -t=crc32.");
+		Filters.push_back(cp+3);
+		return;
+	 #if !defined(__OS2__) && !defined(_WIN32)
+	 case 'u':
+		if (cp[2] != '=' || cp[3] == 0)
+			throw syntax_error("-u requires the path of the control socket.");
+		ControlPath = cp+3;
+		return;
+	 #endif
+	 case 'w':
+		MaxLatency = parsetime(cp+2);
+		return;
+	 #ifdef __linux__
+	 case 'z':
+		ZeroCopy = true;
+		return;
+	 #endif
+	 #if !defined(__OS2__) && !defined(_WIN32)
+	 case 'q':
+	{	int64_t depth = parseint(cp+2);
+		if (depth < 1 || depth > 256)
+			throw syntax_error("The queue depth must be in the range 1-256.");
+		QueueDepth = (unsigned)depth;
+		return;
+	}
+	 #endif
+	 #if !defined(__OS2__) && !defined(_WIN32)
+	 case 'e':
+		if (cp[2] != '=' || cp[3] == 0)
+			throw syntax_error("-e requires a record format, e.g. -e=line.");
+		FramingSpec = cp+3;
+		return;
+	 #endif
+	 case 'x':
+		switch (tolower(cp[2]))
+		{case 'o':
+			if (cp[3])
+				break;
+			DropOldest = true;
+			return;
+		 case 'u':
+		{	char* arg = strchr(cp+3, ':');
+			if (arg)
+				*arg++ = 0;
+			FillRate = parseint(cp+3);
+			if (FillRate < 1)
+				throw syntax_error("The fill rate must be positive.");
+			if (arg)
+			{	size_t len = strlen(arg);
+				if (len == 0 || len % 2 || strspn(arg, "0123456789abcdefABCDEF") != len)
+					throw syntax_error("The fill pattern must be a non-empty hexadecimal string.");
+				FillPattern.clear();
+				for (size_t i = 0; i < len; i += 2)
+				{	unsigned v;
+					sscanf(arg + i, "%2x", &v);
+					FillPattern.push_back((unsigned char)v);
+				}
+			}
+			return;
+		}
+		}
+		break;
+	 case 'd':
+		DetachLag = parseint(cp+2);
+		if (DetachLag < 0)
+			throw syntax_error("The lag limit must not be negative.");
+		return;
+	 case 'g':
+		SegmentSize = parseint(cp+2);
+		if (SegmentSize < 1)
+			throw syntax_error("The segment size must be positive.");
+		return;
+	 case 'm':
+		switch (tolower(cp[2]))
+		{case '=':
+		{	static const char* const types[] = { "HEAP", "MIRROR", "MMAP", "HUGE", "THP", NULL };
+			MemoryType = (Storage::Type)parseenum(cp+2, types);
+			return;
+		}
+		 case 'p':
+			PrefaultMemory = true;
+			if (cp[3])
+			{	int64_t threads = parseint(cp+3);
+				if (threads < 1)
+					throw syntax_error("The number of prefault threads must be positive.");
+				PrefaultThreads = threads;
+			}
+			return;
+		 case 'l':
+			LockMemory = true;
+			return;
+		 case 'c':
+			LimitToCGroup = true;
+			return;
+		}
+		break;
 	 case 's':
 		switch (tolower(cp[2]))
 		{case 'i':
@@ -308,21 +1145,463 @@ static void parseoption(char* cp)
 	throw syntax_error(stringf("Invalid option %s.", cp));
 }
 
-#if defined(__OS2__) || defined (_WIN32)
-static void slash2backslash(char* cp)
-{	while (*cp)
-	{	if (*cp == '/')
-			*cp = '\\';
-		++cp;
+static Storage* CreateStorage(size_t size)
+{	auto_ptr<Storage> storage(Storage::Create(MemoryType, size, BufferAlignment));
+	if (PrefaultMemory)
+	{	unsigned threads = PrefaultThreads;
+		#if !defined(__OS2__) && !defined(_WIN32)
+		if (threads == 0)
+			threads = sysconf(_SC_NPROCESSORS_ONLN);
+		#endif
+		storage->Prefault(threads);
 	}
+	if (LockMemory)
+		storage->Lock();
+	return storage.release();
+}
+
+static MM::FIFO::FIFO* CreateFIFO()
+{	switch (FIFOImpl)
+	{case FT_Segmented:
+		// The segments are allocated on demand, prefaulting is pointless.
+		return new SegmentedFIFO(MemoryType, BufferSize, SegmentSize, BufferAlignment, dHighWaterMark, dLowWaterMark, LockMemory);
+	 case FT_Persistent:
+	{	PersistentFIFO* fifo = new PersistentFIFO(FIFOPath, BufferSize, dHighWaterMark, dLowWaterMark, SyncInterval);
+		if (fifo->getRecovered())
+			lerr << "Resuming " << fifo->getRecovered() << " bytes from " << FIFOPath << "." << endl;
+		return fifo;
+	}
+	 default:
+		break;
+	}
+	auto_ptr<Storage> storage(CreateStorage(BufferSize));
+	FIFOMemory = storage->begin();
+	FIFOMemorySize = storage->isMirrored() ? 2 * storage->size() : storage->size();
+	// the asynchronous I/O and the pipe output have several requests outstanding
+	const unsigned slots = max(QueueDepth, ZeroCopy ? ZeroCopySlots : 1U);
+	switch (FIFOImpl)
+	{case FT_SPSC:
+		return new SPSCFIFO(storage.release(), dHighWaterMark, dLowWaterMark);
+	 case FT_Spill:
+		return new SpillFIFO(storage.release(), dHighWaterMark, FIFOPath, SegmentSize);
+	 case FT_Compressed:
+		return new CompressedFIFO(storage.release(), dHighWaterMark, SegmentSize);
+	 case FT_LowLatency:
+		return new LowLatencyFIFO(storage.release(), dHighWaterMark, dLowWaterMark, slots);
+	 default:
+		return new StaticFIFO(storage.release(), dHighWaterMark, dLowWaterMark, slots);
+	}
+}
+
+#if !defined(__OS2__) && !defined(_WIN32)
+// Parse '=' followed by a size or by a percentage of size.
+// Returns the fraction of size.
+static double parselevel(const char* src, int64_t size)
+{	size_t len = strlen(src);
+	if (len > 1 && src[len-1] == '%')
+	{	double level = parsedouble(string(src, len-1).c_str()) / 100;
+		if (level < 0 || level > 1)
+			throw syntax_error(stringf("The relative buffer level %s is not in the range 0-100%%.", src+1));
+		return level;
+	}
+	int64_t level = parseint(src);
+	if (level < 0 || level > size)
+		throw syntax_error(stringf("The level %s is not in the range from 0 to the buffer size.", src+1));
+	return (double)level / size;
+}
+
+// control channel worker class (-u)
+// The worker serves one client at a time. A command is one line, the reply
+// ends with a line "OK" or "ERROR <message>". The worker has its own thread
+// that is stopped by the destructor.
+class ControlWorker : public Worker
+{	MM::FIFO::FIFO& Fifo;
+	const string Path;
+	int Listener;
+	pthread_t Thread;
+	bool Started;
+	bool volatile Stop;
+ public:
+	// Create the control socket at path.
+	ControlWorker(MM::FIFO::FIFO& fifo, const char* path);
+	~ControlWorker();
+	void Start();
+	void operator()();
+ private:
+	// Wait until fd is readable. Returns false if the worker should stop.
+	bool WaitReadable(int fd);
+	void Serve(int client);
+	// Execute one command and return the reply without the final line.
+	string Execute(const string& command);
+};
+
+ControlWorker::ControlWorker(MM::FIFO::FIFO& fifo, const char* path)
+ :	Fifo(fifo),
+	Path(path),
+	Listener(-1),
+	Started(false),
+	Stop(false)
+{	sockaddr_un addr;
+	if (Path.size() >= sizeof addr.sun_path)
+		throw syntax_error(stringf("The path of the control socket %s is too long.", path));
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	// replace the socket of a previous run, but nothing else
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+	Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (Listener == -1)
+		throw os_error(errno, "Failed to create the control socket.");
+	if (bind(Listener, (sockaddr*)&addr, sizeof addr) != 0 || listen(Listener, 1) != 0)
+	{	int err = errno;
+		close(Listener);
+		throw os_error(err, stringf("Failed to create the control socket %s.", path));
+	}
+}
+
+ControlWorker::~ControlWorker()
+{	Stop = true;
+	if (Started)
+		pthread_join(Thread, NULL);
+	close(Listener);
+	unlink(Path.c_str());
+}
+
+void ControlWorker::Start()
+{	int rc = pthread_create(&Thread, NULL, runWorker, this);
+	if (rc != 0)
+		throw os_error(rc, "Failed to start control worker thread.");
+	Started = true;
+}
+
+bool ControlWorker::WaitReadable(int fd)
+{	pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (!Stop)
+	{	int rc = poll(&pfd, 1, 200);
+		if (rc > 0)
+			return true;
+		if (rc < 0 && errno != EINTR)
+			throw os_error(errno, "Failed to wait at the control socket.");
+	}
+	return false;
+}
+
+void ControlWorker::operator()()
+{	try
+	{	while (WaitReadable(Listener))
+		{	int client = accept(Listener, NULL, NULL);
+			if (client == -1)
+				continue; // The client might have gone meanwhile.
+			Serve(client);
+			close(client);
+		}
+	} catch (const exception& e)
+	{	lerr << "Error in control channel: " << e.what() << endl;
+		Result = 13;
+	}
+}
+
+void ControlWorker::Serve(int client)
+{	string line;
+	char buf[256];
+	while (WaitReadable(client))
+	{	ssize_t len = read(client, buf, sizeof buf);
+		if (len <= 0)
+			return; // connection closed
+		line.append(buf, len);
+		size_t eol;
+		while ((eol = line.find('\n')) != string::npos)
+		{	string command(line, 0, eol);
+			line.erase(0, eol + 1);
+			if (command.size() && command[command.size()-1] == '\r')
+				command.erase(command.size()-1);
+			string reply;
+			try
+			{	reply = Execute(command) + "OK\n";
+			} catch (const exception& e)
+			{	reply = string("ERROR ") + e.what() + "\n";
+			}
+			if (send(client, reply.data(), reply.size(), MSG_NOSIGNAL) != (ssize_t)reply.size())
+				return;
+		}
+		if (line.size() > 4096)
+			return; // not a command
+	}
+}
+
+string ControlWorker::Execute(const string& command)
+{	size_t eq = command.find('=');
+	const string name = MM::toupper(command.substr(0, eq));
+	const char* arg = eq == string::npos ? NULL : command.c_str() + eq;
+	Control* ctl = Fifo.getControl();
+	if (name == "PAUSE" && !arg)
+	{	OutputPause.Set(true);
+		return string();
+	}
+	if (name == "RESUME" && !arg)
+	{	OutputPause.Set(false);
+		return string();
+	}
+	if (name == "STAT" && !arg)
+	{	volatile const MM::FIFO::FIFO::Statistics& stat = Fifo.getStatistics();
+		string ret;
+		if (ctl)
+			ret = stringf("size %llu\nlevel %llu\nhigh %llu\nlow %llu\n",
+				(unsigned long long)ctl->getSize(), (unsigned long long)ctl->getLevel(),
+				(unsigned long long)ctl->getHighWaterMark(), (unsigned long long)ctl->getLowWaterMark());
+		if (stat.OutputRate)
+			ret += stringf("rate %.0f\n", stat.OutputRate);
+		if (DropOldest || FillRate)
+			ret += stringf("dropped %llu\nfill %llu\n", (unsigned long long)stat.DroppedBytes, (unsigned long long)stat.FillBytes);
+		ret += stringf("output %s\nfull %llu\nempty %llu\nsplit %llu\nresident %llu\npeak %llu\n",
+			OutputPause.isPaused() ? "paused" : "running",
+			(unsigned long long)stat.FullCount, (unsigned long long)stat.EmptyCount, (unsigned long long)stat.SplitCount,
+			(unsigned long long)stat.ResidentSize, (unsigned long long)stat.PeakResidentSize);
+		return ret;
+	}
+	if (arg && (name == "SIZE" || name == "HIGH" || name == "LOW"))
+	{	if (!ctl)
+			throw runtime_error("The fifo type does not support this command.");
+		if (name == "SIZE")
+		{	int64_t size = parseint(arg);
+			if (size < 1 || (uint64_t)size > (size_t)-1 / 2)
+				throw syntax_error("The buffer size must be positive and must fit into the address space.");
+			// The paused output would never drain the data that does not fit
+			// and this thread could not execute resume anymore.
+			if (OutputPause.isPaused())
+				throw runtime_error("The buffer cannot be resized while the output is paused.");
+			if (!ctl->Resize(CreateStorage((size_t)size)))
+				throw runtime_error("The stream has already ended.");
+			return string();
+		}
+		size_t size = ctl->getSize();
+		double high = (double)ctl->getHighWaterMark() / size;
+		double low = (double)ctl->getLowWaterMark() / size;
+		(name == "HIGH" ? high : low) = parselevel(arg, size);
+		ctl->SetWaterMarks(high, low);
+		return string();
+	}
+	throw syntax_error(stringf("Invalid command %s.", command.c_str()));
+}
+
+// water mark tuning worker class (-h=auto)
+// The worker samples the fifo statistics once per second. It measures the
+// rates of both sides while they run. If the output is faster it has to
+// stop now and then. So the high water mark is set as high as possible
+// while the input does not block until the output has started. Otherwise
+// the input has to stop now and then and the low water mark is set as low
+// as possible while the output does not run dry until the input has
+// restarted. The start times of both sides are unknown. So the worker
+// reserves a margin of some time at the rate of the other side. The margin
+// starts small, grows when the side blocks or runs dry and shrinks slowly
+// otherwise. The high water mark stays in the upper half of the buffer and
+// the low water mark in the lower half, a larger margin needs a larger
+// buffer.
+class TuneWorker : public Worker
+{	Control& Ctl;
+	volatile const MM::FIFO::FIFO::Statistics& Stat;
+	pthread_t Thread;
+	bool Started;
+	bool volatile Stop;
+	// previous sample
+	uint64_t BytesIn, BytesOut;
+	uint64_t FullCount, EmptyCount;
+	double FullTime, EmptyTime;
+	// results
+	double InRate, OutRate;   // bytes per second while running, 0 = unknown
+	double InMargin, OutMargin; // seconds
+	uint64_t OutputStops;
+	uint64_t InputStops;
+ public:
+	TuneWorker(MM::FIFO::FIFO& fifo, Control& ctl);
+	~TuneWorker();
+	void Start();
+	// Stop tuning and wait for the thread.
+	void Join();
+	void operator()();
+	// Print the rates and the options for the next run.
+	void PrintRecommendation();
+ private:
+	// Update the rates and the water marks after secs seconds.
+	void Sample(double secs);
+};
+
+TuneWorker::TuneWorker(MM::FIFO::FIFO& fifo, Control& ctl)
+ :	Ctl(ctl),
+	Stat(fifo.getStatistics()),
+	Started(false),
+	Stop(false),
+	BytesIn(0), BytesOut(0),
+	FullCount(0), EmptyCount(0),
+	FullTime(0), EmptyTime(0),
+	InRate(0), OutRate(0),
+	InMargin(.1), OutMargin(.1),
+	OutputStops(0), InputStops(0)
+{}
+
+TuneWorker::~TuneWorker()
+{	Join();
+}
+
+void TuneWorker::Join()
+{	Stop = true;
+	if (Started)
+		pthread_join(Thread, NULL);
+	Started = false;
+}
+
+void TuneWorker::Start()
+{	int rc = pthread_create(&Thread, NULL, runWorker, this);
+	if (rc != 0)
+		throw os_error(rc, "Failed to start water mark tuning thread.");
+	Started = true;
+}
+
+void TuneWorker::operator()()
+{	try
+	{	uint64_t last = WaitClock();
+		while (!Stop)
+		{	usleep(200000);
+			const uint64_t now = WaitClock();
+			if (now - last >= 1000000000U)
+			{	Sample((now - last) / 1E9);
+				last = now;
+			}
+		}
+	} catch (const exception& e)
+	{	lerr << "Error in water mark tuning: " << e.what() << endl;
+		Result = 14;
+	}
+}
+
+void TuneWorker::Sample(double secs)
+{	const uint64_t in = Stat.BytesIn;
+	const uint64_t out = Stat.BytesOut;
+	const uint64_t full = Stat.FullCount;
+	const uint64_t empty = Stat.EmptyCount;
+	const double fulltime = Stat.FullTime - FullTime;
+	const double emptytime = Stat.EmptyTime - EmptyTime;
+	// The first sample contains the start of both sides.
+	const bool started = InRate && OutRate;
+	// rates while running, smoothed over a few seconds
+	if (in != BytesIn && secs - fulltime > .01)
+	{	double rate = (in - BytesIn) / (secs - fulltime);
+		InRate = InRate ? (3 * InRate + rate) / 4 : rate;
+	}
+	if (out != BytesOut && secs - emptytime > .01)
+	{	double rate = (out - BytesOut) / (secs - emptytime);
+		OutRate = OutRate ? (3 * OutRate + rate) / 4 : rate;
+	}
+	bool blocked = full != FullCount;
+	bool ranDry = empty != EmptyCount && out != BytesOut;
+	InputStops += full - FullCount;
+	OutputStops += empty - EmptyCount;
+	BytesIn = in;
+	BytesOut = out;
+	FullCount = full;
+	EmptyCount = empty;
+	FullTime += fulltime;
+	EmptyTime += emptytime;
+	if (!InRate || !OutRate)
+		return;
+
+	const double size = Ctl.getSize();
+	if (!started)
+		blocked = ranDry = false;
+	double high, low;
+	if (OutRate > InRate)
+	{	// The output stops. Keep the input from blocking while the output starts.
+		InMargin = blocked ? min(InMargin * 2 + fulltime, 60.) : max(InMargin * .95, .05);
+		high = 1 - InRate * InMargin / size;
+		low = 1;
+	} else
+	{	// The input stops. Keep the output from running dry while the input restarts.
+		OutMargin = ranDry ? min(OutMargin * 2 + emptytime, 60.) : max(OutMargin * .95, .05);
+		high = 1 - InRate * InMargin / size;
+		low = OutRate * OutMargin / size;
+	}
+	Ctl.SetWaterMarks(max(.5, min(1., high)), max(0., min(.5, low)));
+}
+
+void TuneWorker::PrintRecommendation()
+{	lerr << "Auto water marks: ";
+	if (!InRate || !OutRate)
+	{	lerr << "The run was too short to measure the rates." << endl;
+		return;
+	}
+	lerr << "input " << InRate/1024 << " kiB/s, output " << OutRate/1024 << " kiB/s while running, "
+		<< "the input stopped " << InputStops << " times, the output " << OutputStops << " times." << endl;
+	double size = Ctl.getSize();
+	double high = (double)Ctl.getHighWaterMark() / size;
+	double low;
+	if (OutRate > InRate)
+	{	// The output should run at least half a minute between two stops.
+		size = 30 * (OutRate - InRate) + InRate * InMargin;
+		high = 1 - InRate * InMargin / size;
+		low = 1;
+	} else
+		// The output does not stop, the buffer is large enough.
+		low = OutRate * OutMargin / size;
+	// Print what Sample would tune.
+	high = max(.5, min(1., high));
+	low = max(0., min(.5, low));
+	const int64_t mib = max((int64_t)1, ((int64_t)size + (1<<20) - 1) >> 20);
+	lerr << stringf("Auto water marks: recommended for the next run: -b=%lliM -h=%.1f%% -l=%.1f%%",
+		(long long)mib, high * 100, low * 100) << endl;
 }
-#else
-#define slash2backslash(x)
 #endif
 
+static void PrintFIFOStatistics()
+{	lerr << "Fifo: " << FIFOstat->FullCount << " times full, " << FIFOstat->EmptyCount << " times empty, "
+		<< FIFOstat->SplitCount << (MemoryType == Storage::Mirror ? " requests crossed the end of the mirrored buffer." : " requests split at the end of the buffer.") << endl;
+	lerr << "Fifo memory: " << FIFOstat->AllocTime*1000. << " ms to allocate";
+	if (PrefaultMemory)
+		lerr << ", " << FIFOstat->PrefaultTime*1000. << " ms to prefault";
+	lerr << "." << endl;
+	lerr << "Fifo memory: " << FIFOstat->ResidentSize/1024 << " kiB allocated, " << FIFOstat->PeakResidentSize/1024 << " kiB peak." << endl;
+	if (FIFOImpl == FT_Spill)
+	{	lerr << "Spill file: " << FIFOstat->SpillBytes/1024 << " kiB written, " << FIFOstat->PeakSpillSize/1024 << " kiB peak." << endl;
+		if (FIFOstat->SpillError)
+			lerr << "Spill file: writing failed: " << strerror(FIFOstat->SpillError) << endl;
+	}
+	if (FIFOImpl == FT_Compressed)
+	{	lerr << "Compression: " << FIFOstat->CompressIn/1024 << " kiB compressed to " << FIFOstat->CompressOut/1024 << " kiB";
+		if (FIFOstat->CompressOut)
+			lerr << " (ratio " << (double)FIFOstat->CompressIn / FIFOstat->CompressOut << ")";
+		lerr << ", " << FIFOstat->RawBlocks << " blocks stored raw." << endl;
+		lerr << "Compression: " << FIFOstat->CompressTime*1000. << " ms CPU to compress, "
+			<< FIFOstat->DecompressTime*1000. << " ms CPU to decompress." << endl;
+	}
+	if (FIFOstat->OutputRate)
+		lerr << "Fifo output rate: " << FIFOstat->OutputRate/1024 << " kiB/s for the water marks in seconds." << endl;
+	const uint64_t wakeups = FIFOstat->SpinWakeups + FIFOstat->SleepWakeups;
+	if (wakeups)
+	{	lerr << "Fifo wakeups: " << FIFOstat->SleepWakeups << " after sleeping";
+		if (FIFOImpl == FT_LowLatency)
+			lerr << ", " << FIFOstat->SpinWakeups << " while spinning";
+		lerr << ", latency " << FIFOstat->WakeLatency / wakeups / 1000. << " us average, "
+			<< FIFOstat->MaxWakeLatency / 1000. << " us maximum";
+		if (FIFOImpl == FT_LowLatency)
+			lerr << ", " << FIFOstat->SpinTime / 1000000. << " ms spinning";
+		lerr << "." << endl;
+	}
+}
+
+
+// output and the lag limit from -d in front of it
+struct OutputSpec
+{	const char* Name;
+	int64_t MaxLag; // 0 = block the input
+	OutputSpec(const char* name, int64_t maxlag) : Name(name), MaxLag(maxlag) {}
+};
+
 int main(int argc, char** argv)
 {	const char* input = NULL;
-	const char* output = NULL;
+	vector<OutputSpec> outputs;
 
 	try
 	{	char** ap = argv;
@@ -333,24 +1612,28 @@ int main(int argc, char** argv)
 			 else if (input == NULL)
 			{	slash2backslash(*ap);
 				input = *ap;
-			} else if (output == NULL)
-			{	slash2backslash(*ap);
-				output = *ap;
 			} else
-				throw syntax_error(stringf("More than two I/O objects in the command line (at %s).", *ap));
+			{	slash2backslash(*ap);
+				outputs.push_back(OutputSpec(*ap, DetachLag));
+			}
 		}
 
 		// check if we have source & destination
-		if (output == NULL)
+		if (outputs.empty())
 		{	cerr << "Buffer2 Version 0.12\n\n"
-				"usage " << argv[0] << " <input> <output> [options]\n\n"
+				"usage " << argv[0] << " <input> <output> [<output> ...] [options]\n\n"
 				"<input>: Input stream. This is one of\n"
 				"         Filename - an ordinary file which is read until EOF,\n"
 				#ifdef __OS2__
 				"         Pipe - a named pipe e.g. \\PIPE\\MyPipe,\n"
 				#endif
 				"         Device - any character device like \"COM1:\" or \"/dev/st0\",\n"
+				#if defined(__OS2__) || defined(_WIN32)
 				"         Socket - a TCP/IP port tcpip://[hostname]:port or\n"
+				#else
+				"         Socket - a TCP/IP port tcpip://[hostname]:port,\n"
+				"         shm:name - shared memory fifo written by another process or\n"
+				#endif
 				"         \"-\" - stdin\n"
 				"<output>: Output stream. This is one of\n"
 				"          Filename - an ordinary file which is APPENDED,\n"
@@ -358,17 +1641,24 @@ int main(int argc, char** argv)
 				"          Pipe - a named pipe e.g. \\PIPE\\MyPipe,\n"
 				#endif
 				"          Device - any character device like \"LPT1:\" or \"/dev/st0\",\n"
+				#if defined(__OS2__) || defined(_WIN32)
 				"          Socket - a TCP/IP port tcpip://[hostname]:port or\n"
-				"          \"-\" - stdout.\n\n"
+				#else
+				"          Socket - a TCP/IP port tcpip://[hostname]:port,\n"
+				"          shm:name - shared memory fifo read by another process or\n"
+				#endif
+				"          \"-\" - stdout.\n"
+				"          Each of several outputs gets the whole stream.\n\n"
 				#ifdef __OS2__
 				"Remarks: If the pipe does not exist so far it is created.\n"
 				#endif
 				"The Hostname may be an IP address or a DNS name. If hostname is omitted a local\n"
-				"socket is created in listening mode accepting exactly one connection.\n\n"
+				"socket is created in listening mode accepting exactly one connection unless\n"
+				"-j is given.\n\n"
 				"options:\n"
 				" -b=<size>  Internal fifo buffer size. 64kiB by default. If the number is\n"
-				"            followed directly by the letter `k', `m' or `g' the size is\n"
-				"            multiplied by 1024 to the power of 1, 2 or 3.\n"
+				"            followed directly by the letter `k', `m', `g' or `t' the size is\n"
+				"            multiplied by 1024 to the power of 1, 2, 3 or 4.\n"
 				" -r=<size>  I/O-request size. As much as possible by default. The request size\n"
 				"            should neither exceed the fifo size nor the pipe buffer size.\n"
 				"            Larger values have no effect.\n"
@@ -383,13 +1673,113 @@ int main(int argc, char** argv)
 				"            buffer size. If level ends with % the size is relative to the\n"
 				"            buffer size in percent. The default value of 0 causes the output\n"
 				"            thread never to stop unless the buffer is empty.\n"
+				"            If level ends with s or ms it is the time the output needs for\n"
+				"            the data at its measured rate. The output starts at a full\n"
+				"            buffer until the rate is known. Only with -f=lock or lowlat.\n"
+				#if !defined(__OS2__) && !defined(_WIN32)
+				"            auto adjusts both water marks to the measured rates to avoid\n"
+				"            stops of the output and prints recommended options at the end.\n"
+				"            Only with -f=lock or lowlat.\n"
+				#endif
 				" -l=<level> Low water mark. If the input thread is stopped because the buffer\n"
 				"            is full it will not resume until the buffer is emptied at least to\n"
 				"            the low water mark. The level must be be less than or equal to the\n"
 				"            buffer size. If level ends with % the size is relative to the\n"
 				"            buffer size in percent. The default value of 100% causes the input\n"
 				"            thread never to stop unless the buffer is completly full.\n"
+				"            If level ends with s or ms it is a time like at -h.\n"
+				" -w=<time>  Maximum time that data waits for the high water mark, e.g.\n"
+				"            200ms. Only with -f=lock or lowlat.\n"
 				" -c         Enable file system cache.\n"
+				#ifndef __OS2__
+				" -o         Direct I/O for files and block devices. Transfers bypass the\n"
+				"            file system cache and need no synchronous writes. Falls back\n"
+				"            to normal I/O if the file system does not support it.\n"
+				" -q=<depth> Asynchronous I/O with io_uring for files and block devices.\n"
+				"            Up to depth requests of the size of -r are in flight at each\n"
+				"            side. Only with -f=lock or lowlat and a single output.\n"
+				#endif
+				#ifdef __linux__
+				" -z         Zero copy output to a pipe with vmsplice. The reader of the\n"
+				"            pipe must copy the data, e.g. with read. A reader that splices\n"
+				"            it further, e.g. pv, silently corrupts the output.\n"
+				"            Only with -f=lock or lowlat and a single output.\n"
+				#endif
+				#if !defined(__OS2__) && !defined(_WIN32)
+				" -e=<format> Pass whole records. Each write to the output ends at a record\n"
+				"            boundary. Requires -m=mirror and -f=lock, spsc or lowlat.\n"
+				"            line - records end with a newline, delim:<hex> - records end\n"
+				"            with the byte hex, len2, len4 - records start with their\n"
+				"            length as 16 or 32 bit big endian integer, len2le, len4le -\n"
+				"            the same little endian. The length excludes the prefix.\n"
+				#endif
+				" -f=<type>  Fifo implementation. `lock' (default) uses a mutex protected\n"
+				"            buffer, `spsc' a lock-free single producer single consumer ring\n"
+				"            that only enters the kernel when one side has to wait, `seg' a\n"
+				"            chain of segments that grows up to the buffer size on demand and\n"
+				"            returns unused segments to the operating system.\n"
+				"            `spill:<dir>' continues in a file in dir when the buffer is full.\n"
+				"            `persist:<file>' keeps the buffer in file. If the program is\n"
+				"            restarted it continues with the data left in the file.\n"
+				"            `lz4' stores the data compressed when the output falls behind.\n"
+				"            `lowlat' is like lock, but a waiting side spins for a short,\n"
+				"            adaptive time before it sleeps. Lower latency, more CPU time.\n"
+				#ifdef __linux__
+				"            `splice' relays the data with splice through kernel pipes, it\n"
+				"            never enters the process. For files, block devices, pipes and\n"
+				"            sockets. Falls back to lock for other endpoints.\n"
+				#endif
+				" -i=<input> Additional input. Implies -j=seq.\n"
+				" -j=<mode>[:<n>] Merge all inputs into the fifo. A listening socket accepts\n"
+				"            n connections, any number by default. Each one is an input.\n"
+				"            seq - the inputs one after another in the order of the command\n"
+				"            line and of the connections, the data is passed unchanged,\n"
+				"            frame - all inputs at the same time, the data is passed in\n"
+				"            frames with an 8 byte header: stream number and length as 32 bit\n"
+				"            big endian integers. A frame of length 0 ends a stream.\n"
+				" -t=<filter> Process the data in place before it is written. Each -t runs\n"
+				"            in its own thread, in the order of the command line.\n"
+				"            crc32 - print the CRC-32 of the stream to stderr,\n"
+				"            swap2, swap4, swap8 - reverse the byte order of 16, 32 or 64 bit\n"
+				"            words, xor:<hexkey> - XOR with a repeating key (no encryption).\n"
+				#if !defined(__OS2__) && !defined(_WIN32)
+				" -u=<path>  Control socket. Each line sent to this Unix socket is a command:\n"
+				"            size=<size> - resize the buffer without losing data,\n"
+				"            high=<level>, low=<level> - change the water marks,\n"
+				"            pause, resume - stop and continue the output,\n"
+				"            stat - print the buffer level and the fifo statistics.\n"
+				#endif
+				" -xo        Lossy input. When the buffer is full the oldest data is dropped\n"
+				"            instead of stopping the input. Only with -f=lock or lowlat.\n"
+				" -xu=<rate>[:<hex>] Lossy output. When the output would wait for data it\n"
+				"            gets the fill pattern hex (one zero byte by default) at rate\n"
+				"            bytes per second instead, until the buffer reaches the high\n"
+				"            water mark again. Only with -f=lock or lowlat.\n"
+				" -d=<size>  Detach the outputs that follow in the command line when size\n"
+				"            bytes wait for them in the buffer. The other outputs continue.\n"
+				"            By default or with -d=0 the input waits for the slowest output.\n"
+				" -y=<ms>    Interval of the disk updates of -f=persist. 1000ms by default.\n"
+				" -g=<size>  Segment size of -f=seg. The request size by default.\n"
+				"            Chunk size of the spill file I/O of -f=spill. 4MiB by default.\n"
+				"            Block size of -f=lz4. 256kiB or a quarter of the buffer by default.\n"
+				#if defined(__OS2__) || defined(_WIN32)
+				" -m=<type>  Fifo memory. Only `heap' is supported on this platform.\n"
+				#else
+				" -m=<type>  Fifo memory. This is one of\n"
+				"            heap - memory from the heap, it is touched at startup (default),\n"
+				"            mmap - lazily allocated anonymous memory,\n"
+				"            huge - huge pages from the huge page pool (vm.nr_hugepages),\n"
+				"            thp - transparent huge pages,\n"
+				"            mirror - pages mapped twice, so no request is split at the end\n"
+				"            of the buffer.\n"
+				"            Except for heap the size is rounded up to a multiple of the\n"
+				"            page size.\n"
+				" -mp[=<n>]  Prefault the fifo memory at startup with n threads. One thread\n"
+				"            per CPU by default.\n"
+				" -ml        Lock the fifo memory into physical memory (see ulimit -l).\n"
+				" -mc        Reduce the buffer size to the memory that is left within the\n"
+				"            memory limit of the control group (cgroup) of the process.\n"
+				#endif
 				#ifdef __OS2__
 				" -ai        Prefer input. This raises the priority of the input thread.\n"
 				" -ao        Prefer output. This raises the priority of the output thread.\n"
@@ -400,6 +1790,16 @@ int main(int argc, char** argv)
 		}
 
 		// some calculations
+		if (LimitToCGroup)
+		{	uint64_t avail = Storage::AvailableMemory();
+			if ((uint64_t)BufferSize > avail)
+			{	BufferSize = avail;
+				if (BufferSize < 1)
+					throw runtime_error("No memory left within the memory limit of the control group.");
+			}
+		}
+		if ((uint64_t)BufferSize > (size_t)-1 / 2)
+			throw syntax_error("The buffer size exceeds the address space of this platform.");
 		if (dHighWaterMark < 0)
 		{	if (iHighWaterMark > BufferSize)
 				throw syntax_error("The high water mark is larger than the buffer size.");
@@ -413,45 +1813,267 @@ int main(int argc, char** argv)
 		if (RequestSize < 0)
 		{	// Auto Calculate
 			RequestSize = BufferSize >= 1024*256 ? BufferSize / 8 : BufferSize / 4;
-		}
+		} else if (RequestSize > BufferSize)
+			RequestSize = BufferSize; // Larger values have no effect.
+		if (MergeInputs && MergeMode == MT_Framed && RequestSize > (int64_t)0xFFFFFFFFU)
+			throw syntax_error("The frame header of -j=frame takes at most 4 GiB per request.");
+		if (SegmentSize < 0)
+			SegmentSize = FIFOImpl == FT_Spill ? 4*1024*1024 // large sequential I/O
+				: FIFOImpl == FT_Compressed ? min(BufferSize / 4, (int64_t)256*1024)
+				: (RequestSize + BufferAlignment - 1) & -(int64_t)BufferAlignment;
+		 else if (SegmentSize > BufferSize && (FIFOImpl == FT_Segmented || FIFOImpl == FT_Compressed))
+			SegmentSize = BufferSize;
 		
 		// initialize buffer and Workers
-		StaticFIFO fifo(BufferSize, dHighWaterMark, dLowWaterMark, BufferAlignment);
-		FIFOstat = &fifo.getStatistics();
-		InputWorker iwrk(fifo.getDrain(), IInput::Factory(input));
-		OutputWorker owrk(fifo.getSource(), IOutput::Factory(output));
-
-		// start reader thread
-		#ifdef __OS2__
-		int iwtid = _beginthread(runInputWorker, NULL, 65536, &iwrk);
-		if (iwtid == -1)
-			throw runtime_error("Failed to start input worker thread.");
-		if (AdvantageInput)
-			DosSetPriority(PRTYS_THREAD, PRTYC_NOCHANGE, 1, iwtid);
-		if (AdvantageOutput)
-			DosSetPriority(PRTYS_THREAD, PRTYC_NOCHANGE, 1, 0);
+		const char* output = outputs[0].Name;
+		bool tee = outputs.size() > 1 || outputs[0].MaxLag != 0;
+		if (tee && FIFOImpl != FT_Static)
+			throw syntax_error("Multiple outputs and -d are only supported by -f=lock.");
+		#if defined(__OS2__) || defined(_WIN32)
+		const bool shmin = false;
+		const bool shmout = false;
 		#else
-		pthread_t iwth;
-		int rc = pthread_create(&iwth, NULL, runInputWorker, &iwrk);
-		if (rc != 0)
-			throw os_error(rc, "Failed to start input worker thread.");
+		// A shared memory side is served by another process directly.
+		const bool shmin = strncmp(input, SHMPREFIX, 4) == 0;
+		bool shmout = false;
+		for (size_t i = 0; i < outputs.size(); ++i)
+			shmout |= strncmp(outputs[i].Name, SHMPREFIX, 4) == 0;
+		if (shmin && shmout)
+			throw syntax_error("Only one of input and output can be a shared memory fifo.");
+		if (tee && (shmin || shmout))
+			throw syntax_error("A shared memory fifo cannot be used with multiple outputs or -d.");
+		if (MergeInputs && shmin)
+			throw syntax_error("A shared memory fifo cannot be used with -i or -j.");
+		if (Filters.size() && (shmin || shmout))
+			throw syntax_error("A shared memory fifo cannot be used with -t.");
 		#endif
-
-		// execute output worker in main thread
-		owrk();
-		
-		#ifdef __OS2__
-		// join the input worker thread
-		TID tid = iwtid;
-		DosWaitThread(&tid, DCWW_WAIT);
-		#else
-		pthread_join(iwth, NULL);
+		if (Filters.size() && (tee || FIFOImpl != FT_Static))
+			throw syntax_error("-t is only supported by -f=lock with a single output.");
+		if (FramingSpec)
+		{	// A record must not be split at the end of the buffer.
+			if (MemoryType != Storage::Mirror)
+				throw syntax_error("-e requires -m=mirror.");
+			if (FIFOImpl != FT_Static && FIFOImpl != FT_SPSC && FIFOImpl != FT_LowLatency)
+				throw syntax_error("-e is only supported by -f=lock, spsc or lowlat.");
+			if (MergeInputs || Filters.size() || shmin || shmout)
+				throw syntax_error("-e cannot be used with -i, -j, -t or a shared memory fifo.");
+			if (DropOldest || FillRate)
+				throw syntax_error("-e cannot be used with -xo or -xu.");
+		}
+		if (QueueDepth)
+		{	// The workers need the fill level of the fifo and a stable buffer.
+			if (tee || (FIFOImpl != FT_Static && FIFOImpl != FT_LowLatency))
+				throw syntax_error("-q is only supported by -f=lock or lowlat with a single output.");
+			if (MergeInputs || Filters.size() || FramingSpec || shmin || shmout)
+				throw syntax_error("-q cannot be used with -e, -i, -j, -t or a shared memory fifo.");
+			if (DropOldest || FillRate || ControlPath)
+				throw syntax_error("-q cannot be used with -u, -xo or -xu.");
+		}
+		if (ZeroCopy)
+		{	if (tee || (FIFOImpl != FT_Static && FIFOImpl != FT_LowLatency))
+				throw syntax_error("-z is only supported by -f=lock or lowlat with a single output.");
+			if (Filters.size() || FramingSpec || shmout || ControlPath || DropOldest || FillRate)
+				throw syntax_error("-z cannot be used with -e, -t, -u, -xo, -xu or a shared memory fifo.");
+		}
+		// The relay falls back to -f=lock if an endpoint does not support splice.
+		auto_ptr<ISpliceEnd> splicein, spliceout;
+		if (FIFOImpl == FT_Splice)
+		{	if (MergeInputs || Filters.size() || FramingSpec || shmin || shmout)
+				throw syntax_error("-f=splice cannot be used with -e, -i, -j, -t or a shared memory fifo.");
+			if (DirectIO || QueueDepth || ZeroCopy || MaxLatency || DropOldest || FillRate)
+				throw syntax_error("-f=splice cannot be used with -o, -q, -w, -xo, -xu or -z.");
+			if (HighWaterTime || LowWaterTime || AutoWaterMarks)
+				throw syntax_error("-f=splice cannot be used with water marks in seconds or -h=auto.");
+			splicein.reset(ISpliceEnd::Factory(input, false));
+			spliceout.reset(ISpliceEnd::Factory(output, true));
+			if (!splicein.get() || !spliceout.get())
+			{	lerr << (splicein.get() ? output : input) << " does not support splice, using -f=lock." << endl;
+				FIFOImpl = FT_Static;
+			}
+		}
+		auto_ptr<IFraming> framing(FramingSpec ? IFraming::Factory(FramingSpec) : NULL);
+		Framing = framing.get();
+		// create the filters first because their granularity is part of the fifo layout
+		WorkerList<StageWorker> swrk;
+		vector<IFilter*> filters;
+		vector<size_t> granularity;
+		for (size_t i = 0; i < Filters.size(); ++i)
+		{	filters.push_back(IFilter::Factory(Filters[i]));
+			granularity.push_back(filters.back()->Granularity());
+		}
+		auto_ptr<MM::FIFO::FIFO> fifo;
+		TeeFIFO* teefifo = NULL;
+		StageFIFO* stagefifo = NULL;
+		SpliceFIFO* splicefifo = NULL;
+		#if !defined(__OS2__) && !defined(_WIN32)
+		if (shmin || shmout)
+			fifo.reset(new ShmFIFO(shmin ? input+4 : output+4, BufferSize, dHighWaterMark, dLowWaterMark,
+				shmin ? ShmFIFO::Reader : ShmFIFO::Writer));
+		 else
 		#endif
+		if (tee)
+		{	teefifo = new TeeFIFO(CreateStorage(BufferSize), dHighWaterMark, dLowWaterMark);
+			fifo.reset(teefifo);
+			for (size_t i = 0; i < outputs.size(); ++i)
+				if (outputs[i].MaxLag)
+					teefifo->AddReader(TeeFIFO::Detach, (size_t)min(outputs[i].MaxLag, BufferSize));
+				 else
+					teefifo->AddReader(TeeFIFO::Block);
+		} else if (filters.size())
+		{	try
+			{	stagefifo = new StageFIFO(CreateStorage(BufferSize), dHighWaterMark, dLowWaterMark, granularity);
+			} catch (...)
+			{	for (size_t i = 0; i < filters.size(); ++i)
+					delete filters[i];
+				throw;
+			}
+			fifo.reset(stagefifo);
+			for (size_t i = 0; i < filters.size(); ++i)
+			{	swrk.push_back(NULL);
+				swrk.back() = new StageWorker(stagefifo->getStage(i), filters[i]);
+			}
+		} else if (FIFOImpl == FT_Splice)
+		{	splicefifo = new SpliceFIFO((size_t)BufferSize, dHighWaterMark, dLowWaterMark);
+			fifo.reset(splicefifo);
+			if (splicefifo->getCapacity() < (size_t)BufferSize)
+				lerr << "Note: the pipes of -f=splice take only " << splicefifo->getCapacity()/1024 << " kiB instead of "
+					<< BufferSize/1024 << " kiB. See /proc/sys/fs/pipe-max-size and pipe-user-pages-soft." << endl;
+		} else
+			fifo.reset(CreateFIFO());
+		if (HighWaterTime || LowWaterTime || MaxLatency)
+		{	Control* ctl = fifo->getControl();
+			if (!ctl)
+				throw syntax_error("Water marks in seconds and -w are only supported by -f=lock or lowlat with a single output.");
+			ctl->SetTimeLimits(HighWaterTime, LowWaterTime, MaxLatency);
+		}
+		if (DropOldest || FillRate)
+		{	Control* ctl = fifo->getControl();
+			if (!ctl)
+				throw syntax_error("-xo and -xu are only supported by -f=lock or lowlat with a single output.");
+			ctl->SetOverflow(DropOldest);
+			ctl->SetUnderrun(&FillPattern[0], FillPattern.size(), (double)FillRate);
+		}
+		FIFOstat = &fifo->getStatistics();
+		#if !defined(__OS2__) && !defined(_WIN32)
+		auto_ptr<ControlWorker> cwrk;
+		if (ControlPath)
+		{	cwrk.reset(new ControlWorker(*fifo, ControlPath));
+			cwrk->Start();
+		}
+		auto_ptr<TuneWorker> twrk;
+		if (AutoWaterMarks)
+		{	Control* ctl = fifo->getControl();
+			if (!ctl)
+				throw syntax_error("-h=auto is only supported by -f=lock or lowlat with a single output.");
+			twrk.reset(new TuneWorker(*fifo, *ctl));
+			twrk->Start();
+		}
+		#endif
+		auto_ptr<InputWorker> iwrk;
+		WorkerList<OutputWorker> owrk;
+		if (MergeInputs)
+		{	vector<const char*> inputs(1, input);
+			inputs.insert(inputs.end(), MoreInputs.begin(), MoreInputs.end());
+			iwrk.reset(new MergeWorker(fifo->getDrain(), inputs));
+		} else if (!shmin)
+		{
+			#if !defined(__OS2__) && !defined(_WIN32)
+			IAsyncFile* async = QueueDepth ? IAsyncFile::Factory(input, false, QueueDepth) : NULL;
+			if (splicefifo)
+				iwrk.reset(new RelayInputWorker(*splicefifo, splicein.release()));
+			 else if (async)
+				iwrk.reset(new AsyncInputWorker(fifo->getDrain(), *fifo->getControl(), async));
+			 else
+			#endif
+				iwrk.reset(new InputWorker(fifo->getDrain(), IInput::Factory(input)));
+		}
+		if (!shmout)
+		{	for (size_t i = 0; i < outputs.size(); ++i)
+			{	Source& src = teefifo ? teefifo->getSource(i) : fifo->getSource();
+				owrk.push_back(NULL);
+				#if !defined(__OS2__) && !defined(_WIN32)
+				IPipeOutput* pipe = ZeroCopy ? IPipeOutput::Factory(outputs[i].Name) : NULL;
+				IAsyncFile* async = QueueDepth && !pipe ? IAsyncFile::Factory(outputs[i].Name, true, QueueDepth) : NULL;
+				if (splicefifo)
+					owrk.back() = new RelayOutputWorker(*splicefifo, spliceout.release());
+				 else if (pipe)
+					owrk.back() = new SpliceOutputWorker(src, *fifo->getControl(), pipe);
+				 else if (async)
+					owrk.back() = new AsyncOutputWorker(src, *fifo->getControl(), async);
+				 else
+				#endif
+					owrk.back() = new OutputWorker(src, IOutput::Factory(outputs[i].Name));
+			}
+		}
+
+		if (shmout)
+			// no output worker, execute input worker in main thread
+			(*iwrk)();
+		 else if (shmin)
+			// no input worker, execute output worker in main thread
+			(*owrk[0])();
+		 else
+		{	// start reader thread, the threads of all outputs except for the first one
+			// and the processing stages
+			vector<Worker*> threads(1, iwrk.get());
+			threads.insert(threads.end(), owrk.begin() + 1, owrk.end());
+			threads.insert(threads.end(), swrk.begin(), swrk.end());
+			#ifdef __OS2__
+			vector<TID> tids;
+			for (size_t i = 0; i < threads.size(); ++i)
+			{	int tid = _beginthread(runWorker, NULL, 65536, threads[i]);
+				if (tid == -1)
+					throw runtime_error(i ? "Failed to start worker thread." : "Failed to start input worker thread.");
+				tids.push_back(tid);
+			}
+			if (AdvantageInput)
+				DosSetPriority(PRTYS_THREAD, PRTYC_NOCHANGE, 1, tids[0]);
+			if (AdvantageOutput)
+				DosSetPriority(PRTYS_THREAD, PRTYC_NOCHANGE, 1, 0);
+			#else
+			vector<pthread_t> tids;
+			for (size_t i = 0; i < threads.size(); ++i)
+			{	pthread_t tid;
+				int rc = pthread_create(&tid, NULL, runWorker, threads[i]);
+				if (rc != 0)
+					throw os_error(rc, i ? "Failed to start worker thread." : "Failed to start input worker thread.");
+				tids.push_back(tid);
+			}
+			#endif
+
+			// execute the first output worker in main thread
+			(*owrk[0])();
+
+			// join the other worker threads
+			for (size_t i = 0; i < tids.size(); ++i)
+			{
+				#ifdef __OS2__
+				DosWaitThread(&tids[i], DCWW_WAIT);
+				#else
+				pthread_join(tids[i], NULL);
+				#endif
+			}
+		}
 
 		if (EnableInputStats | EnableOutputStats)
-			lerr << endl;
+		{	lerr << endl;
+			PrintFIFOStatistics();
+		}
+		#if !defined(__OS2__) && !defined(_WIN32)
+		if (twrk.get())
+		{	twrk->Join();
+			twrk->PrintRecommendation();
+		}
+		#endif
+		if (DropOldest || FillRate)
+			lerr << "Lossy fifo: " << FIFOstat->DroppedBytes << " bytes dropped, " << FIFOstat->FillBytes << " bytes of fill pattern inserted." << endl;
 
-		return iwrk.getResult() != 0 ? iwrk.getResult() : owrk.getResult();
+		int result = iwrk.get() ? iwrk->getResult() : 0;
+		for (size_t i = 0; result == 0 && i < owrk.size(); ++i)
+			result = owrk[i]->getResult();
+		for (size_t i = 0; result == 0 && i < swrk.size(); ++i)
+			result = swrk[i]->getResult();
+		return result;
 
 	} catch (const syntax_error& e)
 	{	lerr << e.what();
@@ -2,7 +2,9 @@
 #define __buffer2_h
 
 #include <iostream>
+#include <stdint.h>
 #include <MMUtil+.h>
+#include "storage.h"
 
 extern MM::IPC::Mutex LogMtx;
 #define lerr (MM::IPC::Lock(LogMtx), cerr) // lock cerr until the next syncronization point.
@@ -12,17 +14,45 @@ struct syntax_error : std::logic_error
 };
 
 // configuration
-extern int BufferSize;
-extern int RequestSize;
-extern int PipeSize;
+extern int64_t BufferSize;
+extern int64_t RequestSize;
+extern int64_t PipeSize;
 extern unsigned BufferAlignment;
 
-extern int iHighWaterMark;
+extern int64_t iHighWaterMark;
 extern double dHighWaterMark;
-extern int iLowWaterMark;
+extern int64_t iLowWaterMark;
 extern double dLowWaterMark;
 
+enum FIFOType
+{	FT_Static,  // StaticFIFO, mutex protected
+	FT_SPSC,    // SPSCFIFO, lock-free
+	FT_Segmented, // SegmentedFIFO, grows and shrinks with demand
+	FT_Spill,   // SpillFIFO, overflow to a file
+	FT_Persistent, // PersistentFIFO, memory mapped file
+	FT_Compressed, // CompressedFIFO, LZ4 compressed blocks
+	FT_LowLatency, // LowLatencyFIFO, spins before it sleeps
+	FT_Splice   // SpliceFIFO, kernel pipes, falls back to FT_Static
+};
+extern FIFOType FIFOImpl;
+extern int64_t SegmentSize;
+extern const char* FIFOPath;
+extern long SyncInterval;
+extern MM::FIFO::Storage::Type MemoryType;
+extern bool PrefaultMemory;
+extern unsigned PrefaultThreads;
+extern bool LockMemory;
+extern bool LimitToCGroup;
+
+enum MergeType
+{	MT_Sequential, // one input after the other
+	MT_Framed   // chunks of all inputs interleaved with a frame header
+};
+extern MergeType MergeMode;
+extern unsigned MaxConnections;
+
 extern bool EnableCache;
+extern bool DirectIO;
 extern bool EnableInputStats;
 extern bool EnableOutputStats;
 extern const double StatsUpdate;
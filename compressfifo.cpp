@@ -0,0 +1,348 @@
+/*****************************************************************************
+*
+*  Compressing FIFO buffer implementation.
+*  The worker thread releases the mutex while it compresses or decompresses
+*  a block. During compression it owns the block Compressing and the ring
+*  space behind RingWrPos. During decompression it owns the first entry of
+*  the ring and the read block it has taken from FreeRead.
+*
+*****************************************************************************/
+
+#include "compressfifo.h"
+#include <stdexcept>
+#include <string.h>
+
+#if !defined(__OS2__) && !defined(_WIN32)
+#include <time.h>
+#endif
+
+namespace MM {
+namespace FIFO {
+
+using namespace MM::IPC;
+
+#if defined(__OS2__) || defined(_WIN32)
+CompressedFIFO::CompressedFIFO(Storage* storage, double, size_t)
+ : Buffer(storage)
+ , HighWaterMark(0)
+ , BlockSize(0)
+ , NotifyDrain(StateLock)
+ , NotifySource(StateLock)
+ , NotifyWorker(StateLock)
+{  throw std::runtime_error("The compressed fifo is not supported on this platform.");
+}
+
+CompressedFIFO::~CompressedFIFO()
+{}
+
+#else
+// CPU time of the calling thread in seconds.
+static double ThreadTime()
+{  struct timespec ts;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+CompressedFIFO::CompressedFIFO(Storage* storage, double highwater, size_t blocksize)
+ : Buffer(storage)
+ , BufferBegin(Buffer->begin())
+ , BufferSize(Buffer->size())
+ , HighWaterMark(Part2Bytes(highwater))
+ , BlockSize(blocksize)
+ , Current(NULL)
+ , RdBlock(NULL)
+ , Compressing(NULL)
+ , RingWrPos(0)
+ , RingRdPos(0)
+ , Level(0)
+ , RdReq(0)
+ , WrReq(0)
+ , WorkerIdle(false)
+ , ReaderWaiting(false)
+ , Corrupt(false)
+ , EOS(false)
+ , Die(false)
+ , NotifyDrain(StateLock)
+ , NotifySource(StateLock)
+ , NotifyWorker(StateLock)
+{  if (BlockSize == 0 || BlockSize > BufferSize)
+      throw std::invalid_argument("The block size of the CompressedFIFO must be positive and must not exceed the buffer size.");
+   Stat.AllocTime = Buffer->getAllocTime();
+   Stat.PrefaultTime = Buffer->getPrefaultTime();
+   Stat.ResidentSize = Stat.PeakResidentSize = BufferSize + (WriteBlocks + ReadBlocks) * BlockSize;
+   try
+   {  for (unsigned i = 0; i < WriteBlocks + ReadBlocks; ++i)
+      {  Blocks.push_back(new Block(BlockSize));
+         (i < WriteBlocks ? FreeWrite : FreeRead).push_back(Blocks.back());
+      }
+      int rc = pthread_create(&WorkerThread, NULL, WorkerStub, this);
+      if (rc != 0)
+         throw os_error(rc, "Failed to start the compression worker thread.");
+   } catch (...)
+   {  for (size_t i = 0; i < Blocks.size(); ++i)
+         delete Blocks[i];
+      throw;
+   }
+}
+
+CompressedFIFO::~CompressedFIFO()
+{  {  Lock lc(StateLock);
+      Die = true;
+      NotifyWorker.NotifyAll();
+   }
+   pthread_join(WorkerThread, NULL);
+   for (size_t i = 0; i < Blocks.size(); ++i)
+      delete Blocks[i];
+}
+
+void* CompressedFIFO::WorkerStub(void* arg)
+{  ((CompressedFIFO*)arg)->Worker();
+   return NULL;
+}
+
+void CompressedFIFO::Worker()
+{  Lock lc(StateLock);
+   while (!Die && !Corrupt)
+   {  uint64_t pos;
+      // Compress only if the staging blocks pile up. As long as the reader
+      // keeps up it reads them directly.
+      if (!Entries.empty() && !FreeRead.empty())
+         Decompress(lc);
+       else if ( !Pending.empty() && (Pending.size() > 1 || FreeWrite.empty())
+         && !(RdReq && RdBlock == Pending.front())
+         && Reserve(Pending.front()->Len - Pending.front()->Begin, pos) )
+         Compress(lc);
+       else
+      {  WorkerIdle = true;
+         NotifyWorker.Wait();
+         WorkerIdle = false;
+      }
+   }
+}
+
+bool CompressedFIFO::Reserve(size_t len, uint64_t& pos) const
+{  pos = RingWrPos;
+   // A block must be contiguous, skip the rest of the ring unless it is mirrored.
+   size_t offset = pos % BufferSize;
+   if (!Buffer->isMirrored() && BufferSize - offset < len)
+      pos += BufferSize - offset;
+   return pos + len - RingRdPos <= BufferSize;
+}
+
+void CompressedFIFO::Compress(Lock& lc)
+{  Block* blk = Pending.front();
+   const size_t len = blk->Len - blk->Begin;
+   uint64_t pos;
+   Reserve(len, pos);
+   char* dst = BufferBegin + pos % BufferSize;
+   const char* src = &blk->Data[blk->Begin];
+   Compressing = blk;
+   lc.Release();
+   double time = ThreadTime();
+   // Blocks that do not shrink by at least 1/32 are stored raw.
+   size_t stored = Codec.Compress(src, len, dst, len - 1 - len/32);
+   if (stored == 0)
+   {  memcpy(dst, src, len);
+      stored = len;
+   }
+   time = ThreadTime() - time;
+   lc.Request();
+   Compressing = NULL;
+   Stat.CompressTime += time;
+   Stat.CompressIn += len;
+   Stat.CompressOut += stored;
+   if (stored == len)
+      ++Stat.RawBlocks;
+   Entries.push_back(Entry(pos, stored, len));
+   RingWrPos = pos + stored;
+   Pending.pop_front();
+   blk->Begin = blk->Len = 0;
+   FreeWrite.push_back(blk);
+   NotifyDrain.NotifyAll();
+   if (ReaderWaiting && (Level >= HighWaterMark || EOS))
+      NotifySource.NotifyAll();
+}
+
+void CompressedFIFO::Decompress(Lock& lc)
+{  const Entry entry = Entries.front();
+   Block* blk = FreeRead.back();
+   FreeRead.pop_back();
+   const char* src = BufferBegin + entry.Pos % BufferSize;
+   lc.Release();
+   double time = ThreadTime();
+   bool ok = true;
+   if (entry.Stored == entry.Len)
+      memcpy(&blk->Data[0], src, entry.Len);
+    else
+   {  try
+      {  ok = LZ4Codec::Decompress(src, entry.Stored, &blk->Data[0], entry.Len) == entry.Len;
+      } catch (const std::runtime_error&)
+      {  ok = false;
+      }
+   }
+   time = ThreadTime() - time;
+   lc.Request();
+   Stat.DecompressTime += time;
+   if (!ok)
+   {  // The data is lost. Let the reader fail.
+      FreeRead.push_back(blk);
+      Corrupt = true;
+      NotifySource.NotifyAll();
+      return;
+   }
+   Entries.pop_front();
+   if (Entries.empty())
+      RingWrPos = RingRdPos = 0; // start over at the beginning of the ring
+    else
+      RingRdPos = entry.Pos + entry.Stored;
+   blk->Begin = 0;
+   blk->Len = entry.Len;
+   Ready.push_back(blk);
+   if (ReaderWaiting && (Level >= HighWaterMark || EOS))
+      NotifySource.NotifyAll();
+}
+#endif
+
+CompressedFIFO::Block* CompressedFIFO::NextReadBlock() const
+{  if (!Ready.empty())
+      return Ready.front();
+   if (!Entries.empty())
+      return NULL; // wait for the worker
+   if (!Pending.empty())
+      return Pending.front() == Compressing ? NULL : Pending.front();
+   if (Current && Current->Begin < Current->Len)
+      return Current;
+   return NULL;
+}
+
+void CompressedFIFO::RequestWrite(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (WrReq)
+      throw std::logic_error("The CompressedFIFO supports only one outstanding write request.");
+   do
+   {  if (EOS)
+      {  len = 0;
+         return;
+      }
+      if (!Current && !FreeWrite.empty())
+      {  Current = FreeWrite.back();
+         FreeWrite.pop_back();
+      }
+      if (Current)
+      {  size_t rem = BlockSize - Current->Len;
+         if (len > rem)
+            len = rem;
+         data = &Current->Data[Current->Len];
+         WrReq = len;
+         return;
+      }
+      ++Stat.FullCount;
+   } while (NotifyDrain.Wait());
+   // error
+   len = 0;
+}
+
+void CompressedFIFO::CommitWrite(void* data, size_t len)
+{  Lock lc(StateLock);
+   if (!WrReq || data != &Current->Data[Current->Len])
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > WrReq)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   WrReq = 0;
+   Current->Len += len;
+   Level += len;
+   if (Current->Len == BlockSize)
+   {  if (Current->Begin == Current->Len)
+      {  // The reader has already read the block.
+         Current->Begin = Current->Len = 0;
+         FreeWrite.push_back(Current);
+      } else
+         Pending.push_back(Current);
+      Current = NULL;
+      if (WorkerIdle)
+         NotifyWorker.NotifyAll();
+   }
+   if (ReaderWaiting && Level >= HighWaterMark)
+      NotifySource.NotifyAll();
+}
+
+void CompressedFIFO::EndWrite()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   WrReq = 0; // cancel outstanding request
+   NotifySource.NotifyAll(); // notify the other side regardless of the high water mark.
+   NotifyWorker.NotifyAll();
+}
+
+void CompressedFIFO::RequestRead(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (RdReq)
+      throw std::logic_error("The CompressedFIFO supports only one outstanding read request.");
+   do
+   {  ReaderWaiting = false;
+      Block* blk = NextReadBlock();
+      if (blk)
+      {  size_t rem = blk->Len - blk->Begin;
+         if (len > rem)
+            len = rem;
+         data = &blk->Data[blk->Begin];
+         RdBlock = blk;
+         RdReq = len;
+         return;
+      }
+      if (Corrupt)
+         throw std::runtime_error("A compressed block of the fifo is corrupt.");
+      if (EOS && Level == 0)
+      {  len = 0;
+         return;
+      }
+      ++Stat.EmptyCount;
+      ReaderWaiting = true;
+   } while (NotifySource.Wait());
+   // error
+   ReaderWaiting = false;
+   len = 0;
+}
+
+void CompressedFIFO::CommitRead(void* data, size_t len)
+{  Lock lc(StateLock);
+   if (!RdReq || data != &RdBlock->Data[RdBlock->Begin])
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > RdReq)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   RdReq = 0;
+   Block* blk = RdBlock;
+   RdBlock = NULL;
+   blk->Begin += len;
+   Level -= len;
+   if (blk->Begin == blk->Len && blk != Current)
+   {  if (!Ready.empty() && blk == Ready.front())
+      {  Ready.pop_front();
+         FreeRead.push_back(blk);
+      } else
+      {  // staging block read directly
+         Pending.pop_front();
+         blk->Begin = blk->Len = 0;
+         FreeWrite.push_back(blk);
+         NotifyDrain.NotifyAll();
+      }
+   }
+   if (WorkerIdle)
+      NotifyWorker.NotifyAll();
+}
+
+void CompressedFIFO::EndRead()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   RdReq = 0; // cancel outstanding request
+   RdBlock = NULL;
+   NotifyDrain.NotifyAll(); // notify the other side regardless of the low water mark.
+}
+
+size_t CompressedFIFO::Part2Bytes(double part)
+{  if (part < 0.0 || part > 1.0)
+      throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+   return (size_t)(BufferSize * part +.5);
+}
+
+}} // end namespace
@@ -0,0 +1,127 @@
+#ifndef __compressfifo_h
+#define __compressfifo_h
+
+#include <deque>
+
+#include "fifo.h"
+#include "lz4codec.h"
+
+/*****************************************************************************
+*
+*  compressfifo.cpp - fifo buffer that stores the data compressed
+*
+*  The writer fills a few staging blocks. As long as the reader keeps up it
+*  reads the staging blocks directly and nothing is compressed. When the
+*  blocks pile up a worker thread compresses the oldest one into the ring
+*  buffer and recycles it. Blocks that do not shrink are stored raw. The
+*  worker decompresses the oldest blocks of the ring just ahead of the reader
+*  into a few read blocks. So the ring holds more data than its size if the
+*  data compresses, and only the staging and read blocks hold raw data.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class CompressedFIFO
+ : public FIFO
+ , private Drain
+ , private Source
+{private:   // internal types
+   enum { WriteBlocks = 4, ReadBlocks = 2 };
+   // Raw data block
+   struct Block
+   {  std::vector<char> Data;
+      size_t Begin;        // data before Begin has been read
+      size_t Len;          // committed data
+      explicit Block(size_t size) : Data(size), Begin(0), Len(0) {}
+   };
+   // Block in the ring
+   struct Entry
+   {  uint64_t Pos;        // ring position
+      size_t Stored;       // size in the ring
+      size_t Len;          // raw size, Stored == Len for raw blocks
+      Entry(uint64_t pos, size_t stored, size_t len) : Pos(pos), Stored(stored), Len(len) {}
+   };
+ private:   // internal quasi-constant objects
+   const std::auto_ptr<Storage> Buffer;
+   char* BufferBegin;
+   size_t BufferSize;
+   const size_t HighWaterMark;
+   const size_t BlockSize;
+ private:   // internal state
+   std::vector<Block*> Blocks;    // all blocks
+   std::vector<Block*> FreeWrite; // unused staging blocks
+   std::vector<Block*> FreeRead;  // unused read blocks
+   std::deque<Block*> Pending;    // full staging blocks in order
+   std::deque<Entry> Entries;     // blocks in the ring in order
+   std::deque<Block*> Ready;      // decompressed blocks in order
+   Block* Current;        // staging block of the writer or NULL
+   Block* RdBlock;        // block of the outstanding read request
+   Block* Compressing;    // staging block that the worker compresses
+   uint64_t RingWrPos;    // write position in the ring
+   uint64_t RingRdPos;    // the ring is free up to this position
+   uint64_t Level;        // raw data in the fifo
+   size_t RdReq;          // size of outstanding read request
+   size_t WrReq;          // size of outstanding write request
+   bool WorkerIdle;       // the worker waits for NotifyWorker
+   bool ReaderWaiting;    // the reader waits for NotifySource
+   bool Corrupt;          // decompression failed
+   bool volatile EOS; // end of stream flag
+   bool volatile Die; // destroy-flag
+   LZ4Codec Codec;
+ private:   // internal semaphores
+   IPC::Mutex StateLock;
+   IPC::Notification NotifyDrain;
+   IPC::Notification NotifySource;
+   IPC::Notification NotifyWorker;
+   #if !defined(__OS2__) && !defined(_WIN32)
+   pthread_t WorkerThread;
+   #endif
+ private:   // statistics
+   Statistics Stat;
+
+ public:    // public interface
+   // Constructor for a fifo that stores compressed blocks of blocksize
+   // bytes in storage. blocksize must not exceed the size of storage.
+   // The fifo takes the ownership of the storage object.
+   CompressedFIFO(Storage* storage, double highwater, size_t blocksize);
+   virtual ~CompressedFIFO();
+
+   // @see FIFO::getDrain
+   Drain& getDrain()
+   {  return *this;
+   }
+   // @see FIFO::getSource
+   Source& getSource()
+   {  return *this;
+   }
+
+   virtual volatile const Statistics& getStatistics() const { return Stat; }
+
+ protected: // public interface implementations (indirect)
+   void RequestWrite(void*& data, size_t& len);
+   void CommitWrite(void* data, size_t len);
+   void EndWrite();
+   void RequestRead(void*& data, size_t& len);
+   void CommitRead(void* data, size_t len);
+   void EndRead();
+
+ private:
+   size_t Part2Bytes(double part);
+   // Worker thread that compresses and decompresses the blocks.
+   static void* WorkerStub(void* arg);
+   void Worker();
+   // Ring position for len bytes or false if the ring is full.
+   bool Reserve(size_t len, uint64_t& pos) const;
+   // Compress the first pending block into the ring.
+   void Compress(IPC::Lock& lc);
+   // Decompress the first block of the ring into a read block.
+   void Decompress(IPC::Lock& lc);
+   // The block that the reader continues with or NULL.
+   Block* NextReadBlock() const;
+};
+
+}} // end namespace
+
+#endif
@@ -1,7 +1,15 @@
+#ifndef __fifo_h
+#define __fifo_h
+
 #include <stdlib.h>
+#include <stdint.h>
 #include <vector>
 
 #include <MMUtil+.h>
+#include <memory>
+
+#include "storage.h"
+#include "basicfifo.h"
 
 /*****************************************************************************
 *
@@ -45,6 +53,17 @@ struct Drain
    // available depends on the implementation.
    // You must not commit the buffer if the function returned with len = 0.
    virtual void RequestWrite(void*& data, size_t& len) = 0;
+   // Like RequestWrite, but the returned buffer has at least min bytes
+   // unless len = 0 is returned. The function blocks until this space is
+   // free. Meanwhile the reader is released regardless of the high water
+   // mark, so a high water mark above the level that the writer can reach
+   // does not block both sides. min must not exceed len and the buffer size.
+   // The default implementation supports only min = 1.
+   virtual void RequestWriteMin(void*& data, size_t& len, size_t min)
+   {  if (min > 1)
+         throw std::logic_error("The fifo does not support a minimum length of write requests.");
+      RequestWrite(data, len);
+   }
    // Commit the write buffer.
    // This functions commits the data to the FIFO so it might be passed to the
    // source interface. It is not allowed to access or modify the buffer data
@@ -109,13 +128,38 @@ struct Source
    virtual void EndRead() = 0;
 };
 
+// Runtime control interface (optional)
+// Thread safety: may be used by one thread in parallel to the drain and
+// source interfaces.
+struct Control
+{  // Replace the buffer by storage without losing the buffered data.
+   // The function blocks the writer until the data fits into storage and
+   // both sides for the time of the copy. It returns false if the stream
+   // ended before. The fifo takes the ownership of the storage object.
+   virtual bool Resize(Storage* storage) = 0;
+   // Change the water marks. The levels are relative to the buffer size.
+   // This turns off the time based water marks.
+   virtual void SetWaterMarks(double highwater, double lowwater) = 0;
+   // Set the water marks in seconds of output at the measured output rate
+   // and the maximum time data waits for the high water mark. 0 turns a
+   // limit off. The water marks in bytes apply until the rate is known.
+   virtual void SetTimeLimits(double highsecs, double lowsecs, double maxlatency) = 0;
+   // Drop the oldest data at a full buffer instead of blocking the writer.
+   virtual void SetOverflow(bool dropoldest) = 0;
+   // Pass len bytes of pattern repeatedly at rate bytes per second to the
+   // reader instead of blocking it at an empty buffer. rate = 0 turns it off.
+   virtual void SetUnderrun(const void* pattern, size_t len, double rate) = 0;
+   // Buffer size, committed data and water marks in bytes.
+   virtual size_t getSize() = 0;
+   virtual size_t getLevel() = 0;
+   virtual size_t getHighWaterMark() = 0;
+   virtual size_t getLowWaterMark() = 0;
+};
+
 // Basic administrative interface
 struct FIFO
-{	struct Statistics
-	{	unsigned EmptyCount;
-   	unsigned FullCount;
-   	Statistics() : EmptyCount(0), FullCount(0) {}
-   };
+{  typedef FIFOStatistics Statistics;
+   virtual ~FIFO() {}
    // Get the drain interface of the fifo (where the data is stored).
    // This function will return always the same instance for one fifo
    // instance. The instance may not be used by parallel threads.
@@ -126,6 +170,8 @@ struct FIFO
    virtual Source& getSource() = 0;
 	// get STatistics for current FIFO.
    virtual volatile const Statistics& getStatistics() const = 0;
+   // Get the runtime control interface or NULL if the fifo does not support it.
+   virtual Control* getControl() { return NULL; }
 };
 
 // Helper class to implement write access to the FIFO by copying the data.
@@ -171,41 +217,20 @@ class SimpleSource
 };
 
 
-// Simple static implemetation of the FIFO interface.
-
-class StaticFIFO
+// Adapter that implements the virtual interfaces above by an instantiation
+// B of the BasicFIFO template.
+template <class B>
+class VirtualFIFO
  : public FIFO
  , private Drain
  , private Source
-{private:   // internal quasi-constant objects
-   typedef std::vector<char> BufferType;
-   typedef char* BufferIterator; 
-   BufferType Buffer;
-   BufferIterator BufferBegin;
-   BufferIterator BufferEnd;
-   size_t BufferSize;
-   const size_t LowWaterMark;
-   const size_t HighWaterMark;
- private:   // internal state
-   BufferIterator RdPos;  // current commited read position
-   BufferIterator WrPos;  // current comitted write position
-   size_t volatile Level; // (commited) fill level
-   size_t RdReq;          // size of last outstanding read request
-   size_t WrReq;          // size of last outstanding write request
-   bool volatile EOS; // end of stream flag
-   bool volatile Die; // destroy-flag
- private:   // internal semaphores
-   IPC::Mutex StateLock;
-   IPC::Notification NotifyDrain;
-   IPC::Notification NotifySource;
- private:   // statistics
-	Statistics Stat;
-   
+{protected:
+   B Impl;
+
  public:    // public interface
-   // Constructor for a static fifo of size buffersize. 
-   explicit StaticFIFO(size_t buffersize, double highwater, double lowwater, int alignment);
-   virtual ~StaticFIFO() { Die = true; }
-   
+   VirtualFIFO(typename B::StorageArg arg, double highwater, double lowwater, unsigned slots = 1)
+    : Impl(arg, highwater, lowwater, slots) {}
+
    // @see FIFO::getDrain
    Drain& getDrain()
    {  return *this;
@@ -215,19 +240,78 @@ class StaticFIFO
    {  return *this;
    }
 
-   virtual volatile const Statistics& getStatistics() const { return Stat; }
-    
+   virtual volatile const Statistics& getStatistics() const { return Impl.getStatistics(); }
+
  protected: // public interface implementations (indirect)
-   void RequestWrite(void*& data, size_t& len);
-   void CommitWrite(void* data, size_t len);
-   void EndWrite();
-   void RequestRead(void*& data, size_t& len);
-   void CommitRead(void* data, size_t len);
-   void EndRead();
- 
-   size_t Part2Bytes(double part);
-   
-}; 
+   void RequestWrite(void*& data, size_t& len) { Impl.RequestWrite(data, len); }
+   void RequestWriteMin(void*& data, size_t& len, size_t min) { Impl.RequestWrite(data, len, min); }
+   void CommitWrite(void* data, size_t len)    { Impl.CommitWrite(data, len); }
+   void EndWrite()                             { Impl.EndWrite(); }
+   void RequestRead(void*& data, size_t& len)  { Impl.RequestRead(data, len); }
+   void CommitRead(void* data, size_t len)     { Impl.CommitRead(data, len); }
+   void EndRead()                              { Impl.EndRead(); }
+};
+
+// Adapter that implements the control interface in addition. B must be an
+// instantiation of the BasicFIFO template with DynamicStorage and MutexSync.
+template <class B>
+class ControlledFIFO
+ : public VirtualFIFO<B>
+ , private Control
+{public:
+   ControlledFIFO(Storage* storage, double highwater, double lowwater, unsigned slots)
+    : VirtualFIFO<B>(storage, highwater, lowwater, slots) {}
+
+   // @see FIFO::getControl
+   Control* getControl()
+   {  return this;
+   }
+
+ protected: // control interface implementation (indirect)
+   bool Resize(Storage* storage)                         { return this->Impl.Resize(storage); }
+   void SetWaterMarks(double highwater, double lowwater) { this->Impl.SetWaterMarks(highwater, lowwater); }
+   void SetTimeLimits(double highsecs, double lowsecs, double maxlatency) { this->Impl.SetTimeLimits(highsecs, lowsecs, maxlatency); }
+   void SetOverflow(bool dropoldest)                     { this->Impl.SetOverflow(dropoldest); }
+   void SetUnderrun(const void* pattern, size_t len, double rate) { this->Impl.SetUnderrun(pattern, len, rate); }
+   size_t getSize()                                      { return this->Impl.getSize(); }
+   size_t getLevel()                                     { return this->Impl.getLevel(); }
+   size_t getHighWaterMark()                             { return this->Impl.getHighWaterMark(); }
+   size_t getLowWaterMark()                              { return this->Impl.getLowWaterMark(); }
+};
+
+// Simple static implemetation of the FIFO interface.
+// The buffer is a Storage object, both sides are serialized by a mutex and
+// a side waits at a Notification object.
+// If the storage is mirrored no request is split at the end of the buffer.
+// StaticFIFO supports up to slots outstanding requests at each side. The
+// requests may be committed in any order. The data becomes visible to the
+// other side when all older requests of the same side are committed as well.
+// Only the most recent outstanding request may be committed with a length
+// less than requested.
+// The buffer size and the water marks may be changed by the control
+// interface.
+class StaticFIFO
+ : public ControlledFIFO<BasicFIFO<DynamicStorage, MutexSync, CondVarWait> >
+{public:
+   // Constructor for a static fifo in storage. The fifo takes the ownership
+   // of the storage object.
+   // slots is the maximum number of outstanding requests at each side.
+   explicit StaticFIFO(Storage* storage, double highwater, double lowwater, unsigned slots = 1)
+    : ControlledFIFO<BasicFIFO<DynamicStorage, MutexSync, CondVarWait> >(storage, highwater, lowwater, slots) {}
+};
+
+// Like StaticFIFO, but a side that has to wait spins for a short, adaptive
+// time before it sleeps (see AdaptiveWait). This trades CPU time for a lower
+// wakeup latency.
+class LowLatencyFIFO
+ : public ControlledFIFO<BasicFIFO<DynamicStorage, MutexSync, AdaptiveWait> >
+{public:
+   // Constructor for a low latency fifo in storage. The fifo takes the
+   // ownership of the storage object.
+   explicit LowLatencyFIFO(Storage* storage, double highwater, double lowwater, unsigned slots = 1)
+    : ControlledFIFO<BasicFIFO<DynamicStorage, MutexSync, AdaptiveWait> >(storage, highwater, lowwater, slots) {}
+};
 
 }} // end namespace
 
+#endif
@@ -0,0 +1,380 @@
+/*****************************************************************************
+*
+*  fifobench - throughput benchmark for the fifo implementations
+*
+*  usage: fifobench [-b=<size>] [-r=<size>] [-n=<size>] [-y=<ms>]
+*                   [-i=<count>] [-t=<threads>] <type> ...
+*
+*  Each type is one of the fifo implementations of buffer2 (see -f):
+*  lock, lowlat, spsc, seg, spill:<dir> or persist:<file>. The persistent fifo file
+*  is deleted before and after the run.
+*  The basic:<variant> types use an instantiation of the BasicFIFO template
+*  directly, without the virtual interfaces:
+*    basic:mutex    heap storage, mutex, condition variable (like lock)
+*    basic:cond     heap storage, lock-free, condition variable
+*    basic:futex    heap storage, lock-free, futex
+*    basic:spin     heap storage, lock-free, busy waiting
+*    basic:adaptive heap storage, lock-free, spin then futex
+*    basic:static   1 MiB ring inside the fifo object, lock-free, futex
+*  Use small requests (-r) to see the difference of the synchronization.
+*  The types mutex:*, notify:* and event:* measure the IPC classes alone
+*  against plain pthread objects like the former pthread implementation:
+*    mutex:ipc, mutex:fast, mutex:pthread  -t threads lock and unlock a
+*                   mutex i times each.
+*    notify:ipc, notify:pthread  two threads pass a token back and forth
+*                   i times with a notification and its mutex.
+*    event:ipc, event:pthread  the same with two events.
+*  The CPU time of both threads and the wakeup latency measured by the wait
+*  policy are shown to compare the latency with the CPU cost.
+*  A writer thread fills each request completely and a reader thread reads
+*  one byte per cache line. So the figures are an upper bound for buffer2
+*  without the I/O.
+*  Build it from fifobench.cpp, fifo.cpp, spscfifo.cpp, segfifo.cpp,
+*  spillfifo.cpp, persistfifo.cpp, storage.cpp, PerfCount.cpp,
+*  exception.cpp, string.cpp and the IPC classes in Mutex.cpp,
+*  MutexBase.cpp, FastMutex.cpp, Notification.cpp and Event.cpp. The other
+*  sources of buffer2 require the log mutex in buffer2.cpp.
+*
+*****************************************************************************/
+
+#include "fifo.h"
+#include "spscfifo.h"
+#include "segfifo.h"
+#include "spillfifo.h"
+#include "persistfifo.h"
+#include "PerfCount.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+using namespace std;
+using namespace MM;
+using namespace MM::FIFO;
+using namespace MM::IPC;
+
+static int64_t BufferSize = 64*1024*1024;
+static int64_t RequestSize = 1024*1024;
+static int64_t TotalSize = (int64_t)4*1024*1024*1024;
+static long SyncInterval = 1000;
+static int64_t Iterations = 1000000;
+static int64_t Threads = 4;
+
+static int64_t parsesize(const char* src)
+{	long long ret;
+	char unit = 0;
+	if (sscanf(src, "=%lli%c", &ret, &unit) < 1 || ret < 1)
+		throw invalid_argument(string("Invalid size ") + src);
+	switch (unit)
+	{case 'k': case 'K':
+		return ret << 10;
+	 case 'm': case 'M':
+		return ret << 20;
+	 case 'g': case 'G':
+		return ret << 30;
+	}
+	return ret;
+}
+
+static MM::FIFO::FIFO* CreateFIFO(const string& type)
+{	string arg;
+	size_t p = type.find(':');
+	if (p != string::npos)
+		arg = type.substr(p+1);
+	const string name = type.substr(0, p);
+	if (name == "seg")
+		return new SegmentedFIFO(Storage::Anonymous, BufferSize, RequestSize, 4096, 0, 1, false);
+	if (name == "persist")
+	{	unlink(arg.c_str());
+		return new PersistentFIFO(arg.c_str(), BufferSize, 0, 1, SyncInterval);
+	}
+	auto_ptr<Storage> storage(Storage::Create(Storage::Anonymous, BufferSize, 4096));
+	if (name == "lock")
+		return new StaticFIFO(storage.release(), 0, 1);
+	if (name == "lowlat")
+		return new LowLatencyFIFO(storage.release(), 0, 1);
+	if (name == "spsc")
+		return new SPSCFIFO(storage.release(), 0, 1);
+	if (name == "spill")
+		return new SpillFIFO(storage.release(), 0, arg.c_str(), 4*1024*1024);
+	throw invalid_argument("Unknown fifo type " + type);
+}
+
+template <class D>
+static void* Writer(void* arg)
+{	D& drain = *(D*)arg;
+	int64_t rem = TotalSize;
+	unsigned char pattern = 0;
+	while (rem)
+	{	void* data;
+		size_t len = rem < RequestSize ? (size_t)rem : (size_t)RequestSize;
+		drain.RequestWrite(data, len);
+		if (len == 0)
+			break;
+		memset(data, ++pattern, len);
+		drain.CommitWrite(data, len);
+		rem -= len;
+	}
+	drain.EndWrite();
+	return NULL;
+}
+
+// Run the writer thread on drain and read from source in this thread.
+// S and D are either the virtual interfaces or a BasicFIFO instantiation.
+template <class S, class D>
+static void Measure(const string& type, S& source, D& drain, volatile const FIFOStatistics& stat)
+{	PerfCount timer;
+	const clock_t cpu = clock();
+	pthread_t writer;
+	int rc = pthread_create(&writer, NULL, Writer<D>, &drain);
+	if (rc != 0)
+		throw os_error(rc, "Failed to start the writer thread.");
+	unsigned sum = 0;
+	for (;;)
+	{	void* data;
+		size_t len = RequestSize;
+		source.RequestRead(data, len);
+		if (len == 0)
+			break;
+		for (size_t i = 0; i < len; i += 64)
+			sum += ((const unsigned char*)data)[i];
+		source.CommitRead(data, len);
+		timer.Update(len);
+	}
+	pthread_join(writer, NULL);
+	const double secs = timer.getSeconds();
+	printf("%-24s %10.1f MiB/s %8.3f s  full %llu  empty %llu  (%u)\n", type.c_str(),
+		timer.getBytes() / secs / (1024*1024), secs,
+		(unsigned long long)stat.FullCount, (unsigned long long)stat.EmptyCount, sum & 0xff);
+	const uint64_t wakeups = stat.SpinWakeups + stat.SleepWakeups;
+	printf("%-24s %10.3f s CPU", "", (double)(clock() - cpu) / CLOCKS_PER_SEC);
+	if (wakeups)
+		printf("  wakeups %llu spinning %llu sleeping  latency %.1f us avg %.1f us max  spin %.3f s",
+			(unsigned long long)stat.SpinWakeups, (unsigned long long)stat.SleepWakeups,
+			stat.WakeLatency / 1000. / wakeups, stat.MaxWakeLatency / 1000., stat.SpinTime / 1E9);
+	printf("\n");
+}
+
+// ********** IPC benchmarks
+
+// Mutex of the former pthread implementation of FastMutex.
+class PthreadMutex : public MutexBase
+{	pthread_mutex_t Handle;
+ public:
+	PthreadMutex()            { pthread_mutex_init(&Handle, NULL); }
+	~PthreadMutex()           { pthread_mutex_destroy(&Handle); }
+	pthread_mutex_t* get()    { return &Handle; }
+	virtual bool Request(long = -1) { return pthread_mutex_lock(&Handle) == 0; }
+	virtual bool Release()    { return pthread_mutex_unlock(&Handle) == 0; }
+};
+
+// Notification of the former pthread implementation.
+class PthreadNotification : public PthreadMutex
+{	pthread_cond_t Cond;
+ public:
+	PthreadNotification()     { pthread_cond_init(&Cond, NULL); }
+	~PthreadNotification()    { pthread_cond_destroy(&Cond); }
+	bool Wait()               { return pthread_cond_wait(&Cond, get()) == 0; }
+	bool NotifyAll()          { return pthread_cond_broadcast(&Cond) == 0; }
+};
+
+// Event of the former pthread implementation.
+class PthreadEvent
+{	PthreadNotification Notify;
+	bool State;
+ public:
+	PthreadEvent() : State(false) {}
+	void Wait()               { Lock lc(Notify); while (!State) Notify.Wait(); }
+	void Set()                { Lock lc(Notify); State = true; Notify.NotifyAll(); }
+	void Reset()              { Lock lc(Notify); State = false; }
+};
+
+// Run Threads threads with arg and print the time per operation.
+static void RunThreads(const string& type, void* (*func)(void*), void* arg, unsigned threads, int64_t ops)
+{	PerfCount timer;
+	const clock_t cpu = clock();
+	vector<pthread_t> tids(threads);
+	for (unsigned i = 0; i < threads; ++i)
+	{	int rc = pthread_create(&tids[i], NULL, func, arg);
+		if (rc != 0)
+			throw os_error(rc, "Failed to start a benchmark thread.");
+	}
+	for (unsigned i = 0; i < threads; ++i)
+		pthread_join(tids[i], NULL);
+	timer.Update(0);
+	const double secs = timer.getSeconds();
+	printf("%-24s %10.1f ns/op   %8.3f s  %8.3f s CPU\n", type.c_str(),
+		secs * 1E9 / ops, secs, (double)(clock() - cpu) / CLOCKS_PER_SEC);
+}
+
+template <class M>
+struct MutexBench
+{	M Mtx;
+	volatile int64_t Counter;
+	MutexBench() : Counter(0) {}
+	static void* Thread(void* arg)
+	{	MutexBench& b = *(MutexBench*)arg;
+		for (int64_t i = 0; i < Iterations; ++i)
+		{	Lock lc(b.Mtx);
+			++b.Counter;
+		}
+		return NULL;
+	}
+};
+
+template <class M>
+static void RunMutex(const string& type)
+{	MutexBench<M> bench;
+	RunThreads(type, MutexBench<M>::Thread, &bench, (unsigned)Threads, Iterations * Threads);
+	if (bench.Counter != Iterations * Threads)
+		throw logic_error("The mutex did not exclude the other threads.");
+}
+
+// Two threads pass a token with a notification.
+template <class N>
+struct NotifyBench
+{	N Notify;
+	int Turn;
+	unsigned Next;
+	NotifyBench() : Turn(0), Next(0) {}
+	static void* Thread(void* arg)
+	{	NotifyBench& b = *(NotifyBench*)arg;
+		int self;
+		{	Lock lc(b.Notify);
+			self = b.Next++;
+		}
+		for (int64_t i = 0; i < Iterations; ++i)
+		{	Lock lc(b.Notify);
+			while (b.Turn != self)
+				b.Notify.Wait();
+			b.Turn = !self;
+			b.Notify.NotifyAll();
+		}
+		return NULL;
+	}
+};
+
+// Two threads pass a token with two events.
+template <class E>
+struct EventBench
+{	E Ev[2];
+	volatile unsigned Next;
+	EventBench() : Next(0) { Ev[0].Set(); }
+	static void* Thread(void* arg)
+	{	EventBench& b = *(EventBench*)arg;
+		const int self = __atomic_fetch_add(&b.Next, 1, __ATOMIC_RELAXED);
+		for (int64_t i = 0; i < Iterations; ++i)
+		{	b.Ev[self].Wait();
+			b.Ev[self].Reset();
+			b.Ev[!self].Set();
+		}
+		return NULL;
+	}
+};
+
+static bool RunIPC(const string& type)
+{	if (type == "mutex:ipc")
+		RunMutex<IPC::Mutex>(type);
+	else if (type == "mutex:fast")
+		RunMutex<IPC::FastMutex>(type);
+	else if (type == "mutex:pthread")
+		RunMutex<PthreadMutex>(type);
+	else if (type == "notify:ipc")
+	{	NotifyBench<IPC::Notification> bench;
+		RunThreads(type, NotifyBench<IPC::Notification>::Thread, &bench, 2, Iterations * 2);
+	} else if (type == "notify:pthread")
+	{	NotifyBench<PthreadNotification> bench;
+		RunThreads(type, NotifyBench<PthreadNotification>::Thread, &bench, 2, Iterations * 2);
+	} else if (type == "event:ipc")
+	{	EventBench<IPC::Event> bench;
+		RunThreads(type, EventBench<IPC::Event>::Thread, &bench, 2, Iterations * 2);
+	} else if (type == "event:pthread")
+	{	EventBench<PthreadEvent> bench;
+		RunThreads(type, EventBench<PthreadEvent>::Thread, &bench, 2, Iterations * 2);
+	} else
+		return false;
+	return true;
+}
+
+template <class F>
+static void RunBasic(const string& type, typename F::StorageArg arg)
+{	auto_ptr<F> fifo(new F(arg, 0, 1));
+	Measure(type, *fifo, *fifo, fifo->getStatistics());
+}
+
+static void Run(const string& type)
+{	if (RunIPC(type))
+		return;
+	if (type == "basic:mutex")
+		RunBasic<BasicFIFO<VectorStorage, MutexSync, CondVarWait> >(type, BufferSize);
+	else if (type == "basic:cond")
+		RunBasic<BasicFIFO<VectorStorage, LockFreeSync, CondVarWait> >(type, BufferSize);
+	else if (type == "basic:futex")
+		RunBasic<BasicFIFO<VectorStorage, LockFreeSync, FutexWait> >(type, BufferSize);
+	else if (type == "basic:spin")
+		RunBasic<BasicFIFO<VectorStorage, LockFreeSync, SpinWait> >(type, BufferSize);
+	else if (type == "basic:adaptive")
+		RunBasic<BasicFIFO<VectorStorage, LockFreeSync, AdaptiveWait> >(type, BufferSize);
+	else if (type == "basic:static")
+		RunBasic<BasicFIFO<StaticStorage<1024*1024>, LockFreeSync, FutexWait> >(type, 0);
+	else
+	{	auto_ptr<MM::FIFO::FIFO> fifo(CreateFIFO(type));
+		Measure(type, fifo->getSource(), fifo->getDrain(), fifo->getStatistics());
+		fifo.reset();
+		if (type.compare(0, 8, "persist:") == 0)
+			unlink(type.c_str() + 8);
+	}
+}
+
+int main(int argc, char** argv)
+{	try
+	{	int i = 1;
+		for (; i < argc && argv[i][0] == '-'; ++i)
+			switch (argv[i][1])
+			{case 'b':
+				BufferSize = parsesize(argv[i]+2);
+				break;
+			 case 'r':
+				RequestSize = parsesize(argv[i]+2);
+				break;
+			 case 'n':
+				TotalSize = parsesize(argv[i]+2);
+				break;
+			 case 'y':
+				SyncInterval = (long)parsesize(argv[i]+2);
+				break;
+			 case 'i':
+				Iterations = parsesize(argv[i]+2);
+				break;
+			 case 't':
+				Threads = parsesize(argv[i]+2);
+				break;
+			 default:
+				throw invalid_argument(string("Invalid option ") + argv[i]);
+			}
+		if (i == argc)
+		{	fprintf(stderr, "usage: %s [-b=<size>] [-r=<size>] [-n=<size>] [-y=<ms>]\n"
+				"       [-i=<count>] [-t=<threads>] <type> ...\n"
+				"type: lock, lowlat, spsc, seg, spill:<dir>, persist:<file>,\n"
+				"      basic:mutex, basic:cond, basic:futex, basic:spin, basic:adaptive,\n"
+				"      basic:static, mutex:ipc, mutex:fast, mutex:pthread,\n"
+				"      notify:ipc, notify:pthread, event:ipc, event:pthread\n", argv[0]);
+			return 48;
+		}
+		printf("buffer %lld, request %lld, total %lld bytes\n", (long long)BufferSize, (long long)RequestSize, (long long)TotalSize);
+		for (; i < argc; ++i)
+			Run(argv[i]);
+		return 0;
+	} catch (const exception& e)
+	{	fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
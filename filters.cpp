@@ -0,0 +1,124 @@
+#include "IOinterface.h"
+#include "buffer2.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <MMUtil+.h>
+
+using namespace std;
+using namespace MM;
+
+// ********** filter classes
+
+// CRC-32 (IEEE 802.3) of the stream, printed at the end. The data is not modified.
+class CRC32Filter : public IFilter
+{	uint32_t Table[256];
+	uint32_t CRC;
+	uint64_t Bytes;
+ public:
+	CRC32Filter(const char* spec);
+	virtual void ProcessData(void* data, size_t len);
+	virtual void Finish();
+};
+
+// Reverse the byte order of each word of Size bytes.
+class SwapFilter : public IFilter
+{	const size_t Size;
+ public:
+	SwapFilter(const char* spec, size_t size) : IFilter(spec), Size(size) {}
+	virtual size_t Granularity() const { return Size; }
+	virtual void ProcessData(void* data, size_t len);
+};
+
+// XOR the stream with a repeating key. This is a template for ciphers, it
+// does not provide any security.
+class XorFilter : public IFilter
+{	vector<unsigned char> Key;
+	size_t Pos; // position within the key
+ public:
+	XorFilter(const char* spec, const char* key);
+	virtual void ProcessData(void* data, size_t len);
+};
+
+
+IFilter* IFilter::Factory(const char* spec)
+{	const char* arg = strchr(spec, ':');
+	const string name = MM::toupper(arg ? string(spec, arg - spec) : string(spec));
+	if (name == "CRC32" && !arg)
+		return new CRC32Filter(spec);
+	if (name == "SWAP2" && !arg)
+		return new SwapFilter(spec, 2);
+	if (name == "SWAP4" && !arg)
+		return new SwapFilter(spec, 4);
+	if (name == "SWAP8" && !arg)
+		return new SwapFilter(spec, 8);
+	if (name == "XOR" && arg)
+		return new XorFilter(spec, arg+1);
+	throw syntax_error(stringf("The filter %s is invalid.", spec));
+}
+
+
+CRC32Filter::CRC32Filter(const char* spec)
+ : IFilter(spec)
+ , CRC(0xffffffff)
+ , Bytes(0)
+{	for (uint32_t i = 0; i < 256; ++i)
+	{	uint32_t c = i;
+		for (int k = 0; k < 8; ++k)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		Table[i] = c;
+	}
+}
+
+void CRC32Filter::ProcessData(void* data, size_t len)
+{	const unsigned char* cp = (const unsigned char*)data;
+	const unsigned char* const ep = cp + len;
+	uint32_t crc = CRC;
+	while (cp != ep)
+		crc = Table[(crc ^ *cp++) & 0xff] ^ (crc >> 8);
+	CRC = crc;
+	Bytes += len;
+}
+
+void CRC32Filter::Finish()
+{	lerr << stringf("CRC-32 of %llu bytes: %08x", (unsigned long long)Bytes, (unsigned)(CRC ^ 0xffffffff)) << endl;
+}
+
+
+void SwapFilter::ProcessData(void* data, size_t len)
+{	// A remainder at the end of the stream is left unchanged.
+	unsigned char* cp = (unsigned char*)data;
+	unsigned char* const ep = cp + len - len % Size;
+	for (; cp != ep; cp += Size)
+		for (size_t i = 0; i < Size/2; ++i)
+		{	unsigned char c = cp[i];
+			cp[i] = cp[Size-1-i];
+			cp[Size-1-i] = c;
+		}
+}
+
+
+XorFilter::XorFilter(const char* spec, const char* key)
+ : IFilter(spec)
+ , Pos(0)
+{	size_t len = strlen(key);
+	if (len == 0 || len % 2 || strspn(key, "0123456789abcdefABCDEF") != len)
+		throw syntax_error(stringf("The key of the filter %s must be a non-empty hexadecimal string.", spec));
+	for (size_t i = 0; i < len; i += 2)
+	{	unsigned v;
+		sscanf(key + i, "%2x", &v);
+		Key.push_back((unsigned char)v);
+	}
+}
+
+void XorFilter::ProcessData(void* data, size_t len)
+{	unsigned char* cp = (unsigned char*)data;
+	unsigned char* const ep = cp + len;
+	while (cp != ep)
+	{	*cp++ ^= Key[Pos];
+		if (++Pos == Key.size())
+			Pos = 0;
+	}
+}
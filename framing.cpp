@@ -0,0 +1,87 @@
+#include "IOinterface.h"
+#include "buffer2.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <MMUtil+.h>
+
+using namespace std;
+using namespace MM;
+
+// ********** record framing classes
+
+// Records end with a delimiter byte, e.g. lines.
+class DelimiterFraming : public IFraming
+{	const unsigned char Delimiter;
+ public:
+	DelimiterFraming(const char* spec, unsigned char delimiter) : IFraming(spec), Delimiter(delimiter) {}
+	virtual size_t Whole(const void* data, size_t len) const;
+};
+
+// Records start with their length as unsigned integer of Size bytes.
+// The length does not include the prefix.
+class LengthFraming : public IFraming
+{	const size_t Size;
+	const bool BigEndian;
+ public:
+	LengthFraming(const char* spec, size_t size, bool bigendian) : IFraming(spec), Size(size), BigEndian(bigendian) {}
+	virtual size_t Whole(const void* data, size_t len) const;
+};
+
+
+IFraming* IFraming::Factory(const char* spec)
+{	const char* arg = strchr(spec, ':');
+	const string name = MM::toupper(arg ? string(spec, arg - spec) : string(spec));
+	if (name == "LINE" && !arg)
+		return new DelimiterFraming(spec, '\n');
+	if (name == "DELIM" && arg)
+	{	unsigned v;
+		int l = -1;
+		if (sscanf(arg+1, "%2x%n", &v, &l) != 1 || l != (int)strlen(arg+1))
+			throw syntax_error(stringf("The delimiter of the framing %s must be one byte in hexadecimal, e.g. delim:00.", spec));
+		return new DelimiterFraming(spec, (unsigned char)v);
+	}
+	if (name == "LEN2" && !arg)
+		return new LengthFraming(spec, 2, true);
+	if (name == "LEN4" && !arg)
+		return new LengthFraming(spec, 4, true);
+	if (name == "LEN2LE" && !arg)
+		return new LengthFraming(spec, 2, false);
+	if (name == "LEN4LE" && !arg)
+		return new LengthFraming(spec, 4, false);
+	throw syntax_error(stringf("The framing %s is invalid.", spec));
+}
+
+
+size_t DelimiterFraming::Whole(const void* data, size_t len) const
+{	// Only the last delimiter matters, so search backwards. The C library
+	// scans a word or a vector register at a time.
+	#ifdef __GLIBC__
+	const unsigned char* cp = (const unsigned char*)memrchr(data, Delimiter, len);
+	return cp ? cp + 1 - (const unsigned char*)data : 0;
+	#else
+	const unsigned char* const bp = (const unsigned char*)data;
+	const unsigned char* cp = bp + len;
+	while (cp != bp)
+		if (*--cp == Delimiter)
+			return cp + 1 - bp;
+	return 0;
+	#endif
+}
+
+
+size_t LengthFraming::Whole(const void* data, size_t len) const
+{	const unsigned char* const bp = (const unsigned char*)data;
+	size_t pos = 0;
+	while (len - pos >= Size)
+	{	const unsigned char* cp = bp + pos;
+		uint64_t rec = 0;
+		for (size_t i = 0; i < Size; ++i)
+			rec = rec << 8 | cp[BigEndian ? i : Size-1-i];
+		if (rec > len - pos - Size)
+			break;
+		pos += Size + (size_t)rec;
+	}
+	return pos;
+}
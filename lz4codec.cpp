@@ -0,0 +1,186 @@
+/*****************************************************************************
+*
+*  LZ4 block codec implementation.
+*  A block is a sequence of tokens. Each token has a number of literals that
+*  are copied and a match of at least 4 bytes that repeats data at an offset
+*  of up to 65535 bytes. The last token has only literals. The last 5 bytes
+*  are always literals and the last match starts at least 12 bytes before
+*  the end of the block.
+*
+*****************************************************************************/
+
+#include "lz4codec.h"
+#include <stdexcept>
+#include <algorithm>
+#include <string.h>
+
+namespace MM {
+namespace FIFO {
+
+static const size_t MinMatch = 4;
+static const size_t LastLiterals = 5;
+static const size_t MatchLimit = 12;
+static const size_t MaxOffset = 65535;
+
+static inline uint32_t Read32(const unsigned char* p)
+{  uint32_t v;
+   memcpy(&v, p, sizeof v);
+   return v;
+}
+
+static inline uint64_t Read64(const unsigned char* p)
+{  uint64_t v;
+   memcpy(&v, p, sizeof v);
+   return v;
+}
+
+// Write the length extension bytes of a token.
+static inline unsigned char* WriteLength(unsigned char* op, size_t len)
+{  for (; len >= 255; len -= 255)
+      *op++ = 255;
+   *op++ = (unsigned char)len;
+   return op;
+}
+
+LZ4Codec::LZ4Codec()
+ : Table(1 << HashLog)
+{}
+
+size_t LZ4Codec::Compress(const char* src, size_t srclen, char* dst, size_t dstlen)
+{  const unsigned char* const base = (const unsigned char*)src;
+   const unsigned char* const iend = base + srclen;
+   const unsigned char* ip = base;
+   const unsigned char* anchor = base; // start of the pending literals
+   unsigned char* op = (unsigned char*)dst;
+   unsigned char* const oend = op + dstlen;
+
+   if (srclen > MatchLimit)
+   {  const unsigned char* const mflimit = iend - MatchLimit;
+      const unsigned char* const matchlimit = iend - LastLiterals;
+      std::fill(Table.begin(), Table.end(), 0);
+      while (ip <= mflimit)
+      {  const uint32_t seq = Read32(ip);
+         const unsigned hash = (seq * 2654435761U) >> (32 - HashLog);
+         const unsigned char* ref = base + Table[hash];
+         Table[hash] = (uint32_t)(ip - base);
+         if (ref >= ip || (size_t)(ip - ref) > MaxOffset || Read32(ref) != seq)
+         {  // Step faster the longer no match is found.
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+         }
+         // extend the match backwards into the literals
+         while (ip > anchor && ref > base && ip[-1] == ref[-1])
+         {  --ip;
+            --ref;
+         }
+         // and forward
+         const unsigned char* mp = ip + MinMatch;
+         const unsigned char* rp = ref + MinMatch;
+         while (mp + 8 <= matchlimit && Read64(mp) == Read64(rp))
+         {  mp += 8;
+            rp += 8;
+         }
+         while (mp < matchlimit && *mp == *rp)
+         {  ++mp;
+            ++rp;
+         }
+
+         // emit the sequence
+         const size_t litlen = ip - anchor;
+         const size_t matchlen = mp - ip - MinMatch;
+         if ((size_t)(oend - op) < 1 + litlen/255 + 1 + litlen + 2 + matchlen/255 + 1)
+            return 0;
+         unsigned char* token = op++;
+         if (litlen >= 15)
+         {  *token = 15 << 4;
+            op = WriteLength(op, litlen - 15);
+         } else
+            *token = (unsigned char)(litlen << 4);
+         memcpy(op, anchor, litlen);
+         op += litlen;
+         const size_t offset = ip - ref;
+         *op++ = (unsigned char)offset;
+         *op++ = (unsigned char)(offset >> 8);
+         if (matchlen >= 15)
+         {  *token |= 15;
+            op = WriteLength(op, matchlen - 15);
+         } else
+            *token |= (unsigned char)matchlen;
+
+         anchor = ip = mp;
+         if (ip <= mflimit)
+            Table[(Read32(ip - 2) * 2654435761U) >> (32 - HashLog)] = (uint32_t)(ip - 2 - base);
+      }
+   }
+
+   // last literals
+   const size_t litlen = iend - anchor;
+   if ((size_t)(oend - op) < 1 + litlen/255 + 1 + litlen)
+      return 0;
+   if (litlen >= 15)
+   {  *op++ = 15 << 4;
+      op = WriteLength(op, litlen - 15);
+   } else
+      *op++ = (unsigned char)(litlen << 4);
+   memcpy(op, anchor, litlen);
+   op += litlen;
+   return op - (unsigned char*)dst;
+}
+
+size_t LZ4Codec::Decompress(const char* src, size_t srclen, char* dst, size_t dstlen)
+{  const unsigned char* ip = (const unsigned char*)src;
+   const unsigned char* const iend = ip + srclen;
+   unsigned char* const obegin = (unsigned char*)dst;
+   unsigned char* op = obegin;
+   unsigned char* const oend = op + dstlen;
+   while (ip != iend)
+   {  const unsigned token = *ip++;
+      size_t litlen = token >> 4;
+      if (litlen == 15)
+      {  unsigned s;
+         do
+         {  if (ip == iend)
+               goto corrupt;
+            litlen += s = *ip++;
+         } while (s == 255);
+      }
+      if (litlen > (size_t)(iend - ip) || litlen > (size_t)(oend - op))
+         goto corrupt;
+      memcpy(op, ip, litlen);
+      op += litlen;
+      ip += litlen;
+      if (ip == iend)
+         return op - obegin; // last sequence
+
+      if (iend - ip < 2)
+         goto corrupt;
+      const size_t offset = ip[0] | ip[1] << 8;
+      ip += 2;
+      if (offset == 0 || offset > (size_t)(op - obegin))
+         goto corrupt;
+      size_t matchlen = token & 15;
+      if (matchlen == 15)
+      {  unsigned s;
+         do
+         {  if (ip == iend)
+               goto corrupt;
+            matchlen += s = *ip++;
+         } while (s == 255);
+      }
+      matchlen += MinMatch;
+      if (matchlen > (size_t)(oend - op))
+         goto corrupt;
+      const unsigned char* ref = op - offset;
+      if (offset >= matchlen)
+         memcpy(op, ref, matchlen);
+       else
+         // overlapping match, repeats a pattern
+         for (size_t i = 0; i < matchlen; ++i)
+            op[i] = ref[i];
+      op += matchlen;
+   }
+ corrupt:
+   throw std::runtime_error("The compressed block is corrupt.");
+}
+
+}} // end namespace
@@ -0,0 +1,41 @@
+#ifndef __lz4codec_h
+#define __lz4codec_h
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+/*****************************************************************************
+*
+*  lz4codec.cpp - built-in block compressor
+*
+*  The codec writes the LZ4 block format, so the blocks can be decoded by
+*  the LZ4 library as well. The compressor is a greedy single pass matcher
+*  with a small hash table. It skips incompressible data quickly, so trying
+*  to compress such data costs little CPU time. There is no external
+*  dependency.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class LZ4Codec
+{private:
+   enum { HashLog = 12 };
+   std::vector<uint32_t> Table; // last position of each hash value
+ public:
+   LZ4Codec();
+   // Compress srclen bytes at src into at most dstlen bytes at dst.
+   // Returns the compressed length or 0 if the result does not fit into
+   // dstlen bytes. Blocks must not exceed 4 GiB.
+   size_t Compress(const char* src, size_t srclen, char* dst, size_t dstlen);
+   // Decompress the block of srclen bytes at src to dst.
+   // Returns the decompressed length. Throws std::runtime_error if the
+   // block is corrupt or if it does not fit into dstlen bytes.
+   static size_t Decompress(const char* src, size_t srclen, char* dst, size_t dstlen);
+};
+
+}} // end namespace
+
+#endif
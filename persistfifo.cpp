@@ -0,0 +1,293 @@
+/*****************************************************************************
+*
+*  Persistent FIFO buffer implementation.
+*  The header is only written by the sync thread. An update of the two
+*  positions is assumed to be atomic because they share one disk sector.
+*
+*****************************************************************************/
+
+#include "persistfifo.h"
+#include <stdexcept>
+#include <errno.h>
+#include <string.h>
+
+#if !defined(__OS2__) && !defined(_WIN32)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+namespace MM {
+namespace FIFO {
+
+using namespace MM::IPC;
+
+static const char PersistentMagic[16] = "buffer2 fifo v1";
+
+#if defined(__OS2__) || defined(_WIN32)
+PersistentFIFO::PersistentFIFO(const char* filename, size_t, double, double, long syncinterval)
+ : FileName(filename)
+ , SyncInterval(syncinterval)
+ , NotifyDrain(StateLock)
+ , NotifySource(StateLock)
+ , NotifySync(StateLock)
+{  throw std::runtime_error("Persistent fifo buffers are not supported on this platform.");
+}
+
+PersistentFIFO::~PersistentFIFO()
+{}
+
+#else
+PersistentFIFO::PersistentFIFO(const char* filename, size_t size, double highwater, double lowwater, long syncinterval)
+ : FileName(filename)
+ , FileHandle(-1)
+ , Map(NULL)
+ , MapSize(0)
+ , PageSize(sysconf(_SC_PAGESIZE))
+ , SyncInterval(syncinterval)
+ , RdReq(0)
+ , WrReq(0)
+ , SyncRequested(false)
+ , WriterFull(false)
+ , EOS(false)
+ , Die(false)
+ , NotifyDrain(StateLock)
+ , NotifySource(StateLock)
+ , NotifySync(StateLock)
+{  Open(size);
+   LowWaterMark = Part2Bytes(lowwater);
+   HighWaterMark = Part2Bytes(highwater);
+   Stat.ResidentSize = Stat.PeakResidentSize = BufferSize;
+   int rc = pthread_create(&SyncThread, NULL, SyncStub, this);
+   if (rc != 0)
+   {  munmap(Map, MapSize);
+      close(FileHandle);
+      throw os_error(rc, "Failed to start the sync thread of the persistent fifo.");
+   }
+}
+
+PersistentFIFO::~PersistentFIFO()
+{  {  Lock lc(StateLock);
+      Die = true;
+      NotifySync.NotifyAll();
+   }
+   // The sync thread writes the final state.
+   pthread_join(SyncThread, NULL);
+   munmap(Map, MapSize);
+   close(FileHandle);
+}
+
+void PersistentFIFO::Open(size_t size)
+{  FileHandle = open(FileName.c_str(), O_RDWR|O_CREAT, 0644);
+   if (FileHandle == -1)
+      throw os_error(errno, stringf("Failed to open the fifo file %s.", FileName.c_str()));
+   struct stat st;
+   if (fstat(FileHandle, &st) != 0)
+   {  int rc = errno;
+      close(FileHandle);
+      throw os_error(rc, stringf("Failed to query the fifo file %s.", FileName.c_str()));
+   }
+   const bool create = st.st_size == 0;
+   if (create)
+   {  size = (size + PageSize - 1) & -PageSize;
+      if (ftruncate(FileHandle, PageSize + size) != 0)
+      {  int rc = errno;
+         close(FileHandle);
+         throw os_error(rc, stringf("Failed to allocate the fifo file %s.", FileName.c_str()));
+      }
+      MapSize = PageSize + size;
+   } else
+      MapSize = st.st_size;
+   Map = (char*)mmap(NULL, MapSize, PROT_READ|PROT_WRITE, MAP_SHARED, FileHandle, 0);
+   if (Map == MAP_FAILED)
+   {  int rc = errno;
+      close(FileHandle);
+      throw os_error(rc, stringf("Failed to map the fifo file %s.", FileName.c_str()));
+   }
+   Head = (Header*)Map;
+   BufferBegin = Map + PageSize;
+   if (create)
+   {  memcpy(Head->Magic, PersistentMagic, sizeof Head->Magic);
+      Head->Size = MapSize - PageSize;
+      Head->RdCount = Head->WrCount = 0;
+      msync(Map, PageSize, MS_SYNC);
+   } else if ( memcmp(Head->Magic, PersistentMagic, sizeof Head->Magic) != 0
+      || Head->Size != MapSize - PageSize || Head->RdCount > Head->WrCount
+      || Head->WrCount - Head->RdCount > Head->Size )
+   {  munmap(Map, MapSize);
+      close(FileHandle);
+      throw std::runtime_error(stringf("The file %s is not a valid fifo file.", FileName.c_str()));
+   }
+   BufferSize = Head->Size;
+   RdCount = SyncedRd = Head->RdCount;
+   WrCount = SyncedWr = Head->WrCount;
+   Recovered = WrCount - RdCount;
+}
+
+void* PersistentFIFO::SyncStub(void* arg)
+{  ((PersistentFIFO*)arg)->SyncWorker();
+   return NULL;
+}
+
+void PersistentFIFO::SyncWorker()
+{  Lock lc(StateLock);
+   for (;;)
+   {  if (!SyncRequested && !Die)
+         NotifySync.Wait(SyncInterval);
+      Sync(lc);
+      if (Die)
+         return;
+   }
+}
+
+void PersistentFIFO::FlushData(uint64_t from, uint64_t to)
+{  if (to - from >= BufferSize)
+   {  msync(BufferBegin, BufferSize, MS_SYNC);
+      return;
+   }
+   // Detect the wrap before begin is rounded down to the page.
+   const size_t offset = from % BufferSize;
+   size_t end = offset + (size_t)(to - from);
+   size_t begin = offset & -PageSize;
+   if (end > BufferSize)
+   {  // wrapped
+      msync(BufferBegin + begin, BufferSize - begin, MS_SYNC);
+      begin = 0;
+      end -= BufferSize;
+   }
+   msync(BufferBegin + begin, end - begin, MS_SYNC);
+}
+
+void PersistentFIFO::Sync(Lock& lc)
+{  SyncRequested = false;
+   const uint64_t rd = RdCount;
+   const uint64_t wr = WrCount;
+   if (rd == SyncedRd && wr == SyncedWr)
+      return;
+   lc.Release();
+   // data first, then the header that refers to it
+   if (wr != SyncedWr)
+      FlushData(SyncedWr, wr);
+   Head->RdCount = rd;
+   Head->WrCount = wr;
+   msync(Map, PageSize, MS_SYNC);
+   lc.Request();
+   SyncedRd = rd;
+   SyncedWr = wr;
+   // The space up to the synced read position may be overwritten now.
+   if (WrCount - SyncedRd <= LowWaterMark || EOS)
+      NotifyDrain.NotifyAll();
+}
+#endif
+
+void PersistentFIFO::RequestWrite(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (WrReq)
+      throw std::logic_error("The PersistentFIFO supports only one outstanding write request.");
+   do
+   {  if (EOS)
+      {  len = 0;
+         return;
+      }
+      // Do not overwrite data the header on disk refers to.
+      size_t rem = BufferSize - (size_t)(WrCount - SyncedRd);
+      if (rem > 0)
+      {  if (len > rem)
+            len = rem;
+         size_t offset = WrCount % BufferSize;
+         if (len > BufferSize - offset)
+         {  ++Stat.SplitCount;
+            len = BufferSize - offset;
+         }
+         data = BufferBegin + offset;
+         WrReq = len;
+         return;
+      }
+      ++Stat.FullCount;
+      // Space that is read but not yet synced becomes available by a sync.
+      if (RdCount != SyncedRd && WrCount - RdCount <= LowWaterMark)
+      {  SyncRequested = true;
+         NotifySync.NotifyAll();
+      } else
+         WriterFull = true;
+   } while (NotifyDrain.Wait());
+   // error
+   len = 0;
+}
+
+void PersistentFIFO::CommitWrite(void* data, size_t len)
+{  Lock lc(StateLock);
+   if (!WrReq || data != BufferBegin + WrCount % BufferSize)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > WrReq)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   WrReq = 0;
+   if ((WrCount += len) - RdCount >= HighWaterMark)
+      NotifySource.NotifyAll();
+}
+
+void PersistentFIFO::EndWrite()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   WrReq = 0; // cancel outstanding request
+   NotifySource.NotifyAll(); // notify the other side regardless of the high water mark.
+}
+
+void PersistentFIFO::RequestRead(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (RdReq)
+      throw std::logic_error("The PersistentFIFO supports only one outstanding read request.");
+   do
+   {  size_t rem = (size_t)(WrCount - RdCount);
+      if (rem > 0)
+      {  if (len > rem)
+            len = rem;
+         size_t offset = RdCount % BufferSize;
+         if (len > BufferSize - offset)
+         {  ++Stat.SplitCount;
+            len = BufferSize - offset;
+         }
+         data = BufferBegin + offset;
+         RdReq = len;
+         return;
+      }
+      if (EOS)
+      {  len = 0;
+         return;
+      }
+      ++Stat.EmptyCount;
+   } while (NotifySource.Wait());
+   // error
+   len = 0;
+}
+
+void PersistentFIFO::CommitRead(void* data, size_t len)
+{  Lock lc(StateLock);
+   if (!RdReq || data != BufferBegin + RdCount % BufferSize)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > RdReq)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   RdReq = 0;
+   RdCount += len;
+   if (WriterFull && WrCount - RdCount <= LowWaterMark)
+   {  WriterFull = false;
+      SyncRequested = true;
+      NotifySync.NotifyAll();
+   }
+}
+
+void PersistentFIFO::EndRead()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   RdReq = 0; // cancel outstanding request
+   NotifyDrain.NotifyAll(); // notify the other side regardless of the low water mark.
+}
+
+size_t PersistentFIFO::Part2Bytes(double part)
+{  if (part < 0.0 || part > 1.0)
+      throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+   return (size_t)(BufferSize * part +.5);
+}
+
+}} // end namespace
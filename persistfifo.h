@@ -0,0 +1,117 @@
+#ifndef __persistfifo_h
+#define __persistfifo_h
+
+#include <string>
+
+#include "fifo.h"
+
+/*****************************************************************************
+*
+*  persistfifo.cpp - fifo buffer in a memory mapped file
+*
+*  The PersistentFIFO keeps its ring in a shared file mapping. The first
+*  page of the file is a header with the committed read and write stream
+*  positions. A sync thread writes them back at a configurable interval.
+*  The data is flushed before the header, so the header never refers to
+*  data that is not on disk. The writer does not overwrite data before the
+*  header no longer refers to it. If the program dies, a new instance that
+*  opens the same file continues with the data between the read and write
+*  position of the last header update. Data that has been read after the
+*  last update is emitted a second time.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class PersistentFIFO
+ : public FIFO
+ , private Drain
+ , private Source
+{private:   // internal types
+   // file header in the first page
+   struct Header
+   {  char     Magic[16];
+      uint64_t Size;       // size of the ring
+      uint64_t RdCount;    // committed read stream position
+      uint64_t WrCount;    // committed write stream position
+   };
+ private:   // internal quasi-constant objects
+   const std::string FileName;
+   int FileHandle;
+   char* Map;
+   size_t MapSize;
+   size_t PageSize;
+   Header* Head;
+   char* BufferBegin;
+   size_t BufferSize;
+   size_t LowWaterMark;
+   size_t HighWaterMark;
+   const long SyncInterval; // ms
+ private:   // internal state
+   uint64_t RdCount;      // committed read position
+   uint64_t WrCount;      // committed write position
+   uint64_t SyncedRd;     // read position in the header on disk
+   uint64_t SyncedWr;     // write position in the header on disk
+   uint64_t Recovered;    // data found in the file at startup
+   size_t RdReq;          // size of outstanding read request
+   size_t WrReq;          // size of outstanding write request
+   bool SyncRequested;    // the writer waits for the next sync
+   bool WriterFull;       // the writer waits for the reader
+   bool volatile EOS; // end of stream flag
+   bool volatile Die; // destroy-flag
+ private:   // internal semaphores
+   IPC::Mutex StateLock;
+   IPC::Notification NotifyDrain;
+   IPC::Notification NotifySource;
+   IPC::Notification NotifySync;
+   #if !defined(__OS2__) && !defined(_WIN32)
+   pthread_t SyncThread;
+   #endif
+ private:   // statistics
+   Statistics Stat;
+
+ public:    // public interface
+   // Open or create the fifo in the file filename. A new file gets a ring of
+   // size bytes rounded up to the page size. An existing file keeps its size
+   // and its content. The header is updated every syncinterval ms.
+   PersistentFIFO(const char* filename, size_t size, double highwater, double lowwater, long syncinterval);
+   virtual ~PersistentFIFO();
+
+   // @see FIFO::getDrain
+   Drain& getDrain()
+   {  return *this;
+   }
+   // @see FIFO::getSource
+   Source& getSource()
+   {  return *this;
+   }
+
+   virtual volatile const Statistics& getStatistics() const { return Stat; }
+   // Amount of data that has been recovered from the file at startup.
+   uint64_t getRecovered() const { return Recovered; }
+
+ protected: // public interface implementations (indirect)
+   void RequestWrite(void*& data, size_t& len);
+   void CommitWrite(void* data, size_t len);
+   void EndWrite();
+   void RequestRead(void*& data, size_t& len);
+   void CommitRead(void* data, size_t len);
+   void EndRead();
+
+ private:
+   size_t Part2Bytes(double part);
+   // Open or create the file and map it.
+   void Open(size_t size);
+   // Sync thread
+   static void* SyncStub(void* arg);
+   void SyncWorker();
+   // Flush the data and the header up to the current positions.
+   void Sync(IPC::Lock& lc);
+   // Flush the ring between the stream positions from and to.
+   void FlushData(uint64_t from, uint64_t to);
+};
+
+}} // end namespace
+
+#endif
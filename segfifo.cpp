@@ -0,0 +1,234 @@
+/*****************************************************************************
+*
+*  Segmented FIFO buffer implementation.
+*  The chain of segments is protected by a mutex. The allocation of a new
+*  segment is done while holding the mutex. This is rare compared to the
+*  number of requests.
+*
+*****************************************************************************/
+
+#include "segfifo.h"
+#include <stdexcept>
+#include <time.h>
+
+namespace MM {
+namespace FIFO {
+
+using namespace MM::IPC;
+
+const int SegmentedFIFO::ShrinkDelay = 2;
+
+SegmentedFIFO::SegmentedFIFO(Storage::Type memtype, size_t maxsize, size_t segmentsize, size_t alignment,
+                             double highwater, double lowwater, bool lock)
+ : MemoryType(memtype)
+ , SegmentSize(segmentsize)
+ , Alignment(alignment)
+ , LockSegments(lock)
+ , RdOffset(0)
+ , WrOffset(0)
+ , Level(0)
+ , RdReq(0)
+ , WrReq(0)
+ , LowSince(0)
+ , EOS(false)
+ , Die(false)
+ , NotifyDrain(StateLock)
+ , NotifySource(StateLock)
+{  if (SegmentSize == 0)
+      throw std::invalid_argument("The segment size of the SegmentedFIFO must be positive.");
+   MaxSegments = maxsize / SegmentSize;
+   if (MaxSegments == 0)
+      throw std::invalid_argument("The SegmentedFIFO requires at least one segment.");
+   BufferSize = MaxSegments * SegmentSize;
+   LowWaterMark = Part2Bytes(lowwater);
+   HighWaterMark = Part2Bytes(highwater);
+   // The chain is never empty.
+   Grow();
+}
+
+SegmentedFIFO::~SegmentedFIFO()
+{  Die = true;
+   while (!Chain.empty())
+   {  delete Chain.front();
+      Chain.pop_front();
+   }
+   while (!Spare.empty())
+   {  delete Spare.back();
+      Spare.pop_back();
+   }
+}
+
+bool SegmentedFIFO::Grow()
+{  Storage* segment;
+   if (!Spare.empty())
+   {  segment = Spare.back();
+      Spare.pop_back();
+   } else if (Chain.size() < MaxSegments)
+   {  std::auto_ptr<Storage> storage(Storage::Create(MemoryType, SegmentSize, Alignment));
+      if (LockSegments)
+         storage->Lock();
+      Stat.AllocTime += storage->getAllocTime();
+      segment = storage.release();
+   } else
+      return false;
+   Chain.push_back(segment);
+   WrOffset = 0;
+   UpdateResidentSize();
+   return true;
+}
+
+void SegmentedFIFO::Recycle()
+{  Spare.push_back(Chain.front());
+   Chain.pop_front();
+   RdOffset = 0;
+}
+
+void SegmentedFIFO::Shrink()
+{  // Keep one spare segment for the next Grow in any case. The others are
+   // not required as long as they would hold more than the current level.
+   if (Spare.size() <= 1 || (Spare.size() - 1) * SegmentSize <= Level)
+   {  LowSince = 0;
+      return;
+   }
+   time_t now = time(NULL);
+   if (LowSince == 0)
+      LowSince = now;
+    else if (now - LowSince >= ShrinkDelay)
+   {  while (Spare.size() > 1)
+      {  delete Spare.back();
+         Spare.pop_back();
+      }
+      LowSince = 0;
+      UpdateResidentSize();
+   }
+}
+
+void SegmentedFIFO::UpdateResidentSize()
+{  Stat.ResidentSize = (uint64_t)(Chain.size() + Spare.size()) * SegmentSize;
+   if (Stat.PeakResidentSize < Stat.ResidentSize)
+      Stat.PeakResidentSize = Stat.ResidentSize;
+}
+
+void SegmentedFIFO::RequestWrite(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (WrReq)
+      throw std::logic_error("The SegmentedFIFO supports only one outstanding write request.");
+   do
+   {  if (EOS)
+      {  len = 0;
+         return;
+      }
+      if (WrOffset < SegmentSize || Grow())
+      {  size_t rem = SegmentSize - WrOffset;
+         if (len > rem)
+         {  ++Stat.SplitCount;
+            len = rem;
+         }
+         data = Chain.back()->begin() + WrOffset;
+         WrReq = len;
+         return;
+      }
+      ++Stat.FullCount;
+   } while (NotifyDrain.Wait());
+   // error
+   len = 0;
+}
+
+void SegmentedFIFO::CommitWrite(void* data, size_t len)
+{  Lock lc(StateLock);
+   if (!WrReq || data != Chain.back()->begin() + WrOffset)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > WrReq)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   WrReq = 0;
+   WrOffset += len;
+   if ((Level += len) >= HighWaterMark)
+      NotifySource.NotifyAll();
+}
+
+void SegmentedFIFO::EndWrite()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   WrReq = 0; // cancel outstanding request
+   NotifySource.NotifyAll(); // notify the other side regardless of the high water mark.
+}
+
+void SegmentedFIFO::RequestRead(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (RdReq)
+      throw std::logic_error("The SegmentedFIFO supports only one outstanding read request.");
+   bool timeout = false;
+   for (;;)
+   {  // The first segment is complete unless it is the last one as well.
+      size_t rem = (Chain.size() == 1 ? WrOffset : SegmentSize) - RdOffset;
+      if (rem > 0)
+      {  if (len > rem)
+         {  ++Stat.SplitCount;
+            len = rem;
+         }
+         data = Chain.front()->begin() + RdOffset;
+         RdReq = len;
+         return;
+      }
+      if (EOS)
+      {  len = 0;
+         return;
+      }
+      if (!timeout)
+         ++Stat.EmptyCount;
+      // The writer may stay idle for a long time. So do not wait for the
+      // next read to release the unused segments.
+      Shrink();
+      if (LowSince == 0)
+      {  if (!NotifySource.Wait())
+            break;
+         timeout = false;
+      } else
+      {  // Wait at most until the shrink delay is over.
+         const long ms = (long)(LowSince + ShrinkDelay - time(NULL)) * 1000;
+         const uint64_t start = WaitClock();
+         timeout = !NotifySource.Wait(ms);
+         // Without a clock an error ends the wait with the shrink delay.
+         if (timeout && start && WaitClock() - start < (uint64_t)ms * 1000000)
+            break;
+      }
+   }
+   // error
+   len = 0;
+}
+
+void SegmentedFIFO::CommitRead(void* data, size_t len)
+{  Lock lc(StateLock);
+   if (!RdReq || data != Chain.front()->begin() + RdOffset)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > RdReq)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   RdReq = 0;
+   if ((RdOffset += len) == SegmentSize)
+   {  if (Chain.size() > 1)
+         Recycle();
+       else
+         // The only segment is completely read and the writer is at its end
+         // too. Start over at the beginning.
+         RdOffset = WrOffset = 0;
+   }
+   Level -= len;
+   Shrink();
+   if (Level <= LowWaterMark)
+      NotifyDrain.NotifyAll();
+}
+
+void SegmentedFIFO::EndRead()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   RdReq = 0; // cancel outstanding request
+   NotifyDrain.NotifyAll(); // notify the other side regardless of the low water mark.
+}
+
+size_t SegmentedFIFO::Part2Bytes(double part)
+{  if (part < 0.0 || part > 1.0)
+      throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+   return (size_t)(BufferSize * part +.5);
+}
+
+}} // end namespace
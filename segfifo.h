@@ -0,0 +1,99 @@
+#ifndef __segfifo_h
+#define __segfifo_h
+
+#include <deque>
+
+#include "fifo.h"
+
+/*****************************************************************************
+*
+*  segfifo.cpp - fifo buffer that grows and shrinks with demand
+*
+*  The SegmentedFIFO is a chain of fixed size segments. The writer appends
+*  segments as long as the maximum size is not reached. Segments that are
+*  completely read are recycled. If the fill level stays low for some time
+*  the recycled segments are returned to the operating system. So the
+*  resident memory follows the actual demand rather than the worst case.
+*  Requests never span segments.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class SegmentedFIFO
+ : public FIFO
+ , private Drain
+ , private Source
+{private:   // internal quasi-constant objects
+   const Storage::Type MemoryType;
+   const size_t SegmentSize;
+   const size_t Alignment;
+   const bool LockSegments;
+   size_t MaxSegments;
+   size_t BufferSize;
+   size_t LowWaterMark;
+   size_t HighWaterMark;
+   // Unused segments are returned to the operating system after the memory
+   // has not been required for this number of seconds.
+   static const int ShrinkDelay;
+ private:   // internal state
+   std::deque<Storage*> Chain; // segments in use, the reader is at the front
+   std::vector<Storage*> Spare; // recycled segments
+   size_t RdOffset;       // committed read position in the first segment
+   size_t WrOffset;       // committed write position in the last segment
+   size_t volatile Level; // (commited) fill level
+   size_t RdReq;          // size of last outstanding read request
+   size_t WrReq;          // size of last outstanding write request
+   time_t LowSince;       // time since the memory is not required or 0
+   bool volatile EOS; // end of stream flag
+   bool volatile Die; // destroy-flag
+ private:   // internal semaphores
+   IPC::Mutex StateLock;
+   IPC::Notification NotifyDrain;
+   IPC::Notification NotifySource;
+ private:   // statistics
+   Statistics Stat;
+
+ public:    // public interface
+   // Constructor for a segmented fifo of at most maxsize bytes, rounded
+   // down to segmentsize. The segments are allocated as Storage of type
+   // memtype. If lock is true the segments are locked into memory.
+   SegmentedFIFO(Storage::Type memtype, size_t maxsize, size_t segmentsize, size_t alignment,
+                 double highwater, double lowwater, bool lock);
+   virtual ~SegmentedFIFO();
+
+   // @see FIFO::getDrain
+   Drain& getDrain()
+   {  return *this;
+   }
+   // @see FIFO::getSource
+   Source& getSource()
+   {  return *this;
+   }
+
+   virtual volatile const Statistics& getStatistics() const { return Stat; }
+
+ protected: // public interface implementations (indirect)
+   void RequestWrite(void*& data, size_t& len);
+   void CommitWrite(void* data, size_t len);
+   void EndWrite();
+   void RequestRead(void*& data, size_t& len);
+   void CommitRead(void* data, size_t len);
+   void EndRead();
+
+ private:
+   size_t Part2Bytes(double part);
+   // Append a segment to the chain. Returns false if the maximum size is reached.
+   bool Grow();
+   // Recycle the first segment of the chain.
+   void Recycle();
+   // Release recycled segments if they are no longer required.
+   // Called by the reader after each read and while it waits for data.
+   void Shrink();
+   void UpdateResidentSize();
+};
+
+}} // end namespace
+
+#endif
@@ -0,0 +1,78 @@
+/*****************************************************************************
+*
+*  shmclient - example client of the shm:<name> input and output of buffer2
+*
+*  usage: shmclient <name> w   copy stdin into the shared memory fifo
+*         shmclient <name> r   copy the shared memory fifo to stdout
+*
+*  The data is read from stdin directly into the shared ring and written
+*  from the shared ring to stdout respectively. Real clients produce or
+*  consume the data in place instead.
+*  Build it from shmclient.cpp, shmfifo.cpp, exception.cpp and string.cpp.
+*
+*****************************************************************************/
+
+#include "shmfifo.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdexcept>
+
+using namespace std;
+using namespace MM;
+using namespace MM::FIFO;
+
+static void Write(Drain& drain)
+{	for (;;)
+	{	void* data;
+		size_t len = 1024*1024;
+		drain.RequestWrite(data, len);
+		if (len == 0)
+			throw runtime_error("The reader stopped working.");
+		ssize_t n = read(0, data, len);
+		if (n < 0)
+			throw os_error(errno, "Failed to read from stdin.");
+		if (n == 0)
+			break;
+		drain.CommitWrite(data, n);
+	}
+	drain.EndWrite();
+}
+
+static void Read(Source& source)
+{	for (;;)
+	{	void* data;
+		size_t len = 1024*1024;
+		source.RequestRead(data, len);
+		if (len == 0)
+			break;
+		ssize_t n = write(1, data, len);
+		if (n <= 0)
+			throw os_error(errno, "Failed to write to stdout.");
+		source.CommitRead(data, n);
+	}
+	source.EndRead();
+}
+
+int main(int argc, char** argv)
+{	if (argc != 3 || (strcmp(argv[2], "w") != 0 && strcmp(argv[2], "r") != 0))
+	{	fprintf(stderr, "usage: %s <name> w|r\n", argv[0]);
+		return 48;
+	}
+	try
+	{	// wait up to 10 seconds for buffer2 to create the fifo
+		if (*argv[2] == 'w')
+		{	ShmFIFO fifo(argv[1], ShmFIFO::Writer, 10000);
+			Write(fifo.getDrain());
+		} else
+		{	ShmFIFO fifo(argv[1], ShmFIFO::Reader, 10000);
+			Read(fifo.getSource());
+		}
+		return 0;
+	} catch (const exception& e)
+	{	fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
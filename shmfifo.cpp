@@ -0,0 +1,301 @@
+/*****************************************************************************
+*
+*  Shared memory FIFO buffer implementation.
+*  All shared state is protected by a robust process shared mutex. If a
+*  process dies while it owns the mutex the stream is terminated.
+*
+*****************************************************************************/
+
+#include "shmfifo.h"
+#include <stdexcept>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+namespace MM {
+namespace FIFO {
+
+static const char ShmMagic[16] = "buffer2 shm v1";
+
+class ShmFIFO::ShmLock
+{  Header* Head;
+ public:
+   explicit ShmLock(Header* head) : Head(head)
+   {  int rc = pthread_mutex_lock(&Head->Mtx);
+      if (rc == EOWNERDEAD)
+      {  // The other side died in the middle of an operation.
+         pthread_mutex_consistent(&Head->Mtx);
+         Head->EOS = 1;
+         pthread_cond_broadcast(&Head->NotifyDrain);
+         pthread_cond_broadcast(&Head->NotifySource);
+      } else if (rc != 0)
+         throw os_error(rc, "Failed to lock the shared memory fifo.");
+   }
+   ~ShmLock()
+   {  pthread_mutex_unlock(&Head->Mtx);
+   }
+};
+
+// Map a shared memory object name with a leading slash.
+static std::string ShmName(const char* name)
+{  return *name == '/' ? std::string(name) : "/" + std::string(name);
+}
+
+ShmFIFO::ShmFIFO(const char* name, size_t size, double highwater, double lowwater, Side side)
+ : Name(ShmName(name))
+ , MySide(side)
+ , Owner(true)
+{  if (highwater < 0.0 || highwater > 1.0 || lowwater < 0.0 || lowwater > 1.0)
+      throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+   const size_t page = sysconf(_SC_PAGESIZE);
+   size = (size + page - 1) & -page;
+   int fd = shm_open(Name.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+   if (fd == -1)
+      throw os_error(errno, stringf("Failed to create the shared memory object %s. Remove /dev/shm%s if it is left over.", Name.c_str(), Name.c_str()));
+   if (ftruncate(fd, page + size) != 0)
+   {  int rc = errno;
+      close(fd);
+      shm_unlink(Name.c_str());
+      throw os_error(rc, stringf("Failed to allocate the shared memory object %s.", Name.c_str()));
+   }
+   try
+   {  Attach(fd, page + size);
+   } catch (...)
+   {  shm_unlink(Name.c_str());
+      throw;
+   }
+   Head->Size = size;
+   Head->HighWaterMark = (uint64_t)(size * highwater +.5);
+   Head->LowWaterMark = (uint64_t)(size * lowwater +.5);
+   pthread_mutexattr_t mattr;
+   pthread_mutexattr_init(&mattr);
+   pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+   pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+   pthread_mutex_init(&Head->Mtx, &mattr);
+   pthread_mutexattr_destroy(&mattr);
+   pthread_condattr_t cattr;
+   pthread_condattr_init(&cattr);
+   pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+   pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+   pthread_cond_init(&Head->NotifyDrain, &cattr);
+   pthread_cond_init(&Head->NotifySource, &cattr);
+   pthread_condattr_destroy(&cattr);
+   Head->Pid[side] = getpid();
+   BufferSize = size;
+   Stat.ResidentSize = Stat.PeakResidentSize = BufferSize;
+   // The magic marks the header as valid for other processes.
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   memcpy(Head->Magic, ShmMagic, sizeof Head->Magic);
+}
+
+ShmFIFO::ShmFIFO(const char* name, Side side, long timeout)
+ : Name(ShmName(name))
+ , MySide(side)
+ , Owner(false)
+{  // Wait until the object exists and is initialized.
+   int fd;
+   struct stat st;
+   for (;;)
+   {  fd = shm_open(Name.c_str(), O_RDWR, 0);
+      if (fd != -1)
+      {  if (fstat(fd, &st) == 0 && st.st_size != 0)
+            break;
+         close(fd);
+      } else if (errno != ENOENT)
+         throw os_error(errno, stringf("Failed to open the shared memory object %s.", Name.c_str()));
+      if (timeout <= 0)
+         throw std::runtime_error(stringf("The shared memory fifo %s does not exist.", Name.c_str()));
+      usleep(10000);
+      timeout -= 10;
+   }
+   Attach(fd, st.st_size);
+   while (memcmp((const char*)Head->Magic, ShmMagic, sizeof Head->Magic) != 0)
+   {  if (timeout <= 0)
+      {  munmap(Map, MapSize);
+         throw std::runtime_error(stringf("The shared memory object %s is not a buffer2 fifo.", Name.c_str()));
+      }
+      usleep(10000);
+      timeout -= 10;
+   }
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   BufferSize = Head->Size;
+   Stat.ResidentSize = Stat.PeakResidentSize = BufferSize;
+   bool inuse;
+   {  ShmLock lc(Head);
+      inuse = Head->Pid[side] != 0 && (kill(Head->Pid[side], 0) == 0 || errno != ESRCH);
+      if (!inuse)
+         Head->Pid[side] = getpid();
+   }
+   if (inuse)
+   {  munmap(Map, MapSize);
+      throw std::runtime_error(stringf("The %s side of the shared memory fifo %s is already in use.",
+         side == Writer ? "writer" : "reader", Name.c_str()));
+   }
+}
+
+ShmFIFO::~ShmFIFO()
+{  End();
+   munmap(Map, MapSize);
+   if (Owner)
+      shm_unlink(Name.c_str());
+}
+
+void ShmFIFO::Attach(int fd, size_t mapsize)
+{  Map = (char*)mmap(NULL, mapsize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+   int rc = errno;
+   close(fd);
+   if (Map == MAP_FAILED)
+      throw os_error(rc, stringf("Failed to map the shared memory object %s.", Name.c_str()));
+   MapSize = mapsize;
+   Head = (Header*)Map;
+   BufferBegin = Map + sysconf(_SC_PAGESIZE);
+}
+
+Drain& ShmFIFO::getDrain()
+{  if (MySide != Writer)
+      throw std::logic_error("The drain of the shared memory fifo belongs to another process.");
+   return *this;
+}
+
+Source& ShmFIFO::getSource()
+{  if (MySide != Reader)
+      throw std::logic_error("The source of the shared memory fifo belongs to another process.");
+   return *this;
+}
+
+volatile const FIFO::Statistics& ShmFIFO::getStatistics() const
+{  return Stat;
+}
+
+void ShmFIFO::UpdateStatistics()
+{  Stat.EmptyCount = Head->EmptyCount;
+   Stat.FullCount = Head->FullCount;
+   Stat.SplitCount = Head->SplitCount;
+}
+
+bool ShmFIFO::PeerAlive()
+{  pid_t pid = Head->Pid[MySide == Writer ? Reader : Writer];
+   // A side that is not yet attached is alive by definition.
+   return pid == 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+void ShmFIFO::Wait(pthread_cond_t& cond)
+{  struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   ++ts.tv_sec; // check the other side once per second
+   int rc = pthread_cond_timedwait(&cond, &Head->Mtx, &ts);
+   if (rc == EOWNERDEAD)
+   {  pthread_mutex_consistent(&Head->Mtx);
+      Head->EOS = 1;
+   } else if (rc == ETIMEDOUT && !PeerAlive())
+   {  Head->EOS = 1;
+      pthread_cond_broadcast(&Head->NotifyDrain);
+      pthread_cond_broadcast(&Head->NotifySource);
+   }
+}
+
+void ShmFIFO::End()
+{  ShmLock lc(Head);
+   Head->EOS = 1;
+   Head->Req[MySide] = 0; // cancel outstanding request
+   // notify the other side regardless of the water marks.
+   pthread_cond_broadcast(MySide == Writer ? &Head->NotifySource : &Head->NotifyDrain);
+}
+
+void ShmFIFO::RequestWrite(void*& data, size_t& len)
+{  ShmLock lc(Head);
+   if (Head->Req[Writer])
+      throw std::logic_error("The ShmFIFO supports only one outstanding write request.");
+   for (;;)
+   {  if (Head->EOS)
+      {  len = 0;
+         return;
+      }
+      size_t rem = BufferSize - (size_t)(Head->Count[Writer] - Head->Count[Reader]);
+      if (rem > 0)
+      {  if (len > rem)
+            len = rem;
+         size_t offset = Head->Count[Writer] % BufferSize;
+         if (len > BufferSize - offset)
+         {  ++Head->SplitCount;
+            len = BufferSize - offset;
+         }
+         UpdateStatistics();
+         data = BufferBegin + offset;
+         Head->Req[Writer] = len;
+         return;
+      }
+      ++Head->FullCount;
+      UpdateStatistics();
+      Wait(Head->NotifyDrain);
+   }
+}
+
+void ShmFIFO::CommitWrite(void* data, size_t len)
+{  ShmLock lc(Head);
+   if (!Head->Req[Writer] || data != BufferBegin + Head->Count[Writer] % BufferSize)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > Head->Req[Writer])
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   Head->Req[Writer] = 0;
+   UpdateStatistics();
+   if ((Head->Count[Writer] += len) - Head->Count[Reader] >= Head->HighWaterMark)
+      pthread_cond_broadcast(&Head->NotifySource);
+}
+
+void ShmFIFO::EndWrite()
+{  End();
+}
+
+void ShmFIFO::RequestRead(void*& data, size_t& len)
+{  ShmLock lc(Head);
+   if (Head->Req[Reader])
+      throw std::logic_error("The ShmFIFO supports only one outstanding read request.");
+   for (;;)
+   {  size_t rem = (size_t)(Head->Count[Writer] - Head->Count[Reader]);
+      if (rem > 0)
+      {  if (len > rem)
+            len = rem;
+         size_t offset = Head->Count[Reader] % BufferSize;
+         if (len > BufferSize - offset)
+         {  ++Head->SplitCount;
+            len = BufferSize - offset;
+         }
+         UpdateStatistics();
+         data = BufferBegin + offset;
+         Head->Req[Reader] = len;
+         return;
+      }
+      if (Head->EOS)
+      {  len = 0;
+         return;
+      }
+      ++Head->EmptyCount;
+      UpdateStatistics();
+      Wait(Head->NotifySource);
+   }
+}
+
+void ShmFIFO::CommitRead(void* data, size_t len)
+{  ShmLock lc(Head);
+   if (!Head->Req[Reader] || data != BufferBegin + Head->Count[Reader] % BufferSize)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > Head->Req[Reader])
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   Head->Req[Reader] = 0;
+   UpdateStatistics();
+   if (Head->Count[Writer] - (Head->Count[Reader] += len) <= Head->LowWaterMark)
+      pthread_cond_broadcast(&Head->NotifyDrain);
+}
+
+void ShmFIFO::EndRead()
+{  End();
+}
+
+}} // end namespace
@@ -0,0 +1,109 @@
+#ifndef __shmfifo_h
+#define __shmfifo_h
+
+#include <string>
+#include <sys/types.h>
+
+#include "fifo.h"
+
+/*****************************************************************************
+*
+*  shmfifo.cpp - fifo buffer in shared memory
+*
+*  The ShmFIFO places the ring and its state in a POSIX shared memory
+*  object. One process creates the object and uses one side of the fifo.
+*  Another process attaches to the object by its name and uses the other
+*  side. The data is written and read in place, so it crosses the process
+*  boundary without any copy.
+*  Together with fifo.h, exception.cpp and string.cpp this is the client
+*  library for the shm:<name> input and output of buffer2.
+*  The shared memory contains only plain data and process shared pthread
+*  objects. A side that dies is detected by its process ID. This causes
+*  the end of the stream at the other side.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class ShmFIFO
+ : public FIFO
+ , private Drain
+ , private Source
+{public:
+   enum Side
+   {  Writer,       // the process uses the drain interface
+      Reader        // the process uses the source interface
+   };
+ private:   // internal types
+   // Shared state at the start of the shared memory object.
+   // Only plain data, no virtual functions.
+   struct Header
+   {  char     Magic[16];
+      uint64_t Size;          // size of the ring
+      uint64_t HighWaterMark;
+      uint64_t LowWaterMark;
+      pthread_mutex_t Mtx;
+      pthread_cond_t  NotifyDrain;
+      pthread_cond_t  NotifySource;
+      pid_t    Pid[2];        // processes attached to the sides or 0
+      uint64_t Count[2];      // committed stream positions of the sides
+      uint64_t Req[2];        // size of the outstanding requests
+      int      EOS;           // end of stream flag
+      uint64_t EmptyCount;
+      uint64_t FullCount;
+      uint64_t SplitCount;
+   };
+   // Lock of the shared mutex
+   class ShmLock;
+ private:   // internal quasi-constant objects
+   const std::string Name;
+   const Side MySide;
+   const bool Owner;
+   char* Map;
+   size_t MapSize;
+   Header* Head;
+   char* BufferBegin;
+   size_t BufferSize;
+ private:   // statistics
+   Statistics Stat;       // copy of the shared counters, updated by each request
+
+ public:    // public interface
+   // Create the shared memory object name with a ring of size bytes and use
+   // side of it. The object is removed when the fifo is destroyed.
+   ShmFIFO(const char* name, size_t size, double highwater, double lowwater, Side side);
+   // Attach to the existing shared memory object name and use side of it.
+   // Wait at most timeout ms for the object to be created.
+   ShmFIFO(const char* name, Side side, long timeout = 0);
+   virtual ~ShmFIFO();
+
+   // @see FIFO::getDrain
+   Drain& getDrain();
+   // @see FIFO::getSource
+   Source& getSource();
+
+   virtual volatile const Statistics& getStatistics() const;
+
+ protected: // public interface implementations (indirect)
+   void RequestWrite(void*& data, size_t& len);
+   void CommitWrite(void* data, size_t len);
+   void EndWrite();
+   void RequestRead(void*& data, size_t& len);
+   void CommitRead(void* data, size_t len);
+   void EndRead();
+
+ private:
+   // Map the shared memory object fd.
+   void Attach(int fd, size_t mapsize);
+   // Wait for cond. Sets the end of stream flag if the other side died.
+   void Wait(pthread_cond_t& cond);
+   // Check whether the process at the other side is still alive.
+   bool PeerAlive();
+   void End();
+   // Copy the shared counters to Stat. The caller must hold the lock.
+   void UpdateStatistics();
+};
+
+}} // end namespace
+
+#endif
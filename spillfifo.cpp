@@ -0,0 +1,407 @@
+/*****************************************************************************
+*
+*  FIFO buffer with spill file implementation.
+*  The worker thread releases the mutex during I/O and memory copies. While
+*  Transferring is set it owns the ring space behind WrPos, the first chunk
+*  of the queue (or the current chunk) and the spill file.
+*
+*****************************************************************************/
+
+#include "spillfifo.h"
+#include <stdexcept>
+#include <string>
+#include <errno.h>
+#include <string.h>
+
+#if !defined(__OS2__) && !defined(_WIN32)
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+namespace MM {
+namespace FIFO {
+
+using namespace MM::IPC;
+
+#if defined(__OS2__) || defined(_WIN32)
+SpillFIFO::SpillFIFO(Storage* storage, double, const char*, size_t)
+ : Buffer(storage)
+ , HighWaterMark(0)
+ , ChunkSize(0)
+ , NotifyDrain(StateLock)
+ , NotifySource(StateLock)
+ , NotifyWorker(StateLock)
+{  throw std::runtime_error("The spill file is not supported on this platform.");
+}
+
+SpillFIFO::~SpillFIFO()
+{}
+
+#else
+SpillFIFO::SpillFIFO(Storage* storage, double highwater, const char* dir, size_t chunksize)
+ : Buffer(storage)
+ , BufferBegin(Buffer->begin())
+ , BufferEnd(Buffer->end())
+ , BufferSize(Buffer->size())
+ , HighWaterMark(Part2Bytes(highwater))
+ , ChunkSize(chunksize)
+ , FileHandle(-1)
+ , RdPos(BufferBegin)
+ , WrPos(BufferBegin)
+ , Level(0)
+ , RdReq(0)
+ , WrReq(0)
+ , Mode(Direct)
+ , Current(NULL)
+ , Backlog(0)
+ , FileRdPos(0)
+ , FileWrPos(0)
+ , FilePunched(0)
+ , Transferring(false)
+ , WorkerIdle(false)
+ , SpillFailed(false)
+ , ReadError(0)
+ , EOS(false)
+ , Die(false)
+ , NotifyDrain(StateLock)
+ , NotifySource(StateLock)
+ , NotifyWorker(StateLock)
+{  if (ChunkSize == 0)
+      throw std::invalid_argument("The chunk size of the SpillFIFO must be positive.");
+   Stat.AllocTime = Buffer->getAllocTime();
+   Stat.PrefaultTime = Buffer->getPrefaultTime();
+   Stat.ResidentSize = Stat.PeakResidentSize = BufferSize + ChunkCount * ChunkSize;
+   // create an anonymous spill file
+   std::string name = std::string(dir) + "/buffer2.XXXXXX";
+   FileHandle = mkstemp(&name[0]);
+   if (FileHandle == -1)
+      throw os_error(errno, stringf("Failed to create the spill file in %s.", dir));
+   unlink(name.c_str());
+   try
+   {  for (unsigned i = 0; i < ChunkCount; ++i)
+      {  Chunks.push_back(new Chunk(ChunkSize));
+         Free.push_back(Chunks.back());
+      }
+      int rc = pthread_create(&WorkerThread, NULL, WorkerStub, this);
+      if (rc != 0)
+         throw os_error(rc, "Failed to start the spill file worker thread.");
+   } catch (...)
+   {  for (size_t i = 0; i < Chunks.size(); ++i)
+         delete Chunks[i];
+      close(FileHandle);
+      throw;
+   }
+}
+
+SpillFIFO::~SpillFIFO()
+{  {  Lock lc(StateLock);
+      Die = true;
+      NotifyWorker.NotifyAll();
+   }
+   pthread_join(WorkerThread, NULL);
+   for (size_t i = 0; i < Chunks.size(); ++i)
+      delete Chunks[i];
+   close(FileHandle);
+}
+
+void* SpillFIFO::WorkerStub(void* arg)
+{  ((SpillFIFO*)arg)->Worker();
+   return NULL;
+}
+
+void SpillFIFO::Worker()
+{  Lock lc(StateLock);
+   while (!Die && !ReadError)
+   {  size_t ringfree = BufferSize - Level;
+      bool filedata = FileRdPos < FileWrPos;
+      // Chunks must go to the file if there is older data in the file or no
+      // room in the ring.
+      bool spill = !Queue.empty() && !SpillFailed && (filedata || ringfree == 0);
+      bool refill = ringfree != 0 && (filedata || !Queue.empty() || (Current && Current->Moved < Current->Len));
+      // Prefer the spill file if the writer is about to block.
+      if (spill && (Free.empty() || !refill))
+         SpillChunk(lc);
+       else if (refill)
+         Refill(lc);
+       else
+      {  WorkerIdle = true;
+         NotifyWorker.Wait();
+         WorkerIdle = false;
+      }
+   }
+}
+
+void SpillFIFO::SpillChunk(Lock& lc)
+{  Chunk* chunk = Queue.front();
+   const char* src = &chunk->Data[chunk->Moved];
+   size_t len = chunk->Len - chunk->Moved;
+   off_t pos = FileWrPos;
+   Transferring = true;
+   lc.Release();
+   int rc = 0;
+   while (len)
+   {  ssize_t n = pwrite(FileHandle, src, len, pos);
+      if (n < 0)
+      {  if (errno == EINTR)
+            continue;
+         rc = errno;
+         break;
+      }
+      src += n;
+      pos += n;
+      len -= n;
+   }
+   lc.Request();
+   Transferring = false;
+   if (rc)
+   {  // Continue without the file. The writer blocks if the chunks are full.
+      SpillFailed = true;
+      Stat.SpillError = rc;
+      return;
+   }
+   Stat.SpillBytes += chunk->Len - chunk->Moved;
+   FileWrPos = pos;
+   if (Stat.PeakSpillSize < FileWrPos - FileRdPos)
+      Stat.PeakSpillSize = FileWrPos - FileRdPos;
+   Queue.pop_front();
+   Free.push_back(chunk);
+   NotifyDrain.NotifyAll();
+}
+
+void SpillFIFO::Refill(Lock& lc)
+{  size_t len = BufferSize - Level;
+   if (len > (size_t)(BufferEnd - WrPos))
+      len = BufferEnd - WrPos;
+   char* dst = WrPos;
+   if (FileRdPos < FileWrPos)
+   {  // read back the spill file
+      if (len > ChunkSize)
+         len = ChunkSize;
+      if (len > FileWrPos - FileRdPos)
+         len = FileWrPos - FileRdPos;
+      off_t pos = FileRdPos;
+      Transferring = true;
+      lc.Release();
+      size_t done = 0;
+      int rc = 0;
+      while (done < len)
+      {  ssize_t n = pread(FileHandle, dst + done, len - done, pos + done);
+         if (n <= 0)
+         {  if (n < 0 && errno == EINTR)
+               continue;
+            rc = n < 0 ? errno : EIO;
+            break;
+         }
+         done += n;
+      }
+      lc.Request();
+      Transferring = false;
+      if (rc)
+      {  // The data is lost. Let the reader fail.
+         ReadError = rc;
+         NotifySource.NotifyAll();
+         return;
+      }
+      FileRdPos += len;
+      ReleaseFile(lc);
+   } else
+   {  // copy the chunks that did not reach the file
+      Chunk* chunk = Queue.empty() ? Current : Queue.front();
+      if (len > chunk->Len - chunk->Moved)
+         len = chunk->Len - chunk->Moved;
+      const char* src = &chunk->Data[chunk->Moved];
+      Transferring = true;
+      lc.Release();
+      memcpy(dst, src, len);
+      lc.Request();
+      Transferring = false;
+      chunk->Moved += len;
+      if (!Queue.empty() && Queue.front() == chunk && chunk->Moved == chunk->Len)
+      {  Queue.pop_front();
+         Free.push_back(chunk);
+         NotifyDrain.NotifyAll();
+      }
+   }
+   if ((WrPos += len) == BufferEnd)
+      WrPos = BufferBegin;
+   Backlog -= len;
+   if ((Level += len) >= HighWaterMark || EOS)
+      NotifySource.NotifyAll();
+}
+
+void SpillFIFO::ReleaseFile(Lock& lc)
+{  if (FileRdPos == FileWrPos)
+   {  // Everything is read back. Start over at the beginning of the file.
+      Transferring = true;
+      lc.Release();
+      int rc = ftruncate(FileHandle, 0);
+      lc.Request();
+      Transferring = false;
+      if (rc == 0)
+      {  FileRdPos = FileWrPos = FilePunched = 0;
+         return;
+      }
+   }
+   #ifdef FALLOC_FL_PUNCH_HOLE
+   // Release the file space in units of chunks.
+   uint64_t end = FileRdPos - FileRdPos % ChunkSize;
+   if (end > FilePunched)
+   {  uint64_t start = FilePunched;
+      Transferring = true;
+      lc.Release();
+      int rc = fallocate(FileHandle, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, start, end - start);
+      lc.Request();
+      Transferring = false;
+      if (rc == 0)
+         FilePunched = end;
+   }
+   #endif
+}
+#endif
+
+size_t SpillFIFO::ClipAtEnd(char* pos, size_t len)
+{  size_t rem = BufferEnd - pos;
+   if (len > rem)
+   {  ++Stat.SplitCount;
+      if (!Buffer->isMirrored())
+         len = rem;
+   }
+   return len;
+}
+
+void SpillFIFO::RequestWrite(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (WrReq)
+      throw std::logic_error("The SpillFIFO supports only one outstanding write request.");
+   do
+   {  if (EOS)
+      {  len = 0;
+         return;
+      }
+      if ( Mode == Spill && !Transferring && Queue.empty() && FileRdPos == FileWrPos
+        && (!Current || Current->Moved == Current->Len) )
+      {  // Everything is back in the ring.
+         if (Current)
+         {  Free.push_back(Current);
+            Current = NULL;
+         }
+         Mode = Direct;
+      }
+      if (Mode == Direct)
+      {  size_t rem = BufferSize - Level;
+         if (rem > 0)
+         {  if (len > rem)
+               len = rem;
+            len = ClipAtEnd(WrPos, len);
+            data = WrPos;
+            WrReq = len;
+            return;
+         }
+         // The ring is full, continue in the chunks.
+         Mode = Spill;
+      }
+      if (Current && Current->Len == ChunkSize)
+      {  Queue.push_back(Current);
+         Current = NULL;
+      }
+      if (!Current && !Free.empty())
+      {  Current = Free.back();
+         Free.pop_back();
+         Current->Len = Current->Moved = 0;
+      }
+      if (Current)
+      {  size_t rem = ChunkSize - Current->Len;
+         if (len > rem)
+            len = rem;
+         data = &Current->Data[Current->Len];
+         WrReq = len;
+         return;
+      }
+      ++Stat.FullCount;
+   } while (NotifyDrain.Wait());
+   // error
+   len = 0;
+}
+
+void SpillFIFO::CommitWrite(void* data, size_t len)
+{  Lock lc(StateLock);
+   if (!WrReq || data != (Mode == Direct ? WrPos : &Current->Data[Current->Len]))
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > WrReq)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   WrReq = 0;
+   if (Mode == Direct)
+   {  if ((WrPos += len) >= BufferEnd)
+         WrPos -= BufferSize;
+      if ((Level += len) >= HighWaterMark)
+         NotifySource.NotifyAll();
+   } else
+   {  Current->Len += len;
+      Backlog += len;
+      if (WorkerIdle)
+         NotifyWorker.NotifyAll();
+   }
+}
+
+void SpillFIFO::EndWrite()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   WrReq = 0; // cancel outstanding request
+   NotifySource.NotifyAll(); // notify the other side regardless of the high water mark.
+   NotifyWorker.NotifyAll();
+}
+
+void SpillFIFO::RequestRead(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (RdReq)
+      throw std::logic_error("The SpillFIFO supports only one outstanding read request.");
+   do
+   {  size_t rem = Level;
+      if (rem > 0)
+      {  if (len > rem)
+            len = rem;
+         len = ClipAtEnd(RdPos, len);
+         data = RdPos;
+         RdReq = len;
+         return;
+      }
+      if (ReadError)
+         throw os_error(ReadError, "Failed to read back the spill file.");
+      if (EOS && Backlog == 0)
+      {  len = 0;
+         return;
+      }
+      ++Stat.EmptyCount;
+   } while (NotifySource.Wait());
+   // error
+   len = 0;
+}
+
+void SpillFIFO::CommitRead(void* data, size_t len)
+{  Lock lc(StateLock);
+   if (!RdReq || data != RdPos)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > RdReq)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   RdReq = 0;
+   if ((RdPos += len) >= BufferEnd)
+      RdPos -= BufferSize;
+   Level -= len;
+   if (WorkerIdle && Backlog)
+      NotifyWorker.NotifyAll();
+}
+
+void SpillFIFO::EndRead()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   RdReq = 0; // cancel outstanding request
+   NotifyDrain.NotifyAll(); // notify the other side regardless of the low water mark.
+}
+
+size_t SpillFIFO::Part2Bytes(double part)
+{  if (part < 0.0 || part > 1.0)
+      throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+   return (size_t)(BufferSize * part +.5);
+}
+
+}} // end namespace
@@ -0,0 +1,129 @@
+#ifndef __spillfifo_h
+#define __spillfifo_h
+
+#include <deque>
+
+#include "fifo.h"
+
+/*****************************************************************************
+*
+*  spillfifo.cpp - fifo buffer with an overflow file
+*
+*  The SpillFIFO behaves like a StaticFIFO as long as the buffer in memory
+*  is not full. When the writer hits the end of the ring it continues in a
+*  few staging chunks instead of blocking. A worker thread appends the full
+*  chunks to a spill file with large sequential writes and reads the file
+*  back into the ring as soon as the reader makes room. Data that did not
+*  reach the file is copied from the chunks to the ring directly. Once
+*  everything is back in the ring the writer continues in the ring again.
+*  So the order of the data is preserved and the writer only blocks if the
+*  disk cannot keep up.
+*  The spill file is deleted immediately after creation. The part that has
+*  been read back is released by punching holes into the file where
+*  supported.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class SpillFIFO
+ : public FIFO
+ , private Drain
+ , private Source
+{private:   // internal types
+   enum { ChunkCount = 4 };
+   // Staging buffer of the writer
+   struct Chunk
+   {  std::vector<char> Data;
+      size_t Len;          // committed data
+      size_t Moved;        // data already moved to the ring or the file
+      explicit Chunk(size_t size) : Data(size), Len(0), Moved(0) {}
+   };
+   enum WriteMode
+   {  Direct,    // The writer writes into the ring.
+      Spill      // The writer writes into the staging chunks.
+   };
+ private:   // internal quasi-constant objects
+   const std::auto_ptr<Storage> Buffer;
+   char* BufferBegin;
+   char* BufferEnd;
+   size_t BufferSize;
+   const size_t HighWaterMark;
+   const size_t ChunkSize;
+   int FileHandle;
+ private:   // internal state
+   char* RdPos;           // current commited read position in the ring
+   char* WrPos;           // current comitted write position in the ring
+   size_t volatile Level; // fill level of the ring
+   size_t RdReq;          // size of outstanding read request
+   size_t WrReq;          // size of outstanding write request
+   WriteMode Mode;
+   std::vector<Chunk*> Chunks; // all chunks
+   std::vector<Chunk*> Free;   // unused chunks
+   std::deque<Chunk*> Queue;   // full chunks in order
+   Chunk* Current;        // chunk of the writer or NULL
+   uint64_t Backlog;      // data in the chunks and the file, not yet in the ring
+   uint64_t FileRdPos;    // read position in the spill file
+   uint64_t FileWrPos;    // write position in the spill file
+   uint64_t FilePunched;  // the file is released up to this position
+   bool Transferring;     // the worker currently does I/O without the mutex
+   bool WorkerIdle;       // the worker waits for NotifyWorker
+   bool SpillFailed;      // writing the spill file failed, do not try again
+   int ReadError;         // reading the spill file failed with this error
+   bool volatile EOS; // end of stream flag
+   bool volatile Die; // destroy-flag
+ private:   // internal semaphores
+   IPC::Mutex StateLock;
+   IPC::Notification NotifyDrain;
+   IPC::Notification NotifySource;
+   IPC::Notification NotifyWorker;
+   #if !defined(__OS2__) && !defined(_WIN32)
+   pthread_t WorkerThread;
+   #endif
+ private:   // statistics
+   Statistics Stat;
+
+ public:    // public interface
+   // Constructor for a fifo in storage with a spill file in directory dir.
+   // The fifo takes the ownership of the storage object. The spill file is
+   // written in chunks of chunksize bytes.
+   SpillFIFO(Storage* storage, double highwater, const char* dir, size_t chunksize);
+   virtual ~SpillFIFO();
+
+   // @see FIFO::getDrain
+   Drain& getDrain()
+   {  return *this;
+   }
+   // @see FIFO::getSource
+   Source& getSource()
+   {  return *this;
+   }
+
+   virtual volatile const Statistics& getStatistics() const { return Stat; }
+
+ protected: // public interface implementations (indirect)
+   void RequestWrite(void*& data, size_t& len);
+   void CommitWrite(void* data, size_t len);
+   void EndWrite();
+   void RequestRead(void*& data, size_t& len);
+   void CommitRead(void* data, size_t len);
+   void EndRead();
+
+ private:
+   size_t Part2Bytes(double part);
+   size_t ClipAtEnd(char* pos, size_t len);
+   // Worker thread that moves the chunks to the file and to the ring.
+   static void* WorkerStub(void* arg);
+   void Worker();
+   // Append the first chunk of the queue to the spill file.
+   void SpillChunk(IPC::Lock& lc);
+   // Move the oldest data from the spill file or the chunks into the ring.
+   void Refill(IPC::Lock& lc);
+   // Release the part of the spill file that has been read back.
+   void ReleaseFile(IPC::Lock& lc);
+};
+
+}} // end namespace
+
+#endif
@@ -0,0 +1,287 @@
+/*****************************************************************************
+*
+*  Splice FIFO buffer implementation.
+*  The ring positions and the byte counts are protected by StateLock, but
+*  the splice calls run without it. The writer owns the free space of the
+*  pipe WrPipe and the reader owns the counted data of the pipe RdPipe.
+*  The pipes outside of RdPipe..WrPipe are empty and RdPipe is empty only
+*  if it is WrPipe.
+*
+*****************************************************************************/
+
+#include "splicefifo.h"
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#endif
+
+namespace MM {
+namespace FIFO {
+
+using namespace MM::IPC;
+
+#ifndef __linux__
+SpliceFIFO::SpliceFIFO(size_t, double, double)
+ : BufferSize(0)
+ , Capacity(0)
+ , HighWaterMark(0)
+ , LowWaterMark(0)
+ , NotifyDrain(StateLock)
+ , NotifySource(StateLock)
+{  throw std::runtime_error("The splice fifo is not supported on this platform.");
+}
+
+SpliceFIFO::~SpliceFIFO()
+{}
+
+bool SpliceFIFO::SpliceIn(int, size_t& len)
+{  len = 0;
+   return false;
+}
+
+size_t SpliceFIFO::SpliceOut(int, size_t)
+{  return 0;
+}
+
+void SpliceFIFO::CreatePipes()
+{}
+
+void SpliceFIFO::ClosePipes()
+{}
+
+#else
+// Each pipe takes two file descriptors.
+static const size_t MaxPipes = 256;
+
+SpliceFIFO::SpliceFIFO(size_t size, double highwater, double lowwater)
+ : BufferSize(size)
+ , Capacity(0)
+ , HighWaterMark(0)
+ , LowWaterMark(0)
+ , WrPipe(0)
+ , RdPipe(0)
+ , Level(0)
+ , WriterWaiting(false)
+ , ReaderWaiting(false)
+ , EOS(false)
+ , Stopped(false)
+ , NotifyDrain(StateLock)
+ , NotifySource(StateLock)
+{  if (BufferSize == 0)
+      throw std::invalid_argument("The size of the SpliceFIFO must be positive.");
+   CreatePipes();
+   // The water marks refer to the pipes really created.
+   try
+   {  HighWaterMark = Part2Bytes(highwater);
+      LowWaterMark = Part2Bytes(lowwater);
+   } catch (...)
+   {  ClosePipes();
+      throw;
+   }
+}
+
+SpliceFIFO::~SpliceFIFO()
+{  ClosePipes();
+}
+
+void SpliceFIFO::CreatePipes()
+{  const uint64_t start = WaitClock();
+   size_t want = BufferSize;
+   size_t total = 0;
+   while (total < BufferSize && Pipes.size() < MaxPipes)
+   {  int fd[2];
+      if (pipe(fd) != 0)
+      {  if (Pipes.size() && (errno == EMFILE || errno == ENFILE))
+            break; // continue with less capacity
+         const int rc = errno;
+         ClosePipes();
+         throw os_error(rc, "Failed to create a pipe for the splice fifo.");
+      }
+      Pipe p = { fd[0], fd[1], 0, 0, false };
+      Pipes.push_back(p);
+      // The kernel limits the pipe size, e.g. to /proc/sys/fs/pipe-max-size.
+      // So retry with smaller pipes.
+      want = std::min(want, BufferSize - total);
+      int len;
+      while ((len = fcntl(fd[0], F_SETPIPE_SZ, (int)std::min(want, (size_t)1 << 30))) == -1 && want > 4096)
+         want /= 2;
+      if (len == -1 && (len = fcntl(fd[0], F_GETPIPE_SZ)) == -1)
+      {  const int rc = errno;
+         ClosePipes();
+         throw os_error(rc, "Failed to query the size of a pipe for the splice fifo.");
+      }
+      Pipes.back().Size = len;
+      total += len;
+   }
+   Stat.AllocTime = (WaitClock() - start) / 1E9;
+   Capacity = total;
+   Stat.ResidentSize = Stat.PeakResidentSize = total;
+}
+
+void SpliceFIFO::ClosePipes()
+{  for (size_t i = 0; i < Pipes.size(); ++i)
+   {  close(Pipes[i].Rd);
+      close(Pipes[i].Wr);
+   }
+   Pipes.clear();
+}
+
+bool SpliceFIFO::isFull() const
+{  const Pipe& p = Pipes[WrPipe];
+   return (p.Full || p.Level >= p.Size) && Next(WrPipe) == RdPipe;
+}
+
+bool SpliceFIFO::SpliceIn(int fd, size_t& len)
+{  Lock lc(StateLock);
+   for (;;)
+   {  if (Stopped)
+      {  len = 0;
+         return false;
+      }
+      Pipe& p = Pipes[WrPipe];
+      if (p.Full || p.Level >= p.Size)
+      {  if (Next(WrPipe) != RdPipe)
+         {  // continue with the next pipe, it is empty
+            WrPipe = Next(WrPipe);
+            continue;
+         }
+         ++Stat.FullCount;
+         WriterWaiting = true;
+         // The reader must not wait for a high water mark that the ring cannot reach.
+         if (ReaderWaiting)
+            NotifySource.NotifyAll();
+         const uint64_t start = WaitClock();
+         bool ok;
+         do
+            ok = NotifyDrain.Wait();
+         while (ok && !Stopped && (isFull() || Level > LowWaterMark));
+         WriterWaiting = false;
+         Stat.FullTime += (WaitClock() - start) / 1E9;
+         if (!ok)
+         {  // error
+            len = 0;
+            return false;
+         }
+         continue;
+      }
+      const int wr = p.Wr;
+      const size_t size = std::min(len, p.Size - p.Level);
+      lc.Release();
+      // Wait for the input first. So EAGAIN from a nonblocking splice
+      // means that the pipe is out of buffers rather than a slow input.
+      ssize_t r;
+      do
+      {  pollfd pfd;
+         pfd.fd = fd;
+         pfd.events = POLLIN;
+         r = poll(&pfd, 1, -1);
+         if (r != -1)
+            r = splice(fd, NULL, wr, NULL, size, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+      } while (r == -1 && errno == EINTR);
+      const int rc = errno;
+      lc.Request();
+      if (r == -1)
+      {  if (rc != EAGAIN)
+            throw os_error(rc, "Failed to splice from the input stream.");
+         // The pipe may take less than its size, e.g. if the input passes
+         // small fragments. Continue with the next pipe.
+         if (p.Level)
+            p.Full = true;
+         continue;
+      }
+      p.Level += r;
+      Level += r;
+      Stat.BytesIn += r;
+      if (ReaderWaiting && Level >= HighWaterMark)
+         NotifySource.NotifyAll();
+      len = r;
+      return true;
+   }
+}
+
+size_t SpliceFIFO::SpliceOut(int fd, size_t len)
+{  Lock lc(StateLock);
+   if (Level == 0 && !EOS)
+   {  ++Stat.EmptyCount;
+      ReaderWaiting = true;
+      const uint64_t start = WaitClock();
+      bool ok;
+      do
+         ok = NotifySource.Wait();
+      while (ok && !EOS && (Level == 0 || (Level < HighWaterMark && !WriterWaiting)));
+      ReaderWaiting = false;
+      Stat.EmptyTime += (WaitClock() - start) / 1E9;
+      if (!ok)
+         return 0; // error
+   }
+   if (Level == 0)
+      return 0; // end of stream
+   Pipe& p = Pipes[RdPipe];
+   const int rd = p.Rd;
+   const size_t size = std::min(len, p.Level);
+   // Let a socket merge the data with the next call.
+   const unsigned flags = Level > size ? SPLICE_F_MOVE|SPLICE_F_MORE : SPLICE_F_MOVE;
+   lc.Release();
+   ssize_t r;
+   do
+      r = splice(rd, NULL, fd, NULL, size, flags);
+   while (r == -1 && errno == EINTR);
+   const int rc = errno;
+   lc.Request();
+   if (r == -1)
+      throw os_error(rc, "Failed to splice to the output stream.");
+   if (r == 0)
+      throw std::runtime_error("Failed to write to the output stream because the destination does not accept more data.");
+   p.Level -= r;
+   Level -= r;
+   Stat.BytesOut += r;
+   if (p.Level == 0)
+   {  p.Full = false;
+      if (RdPipe != WrPipe)
+         RdPipe = Next(RdPipe);
+   }
+   if (WriterWaiting && !isFull() && Level <= LowWaterMark)
+      NotifyDrain.NotifyAll();
+   return r;
+}
+#endif
+
+void SpliceFIFO::RequestWrite(void*&, size_t&)
+{  throw std::logic_error("The SpliceFIFO has no buffer memory. Use SpliceIn.");
+}
+
+void SpliceFIFO::CommitWrite(void*, size_t)
+{  throw std::logic_error("The SpliceFIFO has no buffer memory. Use SpliceIn.");
+}
+
+void SpliceFIFO::EndWrite()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   NotifySource.NotifyAll(); // notify the other side regardless of the high water mark.
+}
+
+void SpliceFIFO::RequestRead(void*&, size_t&)
+{  throw std::logic_error("The SpliceFIFO has no buffer memory. Use SpliceOut.");
+}
+
+void SpliceFIFO::CommitRead(void*, size_t)
+{  throw std::logic_error("The SpliceFIFO has no buffer memory. Use SpliceOut.");
+}
+
+void SpliceFIFO::EndRead()
+{  Lock lc(StateLock);
+   Stopped = true;
+   NotifyDrain.NotifyAll(); // notify the other side regardless of the low water mark.
+}
+
+size_t SpliceFIFO::Part2Bytes(double part)
+{  if (part < 0.0 || part > 1.0)
+      throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+   return (size_t)(Capacity * part +.5);
+}
+
+}} // end namespace
@@ -0,0 +1,111 @@
+#ifndef __splicefifo_h
+#define __splicefifo_h
+
+#include <vector>
+
+#include "fifo.h"
+
+/*****************************************************************************
+*
+*  splicefifo.cpp - fifo buffer of kernel pipes for splice relays
+*
+*  The data never enters the user space. The writer splices it from a file
+*  descriptor into a ring of pipes and the reader splices it from there to
+*  another file descriptor. Each pipe holds one part of the buffer, so the
+*  buffer can be larger than the maximum size of a pipe. The fifo counts
+*  the bytes in the pipes like the other fifos count the bytes in their
+*  memory, so the water marks, the statistics and the end of the stream
+*  work the same way. The file descriptors may be pipes, sockets, files or
+*  block devices.
+*  The Drain and Source interfaces support only EndWrite and EndRead. The
+*  data is passed by SpliceIn and SpliceOut. Only available on Linux.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class SpliceFIFO
+ : public FIFO
+ , private Drain
+ , private Source
+{private:   // internal types
+   struct Pipe
+   {  int Rd;             // read end
+      int Wr;             // write end
+      size_t Size;        // capacity
+      size_t Level;       // bytes in the pipe
+      bool Full;          // no more space, e.g. all pipe buffers are in use
+   };
+ private:   // internal quasi-constant objects
+   const size_t BufferSize;
+   size_t Capacity;       // total size of the pipes
+   size_t HighWaterMark;
+   size_t LowWaterMark;
+ private:   // internal state
+   std::vector<Pipe> Pipes;
+   size_t WrPipe;         // pipe of the writer
+   size_t RdPipe;         // pipe of the reader
+   size_t Level;          // bytes in all pipes
+   bool WriterWaiting;    // the writer waits at a full ring
+   bool ReaderWaiting;    // the reader waits at an empty ring
+   bool volatile EOS;     // end of stream flag
+   bool volatile Stopped; // the reader stopped
+ private:   // internal semaphores
+   IPC::Mutex StateLock;
+   IPC::Notification NotifyDrain;
+   IPC::Notification NotifySource;
+ private:   // statistics
+   Statistics Stat;
+
+ public:    // public interface
+   // Constructor for a fifo of pipes with a total capacity of at least
+   // size bytes. If the pipes cannot be enlarged or the process runs out
+   // of file descriptors the capacity may be less.
+   SpliceFIFO(size_t size, double highwater, double lowwater);
+   virtual ~SpliceFIFO();
+
+   // @see FIFO::getDrain
+   Drain& getDrain()
+   {  return *this;
+   }
+   // @see FIFO::getSource
+   Source& getSource()
+   {  return *this;
+   }
+
+   virtual volatile const Statistics& getStatistics() const { return Stat; }
+   // Total capacity of the pipes. May be less than requested.
+   size_t getCapacity() const { return Capacity; }
+
+   // Move up to len bytes from fd into the fifo. Waits while the fifo is
+   // full. len returns the number of bytes, 0 at the end of the input.
+   // Returns false if the reader stopped.
+   bool SpliceIn(int fd, size_t& len);
+   // Move up to len bytes from the fifo to fd. Waits while the fifo is
+   // empty. Returns the number of bytes, 0 at the end of the stream.
+   size_t SpliceOut(int fd, size_t len);
+
+ protected: // public interface implementations (indirect)
+   void RequestWrite(void*& data, size_t& len);
+   void CommitWrite(void* data, size_t len);
+   void EndWrite();
+   void RequestRead(void*& data, size_t& len);
+   void CommitRead(void* data, size_t len);
+   void EndRead();
+
+ private:
+   // Fraction of the capacity.
+   size_t Part2Bytes(double part);
+   // Create the pipes for at least BufferSize bytes.
+   void CreatePipes();
+   void ClosePipes();
+   // The writer cannot continue until the reader empties a pipe.
+   bool isFull() const;
+   // The pipe after index in the ring.
+   size_t Next(size_t index) const { return index + 1 == Pipes.size() ? 0 : index + 1; }
+};
+
+}} // end namespace
+
+#endif
@@ -0,0 +1,188 @@
+/*****************************************************************************
+*
+*  Lock-free SPSC FIFO buffer implementation.
+*  The synchronization relies on the GCC __atomic builtins. The stream
+*  positions are 64 bit counters that never wrap in practice. So the fill
+*  level is always the difference of the write and the read count.
+*
+*****************************************************************************/
+
+#include "spscfifo.h"
+#include <stdexcept>
+
+namespace MM {
+namespace FIFO {
+
+template <typename T>
+inline static T load_acquire(const volatile T& v)
+{  return __atomic_load_n(&v, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+inline static void store_release(volatile T& v, T value)
+{  __atomic_store_n(&v, value, __ATOMIC_RELEASE);
+}
+
+SPSCFIFO::SPSCFIFO(Storage* storage, double highwater, double lowwater)
+ : Buffer(storage)
+ , BufferBegin(Buffer->begin())
+ , BufferSize(Buffer->size())
+ , EOS(false)
+ , Die(false)
+ , WrMin(1)
+{  LowWaterMark = Part2Bytes(lowwater);
+   HighWaterMark = Part2Bytes(highwater);
+   Stat.AllocTime = Buffer->getAllocTime();
+   Stat.PrefaultTime = Buffer->getPrefaultTime();
+   Stat.ResidentSize = Stat.PeakResidentSize = BufferSize;
+}
+
+SPSCFIFO::~SPSCFIFO()
+{  store_release(Die, true);
+   Wr.Spot.Wake();
+   Rd.Spot.Wake();
+}
+
+inline size_t SPSCFIFO::WriterLevel() const
+{  return (size_t)(Wr.Count - load_acquire(Rd.Count));
+}
+
+inline size_t SPSCFIFO::ReaderLevel() const
+{  return (size_t)(load_acquire(Wr.Count) - Rd.Count);
+}
+
+bool SPSCFIFO::WriterReady() const
+{  size_t level = WriterLevel();
+   return (BufferSize - level >= load_acquire(WrMin) && level <= LowWaterMark) || load_acquire(EOS) || load_acquire(Die);
+}
+
+bool SPSCFIFO::ReaderReady() const
+{  size_t level = ReaderLevel();
+   return (level > 0 && (level >= HighWaterMark || load_acquire(WrMin) > 1)) || load_acquire(EOS) || load_acquire(Die);
+}
+
+size_t SPSCFIFO::ClipAtEnd(size_t offset, size_t len)
+{  size_t rem = BufferSize - offset;
+   if (len > rem)
+   {  __atomic_add_fetch(&Stat.SplitCount, 1, __ATOMIC_RELAXED); // counted by both sides
+      if (!Buffer->isMirrored())
+         len = rem;
+   }
+   return len;
+}
+
+void SPSCFIFO::RequestWrite(void*& data, size_t& len)
+{  RequestWriteMin(data, len, 1);
+}
+
+void SPSCFIFO::RequestWriteMin(void*& data, size_t& len, size_t min)
+{  if (Wr.Req != 0)
+      throw std::logic_error("The SPSCFIFO class does not support two buffer resquests without commit in between.");
+   if (min > len || min > BufferSize || (min > 1 && !Buffer->isMirrored()))
+      throw std::logic_error("The minimum length of a write request must not exceed the requested length or the buffer size and requires a mirrored buffer.");
+   for (;;)
+   {  if (load_acquire(EOS) || load_acquire(Die))
+      {  len = 0;
+         return;
+      }
+      size_t rem = BufferSize - WriterLevel();
+      if (rem > 0 && rem >= min)
+      {  if (len > rem)
+            len = rem;
+         len = ClipAtEnd(Wr.Offset, len);
+         data = BufferBegin + Wr.Offset;
+         Wr.Req = len;
+         return;
+      }
+      ++Stat.FullCount;
+      store_release(WrMin, min);
+      if (min > 1)
+      {  // The reader may wait for a high water mark that the level cannot reach.
+         __atomic_thread_fence(__ATOMIC_SEQ_CST);
+         if (ReaderReady())
+            Rd.Spot.Wake();
+      }
+      Wr.Spot.Park(*this, &SPSCFIFO::WriterReady, Stat);
+      store_release(WrMin, (size_t)1);
+   }
+}
+
+void SPSCFIFO::CommitWrite(void* data, size_t len)
+{  if (data != BufferBegin + Wr.Offset)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > Wr.Req)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   Wr.Req = 0;
+   if ((Wr.Offset += len) >= BufferSize)
+      Wr.Offset -= BufferSize;
+   store_release(Wr.Count, Wr.Count + len);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   if (ReaderReady())
+      Rd.Spot.Wake();
+}
+
+void SPSCFIFO::EndWrite()
+{  Wr.Req = 0; // cancel outstanding requests
+   store_release(EOS, true); // end of stream marker
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   Rd.Spot.Wake(); // notify the other side regardless of the high water mark.
+}
+
+void SPSCFIFO::RequestRead(void*& data, size_t& len)
+{  if (Rd.Req != 0)
+      throw std::logic_error("The SPSCFIFO class does not support two buffer resquests without commit in between.");
+   for (;;)
+   {  size_t level = ReaderLevel();
+      if (level > 0)
+      {  if (len > level)
+            len = level;
+         len = ClipAtEnd(Rd.Offset, len);
+         data = BufferBegin + Rd.Offset;
+         Rd.Req = len;
+         return;
+      }
+      if (load_acquire(Die))
+      {  len = 0;
+         return;
+      }
+      if (load_acquire(EOS))
+      {  // The writer might have committed data before it set the EOS flag.
+         if (ReaderLevel() == 0)
+         {  len = 0;
+            return;
+         }
+         continue;
+      }
+      ++Stat.EmptyCount;
+      Rd.Spot.Park(*this, &SPSCFIFO::ReaderReady, Stat);
+   }
+}
+
+void SPSCFIFO::CommitRead(void* data, size_t len)
+{  if (data != BufferBegin + Rd.Offset)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > Rd.Req)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   Rd.Req = 0;
+   if ((Rd.Offset += len) >= BufferSize)
+      Rd.Offset -= BufferSize;
+   store_release(Rd.Count, Rd.Count + len);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   if (WriterReady())
+      Wr.Spot.Wake();
+}
+
+void SPSCFIFO::EndRead()
+{  Rd.Req = 0; // cancel outstanding requests
+   store_release(EOS, true); // end of stream marker
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   Wr.Spot.Wake(); // notify the other side regardless of the low water mark.
+}
+
+size_t SPSCFIFO::Part2Bytes(double part)
+{  if (part < 0.0 || part > 1.0)
+      throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+   return (size_t)(BufferSize * part +.5);
+}
+
+}} // end namespace
@@ -0,0 +1,98 @@
+#ifndef __spscfifo_h
+#define __spscfifo_h
+
+#include <stdint.h>
+
+#include "fifo.h"
+
+/*****************************************************************************
+*
+*  spscfifo.cpp - lock-free single producer single consumer fifo
+*
+*  This is an alternative to StaticFIFO for exactly one writer thread and
+*  exactly one reader thread. The hot path of both sides does not take any
+*  lock. The sides only exchange their committed stream positions by atomic
+*  loads and stores with acquire/release semantics. The kernel is only
+*  entered if one side has to wait at a water mark. The sides wait in the
+*  FutexWait policy of basicfifo.h.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class SPSCFIFO
+ : public FIFO
+ , private Drain
+ , private Source
+{private:
+   enum { CacheLineSize = 64 };
+   // One side of the fifo. Only the owning thread writes Count, Offset and Req.
+   struct Cursor
+   {  volatile uint64_t Count;  // Committed stream position.
+      size_t   Offset;          // Committed position within the buffer.
+      size_t   Req;             // Size of the outstanding request.
+      FutexWait Spot;           // Owner waits here.
+      Cursor() : Count(0), Offset(0), Req(0) {}
+   };
+
+ private:   // internal quasi-constant objects
+   const std::auto_ptr<Storage> Buffer;
+   char* BufferBegin;
+   size_t BufferSize;
+   size_t LowWaterMark;
+   size_t HighWaterMark;
+ private:   // internal state, each side on its own cache line
+   char Pad0[CacheLineSize];
+   Cursor Wr;
+   char Pad1[CacheLineSize];
+   Cursor Rd;
+   char Pad2[CacheLineSize];
+   bool volatile EOS; // end of stream flag
+   bool volatile Die; // destroy-flag
+   size_t volatile WrMin; // free space the parked writer waits for
+ private:   // statistics
+   Statistics Stat;
+
+ public:    // public interface
+   // Constructor for a lock-free fifo in storage. The fifo takes the
+   // ownership of the storage object.
+   explicit SPSCFIFO(Storage* storage, double highwater, double lowwater);
+   virtual ~SPSCFIFO();
+
+   // @see FIFO::getDrain
+   Drain& getDrain()
+   {  return *this;
+   }
+   // @see FIFO::getSource
+   Source& getSource()
+   {  return *this;
+   }
+
+   virtual volatile const Statistics& getStatistics() const { return Stat; }
+
+ protected: // public interface implementations (indirect)
+   void RequestWrite(void*& data, size_t& len);
+   void RequestWriteMin(void*& data, size_t& len, size_t min);
+   void CommitWrite(void* data, size_t len);
+   void EndWrite();
+   void RequestRead(void*& data, size_t& len);
+   void CommitRead(void* data, size_t len);
+   void EndRead();
+
+ private:
+   size_t Part2Bytes(double part);
+   // Committed fill level as seen by the writer and the reader respectively.
+   size_t WriterLevel() const;
+   size_t ReaderLevel() const;
+   // Wakeup conditions of the parked threads.
+   bool WriterReady() const;
+   bool ReaderReady() const;
+   // Clip a request of len bytes at offset to the end of the buffer unless
+   // the storage is mirrored.
+   size_t ClipAtEnd(size_t offset, size_t len);
+};
+
+}} // end namespace
+
+#endif
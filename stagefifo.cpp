@@ -0,0 +1,217 @@
+/*****************************************************************************
+*
+*  FIFO buffer with processing stages.
+*  All cursors share one mutex. Each cursor waits at its own notification
+*  and is only woken by the cursor in front of it, except for the writer
+*  which is woken by the reader.
+*
+*****************************************************************************/
+
+#include "stagefifo.h"
+#include <stdexcept>
+
+namespace MM {
+namespace FIFO {
+
+using namespace MM::IPC;
+
+StageFIFO::StageFIFO(Storage* storage, double highwater, double lowwater, const std::vector<size_t>& granularity)
+ : Buffer(storage)
+ , BufferBegin(Buffer->begin())
+ , BufferSize(Buffer->size())
+ , LowWaterMark(Part2Bytes(lowwater))
+ , HighWaterMark(Part2Bytes(highwater))
+ , Broken(false)
+ , Die(false)
+{  Cursors.push_back(new Cursor(StateLock, 1)); // writer
+   for (size_t i = 0; i < granularity.size(); ++i)
+   {  if (granularity[i] == 0 || BufferSize % granularity[i])
+         throw std::invalid_argument("The buffer size must be a multiple of the granularity of all stages.");
+      Cursors.push_back(new Cursor(StateLock, granularity[i]));
+      Stages.push_back(new StageImpl(*this, i+1));
+   }
+   Cursors.push_back(new Cursor(StateLock, 1)); // reader
+   Stat.AllocTime = Buffer->getAllocTime();
+   Stat.PrefaultTime = Buffer->getPrefaultTime();
+   Stat.ResidentSize = Stat.PeakResidentSize = BufferSize;
+}
+
+StageFIFO::~StageFIFO()
+{  Die = true;
+   for (size_t i = 0; i < Stages.size(); ++i)
+      delete Stages[i];
+   for (size_t i = 0; i < Cursors.size(); ++i)
+      delete Cursors[i];
+}
+
+Stage& StageFIFO::getStage(unsigned i)
+{  if (i >= Stages.size())
+      throw std::logic_error("The StageFIFO does not have a stage with this index.");
+   return *Stages[i];
+}
+
+size_t StageFIFO::Available(size_t index) const
+{  const Cursor& cur = *Cursors[index];
+   if (index == 0)
+      return BufferSize - (size_t)(cur.Count - Cursors.back()->Count);
+   const Cursor& prev = *Cursors[index-1];
+   size_t avail = (size_t)(prev.Count - cur.Count);
+   if (!prev.Ended)
+      avail -= avail % cur.Granularity;
+   return avail;
+}
+
+bool StageFIFO::Request(size_t index, void*& data, size_t& len)
+{  Cursor& cur = *Cursors[index];
+   size_t rem = Available(index);
+   if (rem == 0)
+      return false;
+   // A stage gets at least one granule even if it requested less.
+   if (len < cur.Granularity)
+      len = cur.Granularity;
+   if (len > rem)
+      len = rem;
+   size_t offset = cur.Count % BufferSize;
+   if (len > BufferSize - offset)
+   {  ++Stat.SplitCount;
+      if (!Buffer->isMirrored())
+         len = BufferSize - offset;
+   }
+   // keep the granularity, only the end of the stream is shorter
+   if (len > cur.Granularity)
+      len -= len % cur.Granularity;
+   data = BufferBegin + offset;
+   cur.Req = len;
+   return true;
+}
+
+void StageFIFO::Commit(size_t index, void* data, size_t len)
+{  Cursor& cur = *Cursors[index];
+   if (!cur.Req || data != BufferBegin + cur.Count % BufferSize)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > cur.Req)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   cur.Req = 0;
+   cur.Count += len;
+   const size_t last = Cursors.size() - 1;
+   if (index == last)
+   {  if (Cursors[0]->Count - cur.Count <= LowWaterMark)
+         Cursors[0]->Notify.NotifyAll();
+   } else if (index + 1 == last)
+   {  if (cur.Count - Cursors[last]->Count >= HighWaterMark)
+         Cursors[last]->Notify.NotifyAll();
+   } else if (Available(index + 1))
+      Cursors[index + 1]->Notify.NotifyAll();
+}
+
+void StageFIFO::End(size_t index)
+{  Cursor& cur = *Cursors[index];
+   cur.Ended = true;
+   cur.Req = 0; // cancel outstanding requests
+   // A cursor that stops before it reached the end of the stream stops all
+   // cursors in front of it.
+   if (index != 0 && (!Cursors[index-1]->Ended || Cursors[index-1]->Count != cur.Count))
+      Broken = true;
+   for (size_t i = 0; i < Cursors.size(); ++i)
+      Cursors[i]->Notify.NotifyAll();
+}
+
+void StageFIFO::RequestWrite(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   Cursor& cur = *Cursors[0];
+   if (cur.Req)
+      throw std::logic_error("The StageFIFO supports only one outstanding write request.");
+   do
+   {  if (cur.Ended || Broken)
+      {  len = 0;
+         return;
+      }
+      if (Request(0, data, len))
+         return;
+      ++Stat.FullCount;
+   } while (cur.Notify.Wait());
+   // error
+   len = 0;
+}
+
+void StageFIFO::CommitWrite(void* data, size_t len)
+{  Lock lc(StateLock);
+   Commit(0, data, len);
+}
+
+void StageFIFO::EndWrite()
+{  Lock lc(StateLock);
+   End(0);
+}
+
+void StageFIFO::RequestProcess(size_t index, void*& data, size_t& len)
+{  Lock lc(StateLock);
+   Cursor& cur = *Cursors[index];
+   if (cur.Req)
+      throw std::logic_error("The StageFIFO supports only one outstanding request per stage.");
+   do
+   {  if (cur.Ended || Broken)
+      {  len = 0;
+         return;
+      }
+      if (Request(index, data, len))
+         return;
+      if (Cursors[index-1]->Ended)
+      {  len = 0;
+         return;
+      }
+   } while (cur.Notify.Wait());
+   // error
+   len = 0;
+}
+
+void StageFIFO::CommitProcess(size_t index, void* data, size_t len)
+{  Lock lc(StateLock);
+   Commit(index, data, len);
+}
+
+void StageFIFO::EndProcess(size_t index)
+{  Lock lc(StateLock);
+   End(index);
+}
+
+void StageFIFO::RequestRead(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   const size_t last = Cursors.size() - 1;
+   Cursor& cur = *Cursors[last];
+   if (cur.Req)
+      throw std::logic_error("The StageFIFO supports only one outstanding read request.");
+   do
+   {  if (cur.Ended)
+      {  len = 0;
+         return;
+      }
+      if (Request(last, data, len))
+         return;
+      if (Cursors[last-1]->Ended)
+      {  len = 0;
+         return;
+      }
+      ++Stat.EmptyCount;
+   } while (cur.Notify.Wait());
+   // error
+   len = 0;
+}
+
+void StageFIFO::CommitRead(void* data, size_t len)
+{  Lock lc(StateLock);
+   Commit(Cursors.size() - 1, data, len);
+}
+
+void StageFIFO::EndRead()
+{  Lock lc(StateLock);
+   End(Cursors.size() - 1);
+}
+
+size_t StageFIFO::Part2Bytes(double part)
+{  if (part < 0.0 || part > 1.0)
+      throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+   return (size_t)(BufferSize * part +.5);
+}
+
+}} // end namespace
@@ -0,0 +1,131 @@
+#ifndef __stagefifo_h
+#define __stagefifo_h
+
+#include <vector>
+
+#include "fifo.h"
+
+/*****************************************************************************
+*
+*  stagefifo.cpp - fifo buffer with in-place processing stages
+*
+*  The StageFIFO has a chain of cursors in one ring: the writer, any number
+*  of processing stages and the reader. A stage requests data that has been
+*  committed by the cursor in front of it, modifies the data in place and
+*  commits it to the next cursor. The reader only sees data that passed all
+*  stages. The space is reused when the reader has committed it. So the
+*  data is never copied and each stage may run in its own thread.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+// In-place processing interface (fifo stage)
+// Thread safety: one instance <-> one thread.
+struct Stage
+{  // Request data to process.
+   // The function returns data that has been committed by the previous
+   // stage or the writer. len is a multiple of the granularity of the
+   // stage unless the end of the stream is reached, at least one granule
+   // even if less is requested. It is zero at the end of the stream. The
+   // function blocks if there is no data.
+   virtual void RequestProcess(void*& data, size_t& len) = 0;
+   // Pass the processed data to the next stage or the reader.
+   // data must be the pointer returned by RequestProcess, len must not be
+   // larger than returned by RequestProcess.
+   virtual void CommitProcess(void* data, size_t len) = 0;
+   // The stage does not process any more data. If this is called before
+   // the end of the stream the writer and the previous stages are stopped.
+   virtual void EndProcess() = 0;
+};
+
+class StageFIFO
+ : public FIFO
+ , private Drain
+ , private Source
+{private:   // internal types
+   // Position of the writer, a stage or the reader.
+   struct Cursor
+   {  uint64_t Count;          // committed stream position
+      size_t Req;              // size of the outstanding request
+      size_t Granularity;      // stages only process multiples of this
+      bool Ended;              // the cursor does not commit any more data
+      IPC::Notification Notify; // the owner of the cursor waits here
+      Cursor(IPC::Mutex& mtx, size_t granularity) : Count(0), Req(0), Granularity(granularity), Ended(false), Notify(mtx) {}
+   };
+   // Stage interface of the cursor Index.
+   class StageImpl : public Stage
+   {  StageFIFO& Fifo;
+      const size_t Index;
+    public:
+      StageImpl(StageFIFO& fifo, size_t index) : Fifo(fifo), Index(index) {}
+      virtual ~StageImpl() {}
+      void RequestProcess(void*& data, size_t& len) { Fifo.RequestProcess(Index, data, len); }
+      void CommitProcess(void* data, size_t len)    { Fifo.CommitProcess(Index, data, len); }
+      void EndProcess()                             { Fifo.EndProcess(Index); }
+   };
+ private:   // internal quasi-constant objects
+   const std::auto_ptr<Storage> Buffer;
+   char* BufferBegin;
+   size_t BufferSize;
+   const size_t LowWaterMark;
+   const size_t HighWaterMark;
+ private:   // internal state
+   std::vector<Cursor*> Cursors; // writer, stages, reader
+   std::vector<StageImpl*> Stages;
+   bool volatile Broken;  // a cursor stopped before the end of the stream
+   bool volatile Die;     // destroy-flag
+ private:   // internal semaphores
+   IPC::Mutex StateLock;
+ private:   // statistics
+   Statistics Stat;
+
+ public:    // public interface
+   // Constructor for a fifo in storage with one processing stage per entry
+   // of granularity. Each stage only gets multiples of its granularity,
+   // except for the end of the stream. The size of storage must be a multiple
+   // of all granularities. The fifo takes the ownership of the storage
+   // object.
+   StageFIFO(Storage* storage, double highwater, double lowwater, const std::vector<size_t>& granularity);
+   virtual ~StageFIFO();
+
+   // @see FIFO::getDrain
+   Drain& getDrain()
+   {  return *this;
+   }
+   // @see FIFO::getSource
+   Source& getSource()
+   {  return *this;
+   }
+   // Interface of the i-th processing stage.
+   Stage& getStage(unsigned i);
+
+   virtual volatile const Statistics& getStatistics() const { return Stat; }
+
+ protected: // public interface implementations (indirect)
+   void RequestWrite(void*& data, size_t& len);
+   void CommitWrite(void* data, size_t len);
+   void EndWrite();
+   void RequestRead(void*& data, size_t& len);
+   void CommitRead(void* data, size_t len);
+   void EndRead();
+   void RequestProcess(size_t index, void*& data, size_t& len);
+   void CommitProcess(size_t index, void* data, size_t len);
+   void EndProcess(size_t index);
+
+ private:
+   size_t Part2Bytes(double part);
+   // Data that the cursor index may request.
+   size_t Available(size_t index) const;
+   // Request up to len bytes at cursor index. Returns false if the caller has to wait.
+   bool Request(size_t index, void*& data, size_t& len);
+   // Commit len bytes of cursor index and wake the next cursor.
+   void Commit(size_t index, void* data, size_t len);
+   // End cursor index.
+   void End(size_t index);
+};
+
+}} // end namespace
+
+#endif
@@ -0,0 +1,299 @@
+/*****************************************************************************
+*
+*  Storage implementations for the fifo buffers.
+*
+*****************************************************************************/
+
+#include "storage.h"
+#include "PerfCount.h"
+#include <MMUtil+.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdexcept>
+#include <memory>
+#include <string>
+
+#if !defined(__OS2__) && !defined(_WIN32)
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+namespace MM {
+namespace FIFO {
+
+Storage* Storage::Create(Type type, size_t size, size_t alignment)
+{  PerfCount timer;
+   Storage* storage;
+   switch (type)
+   {case Mirror:
+      storage = new MirrorStorage(size, alignment);
+      break;
+    case Anonymous:
+    case HugeTLB:
+    case THP:
+      storage = new MappedStorage(type, size, alignment);
+      break;
+    default:
+      storage = new HeapStorage(size, alignment);
+   }
+   timer.Update(storage->Size);
+   storage->AllocTime = timer.getSeconds();
+   return storage;
+}
+
+#ifdef __linux__
+// Read a single number from a cgroup file. Returns UINT64_MAX for "max" or
+// if the file does not exist.
+static uint64_t ReadCGroupValue(const std::string& path)
+{  uint64_t value = UINT64_MAX;
+   FILE* fp = fopen(path.c_str(), "r");
+   if (fp)
+   {  unsigned long long v;
+      if (fscanf(fp, "%llu", &v) == 1)
+         value = v;
+      fclose(fp);
+   }
+   return value;
+}
+
+uint64_t Storage::AvailableMemory()
+{  // cgroup v2: find the group of this process in the unified hierarchy.
+   std::string dir = "/sys/fs/cgroup";
+   FILE* fp = fopen("/proc/self/cgroup", "r");
+   if (fp)
+   {  char line[1024];
+      while (fgets(line, sizeof line, fp))
+         if (strncmp(line, "0::", 3) == 0)
+         {  line[strcspn(line, "\n")] = 0;
+            if (strcmp(line+3, "/") != 0)
+               dir += line+3;
+            break;
+         }
+      fclose(fp);
+   }
+   uint64_t limit = ReadCGroupValue(dir + "/memory.max");
+   uint64_t usage;
+   if (limit != UINT64_MAX)
+      usage = ReadCGroupValue(dir + "/memory.current");
+    else
+   {  // cgroup v1
+      limit = ReadCGroupValue("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+      usage = ReadCGroupValue("/sys/fs/cgroup/memory/memory.usage_in_bytes");
+   }
+   if (limit == UINT64_MAX || usage == UINT64_MAX)
+      return UINT64_MAX;
+   return limit > usage ? limit - usage : 0;
+}
+#else
+uint64_t Storage::AvailableMemory()
+{  return UINT64_MAX;
+}
+#endif
+
+#if defined(__OS2__) || defined(_WIN32)
+void Storage::Prefault(unsigned)
+{  PerfCount timer;
+   for (volatile char* cp = Begin; cp < Begin + Size; cp += 4096)
+      *cp = 0;
+   timer.Update(Size);
+   PrefaultTime = timer.getSeconds();
+}
+
+void Storage::Lock()
+{  throw std::runtime_error("Locking the fifo buffer into memory is not supported on this platform.");
+}
+
+#else
+// range of pages to be touched by one thread
+struct PrefaultJob
+{  char*  Begin;
+   char*  End;
+   size_t Page;
+};
+
+static void* PrefaultWorker(void* arg)
+{  const PrefaultJob& job = *(const PrefaultJob*)arg;
+   for (volatile char* cp = job.Begin; cp < job.End; cp += job.Page)
+      *cp = 0;
+   return NULL;
+}
+
+void Storage::Prefault(unsigned threads)
+{  PerfCount timer;
+   const size_t page = sysconf(_SC_PAGESIZE);
+   const size_t pages = Size / page;
+   if (threads > pages)
+      threads = pages;
+   if (threads == 0)
+      threads = 1;
+   std::vector<PrefaultJob> jobs(threads);
+   std::vector<pthread_t> tids(threads);
+   std::vector<bool> running(threads);
+   for (unsigned i = 0; i < threads; ++i)
+   {  jobs[i].Begin = Begin + pages * i / threads * page;
+      jobs[i].End = i == threads-1 ? Begin + Size : Begin + pages * (i+1) / threads * page;
+      jobs[i].Page = page;
+      // job 0 is executed by the current thread
+      running[i] = i && pthread_create(&tids[i], NULL, PrefaultWorker, &jobs[i]) == 0;
+   }
+   PrefaultWorker(&jobs[0]);
+   for (unsigned i = 1; i < threads; ++i)
+      if (running[i])
+         pthread_join(tids[i], NULL);
+       else
+         PrefaultWorker(&jobs[i]); // thread creation failed, do it here
+   timer.Update(Size);
+   PrefaultTime = timer.getSeconds();
+}
+
+void Storage::Lock()
+{  // A mirrored storage locks both mappings of the same pages.
+   if (mlock(Begin, Mirrored ? 2*Size : Size) != 0)
+      throw os_error(errno, stringf("Failed to lock %lu bytes of fifo buffer into memory. Check ulimit -l.", (unsigned long)Size));
+}
+#endif
+
+// class HeapStorage
+HeapStorage::HeapStorage(size_t size, size_t alignment)
+ : Buffer(size + alignment)
+{  Begin = (char*)(((uintptr_t)&*Buffer.begin() + alignment - 1) & -(uintptr_t)alignment);
+   Size = size;
+}
+
+// class MappedStorage
+#ifdef __linux__
+// size of the huge pages from the huge page pool
+static size_t HugePageSize()
+{  size_t size = 2*1024*1024;
+   FILE* fp = fopen("/proc/meminfo", "r");
+   if (fp)
+   {  char line[128];
+      unsigned long kb;
+      while (fgets(line, sizeof line, fp))
+         if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+         {  size = (size_t)kb * 1024;
+            break;
+         }
+      fclose(fp);
+   }
+   return size;
+}
+#endif
+
+#if !defined(__OS2__) && !defined(_WIN32)
+MappedStorage::MappedStorage(Type type, size_t size, size_t alignment)
+{  size_t page = sysconf(_SC_PAGESIZE);
+   int flags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE;
+   switch (type)
+   {default:
+      break;
+    #ifdef __linux__
+    case HugeTLB:
+      page = HugePageSize();
+      // Reserve the huge pages now. Otherwise the first access would fail
+      // with SIGBUS if the pool is exhausted.
+      flags = (flags & ~MAP_NORESERVE) | MAP_HUGETLB;
+      break;
+    case THP:
+      // Transparent huge pages require huge page aligned addresses.
+      if (alignment < HugePageSize())
+         alignment = HugePageSize();
+      break;
+    #else
+    case HugeTLB:
+    case THP:
+      throw std::runtime_error("Huge pages are not supported on this platform.");
+    #endif
+   }
+   size = (size + page - 1) & -page;
+   if (alignment < page)
+      alignment = page;
+   // The kernel aligns huge pages by itself. Other mappings are aligned by
+   // reserving more address space and cutting off the remaining parts.
+   MapSize = type == HugeTLB ? size : size + alignment - sysconf(_SC_PAGESIZE);
+   Map = (char*)mmap(NULL, MapSize, PROT_READ|PROT_WRITE, flags, -1, 0);
+   if (Map == MAP_FAILED)
+   {  int rc = errno;
+      if (type == HugeTLB)
+         throw os_error(rc, stringf("Failed to allocate %lu bytes of huge pages. Check /proc/sys/vm/nr_hugepages.", (unsigned long)size));
+      throw os_error(rc, stringf("Failed to map %lu bytes of fifo buffer.", (unsigned long)size));
+   }
+   Begin = (char*)(((uintptr_t)Map + alignment - 1) & -(uintptr_t)alignment);
+   Size = size;
+   #ifdef __linux__
+   if (type == THP)
+      madvise(Begin, Size, MADV_HUGEPAGE); // only a hint, ignore errors
+   #endif
+}
+
+MappedStorage::~MappedStorage()
+{  munmap(Map, MapSize);
+}
+
+#else
+MappedStorage::MappedStorage(Type, size_t, size_t)
+{  throw std::runtime_error("Mapped fifo buffers are not supported on this platform.");
+}
+
+MappedStorage::~MappedStorage()
+{}
+#endif
+
+// class MirrorStorage
+#ifdef __linux__
+MirrorStorage::MirrorStorage(size_t size, size_t alignment)
+{  size_t page = sysconf(_SC_PAGESIZE);
+   size = (size + page - 1) & -page;
+   if (alignment < page)
+      alignment = page;
+   int fd = memfd_create("buffer2", MFD_CLOEXEC);
+   if (fd == -1)
+      throw os_error(errno, "Failed to create the memory file for the mirrored buffer.");
+   if (ftruncate(fd, size) != 0)
+   {  int rc = errno;
+      close(fd);
+      throw os_error(rc, "Failed to allocate the memory file for the mirrored buffer.");
+   }
+   // reserve address space for both mappings and the alignment
+   char* area = (char*)mmap(NULL, 2*size + alignment, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+   if (area == MAP_FAILED)
+   {  int rc = errno;
+      close(fd);
+      throw os_error(rc, "Failed to reserve address space for the mirrored buffer.");
+   }
+   char* begin = (char*)(((uintptr_t)area + alignment - 1) & -(uintptr_t)alignment);
+   // give back the unused address space
+   if (begin != area)
+      munmap(area, begin - area);
+   munmap(begin + 2*size, area + alignment - begin);
+   if ( mmap(begin, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED
+     || mmap(begin + size, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED )
+   {  int rc = errno;
+      munmap(begin, 2*size);
+      close(fd);
+      throw os_error(rc, "Failed to map the mirrored buffer.");
+   }
+   close(fd); // the mappings keep the memory alive
+   Begin = begin;
+   Size = size;
+   Mirrored = true;
+}
+
+MirrorStorage::~MirrorStorage()
+{  munmap(Begin, 2*Size);
+}
+
+#else
+MirrorStorage::MirrorStorage(size_t, size_t)
+{  throw std::runtime_error("Mirrored buffers are not supported on this platform.");
+}
+
+MirrorStorage::~MirrorStorage()
+{}
+#endif
+
+}} // end namespace
@@ -0,0 +1,101 @@
+#ifndef __storage_h
+#define __storage_h
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+/*****************************************************************************
+*
+*  storage.cpp - memory blocks for fifo buffers
+*
+*  A Storage object owns the memory of one fifo buffer. The fifo does not
+*  care about how the memory is obtained. It only uses the address range
+*  [begin(), end()). If the storage is mirrored the same pages are mapped a
+*  second time directly behind end(). So any range of up to size() bytes
+*  that starts within [begin(), end()) is contiguous in memory and the fifo
+*  does not need to split requests at the end of the buffer.
+*  Except for the heap storage the memory is not touched before it is used
+*  unless Prefault or Lock is called.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class Storage
+{public:
+   enum Type
+   {  Heap,       // ordinary heap memory
+      Mirror,     // memfd pages mapped twice back to back
+      Anonymous,  // lazily allocated anonymous mapping
+      HugeTLB,    // anonymous mapping from the huge page pool
+      THP         // anonymous mapping with transparent huge pages
+   };
+ protected:
+   char*  Begin;
+   size_t Size;
+   bool   Mirrored;
+   double AllocTime;
+   double PrefaultTime;
+ protected:
+   Storage() : Begin(NULL), Size(0), Mirrored(false), AllocTime(0), PrefaultTime(0) {}
+ private: // non-copyable
+   Storage(const Storage&);
+   void operator=(const Storage&);
+ public:
+   virtual ~Storage() {}
+   char*  begin() const      { return Begin; }
+   char*  end() const        { return Begin + Size; }
+   size_t size() const       { return Size; }
+   bool   isMirrored() const { return Mirrored; }
+   // Time in seconds to allocate the storage and to prefault the pages.
+   double getAllocTime() const { return AllocTime; }
+   double getPrefaultTime() const { return PrefaultTime; }
+
+   // Touch all pages of the storage with the given number of parallel
+   // threads. This moves the cost of page faults to the start of the program.
+   void   Prefault(unsigned threads);
+   // Lock the storage into physical memory. Throws os_error if the limit
+   // for locked memory (ulimit -l) is too low.
+   void   Lock();
+
+   // Create a storage object of the given type with at least size bytes.
+   // The start address is aligned to alignment which must be a power of 2.
+   // Mapped storage is rounded up to a multiple of the page size, HugeTLB
+   // storage to a multiple of the huge page size.
+   static Storage* Create(Type type, size_t size, size_t alignment);
+   // Memory that may still be allocated before the memory limit of the
+   // control group of this process is reached. Returns UINT64_MAX if there
+   // is no limit or if it cannot be determined.
+   static uint64_t AvailableMemory();
+};
+
+// Storage from the heap.
+class HeapStorage : public Storage
+{private:
+   std::vector<char> Buffer;
+ public:
+   HeapStorage(size_t size, size_t alignment);
+};
+
+// Storage from an anonymous memory mapping.
+class MappedStorage : public Storage
+{private:
+   char*  Map;
+   size_t MapSize;
+ public:
+   MappedStorage(Type type, size_t size, size_t alignment);
+   virtual ~MappedStorage();
+};
+
+// Storage that is mapped twice to consecutive virtual addresses.
+class MirrorStorage : public Storage
+{public:
+   MirrorStorage(size_t size, size_t alignment);
+   virtual ~MirrorStorage();
+};
+
+}} // end namespace
+
+#endif
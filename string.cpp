@@ -65,7 +65,11 @@ string vstringf(const char* fmt, va_list ap)
 #elif defined(__GNUC__)
 string vstringf(const char* fmt, va_list va)
 {  // BSD and compatible environments only:
-   size_t len = vsnprintf(NULL, 0, fmt, va);
+   // va_list cannot be used twice on some 64 bit ABIs
+   va_list va2;
+   va_copy(va2, va);
+   size_t len = vsnprintf(NULL, 0, fmt, va2);
+   va_end(va2);
    char* cp = new char[len+1]; // political correct (do not write the internal string data structures directly)
    vsnprintf(cp, len+1, fmt, va);
    string s(cp, len);
@@ -0,0 +1,222 @@
+/*****************************************************************************
+*
+*  Fan-out FIFO buffer implementation.
+*  The writer and all readers share one mutex. Each reader waits at its own
+*  notification, so only the readers that reached the high water mark are
+*  woken.
+*
+*****************************************************************************/
+
+#include "teefifo.h"
+#include <stdexcept>
+
+namespace MM {
+namespace FIFO {
+
+using namespace MM::IPC;
+
+// class TeeFIFO::Reader
+TeeFIFO::Reader::Reader(TeeFIFO& fifo, LagPolicy policy, size_t maxlag)
+ : Fifo(fifo)
+ , Policy(policy)
+ , MaxLag(maxlag)
+ , Count(fifo.WrCount)
+ , Req(0)
+ , Active(true)
+ , Detached(false)
+ , NotifySource(fifo.StateLock)
+{}
+
+// class TeeFIFO
+TeeFIFO::TeeFIFO(Storage* storage, double highwater, double lowwater)
+ : Buffer(storage)
+ , BufferBegin(Buffer->begin())
+ , BufferSize(Buffer->size())
+ , LowWaterMark(Part2Bytes(lowwater))
+ , HighWaterMark(Part2Bytes(highwater))
+ , ActiveReaders(0)
+ , WrCount(0)
+ , WrReq(0)
+ , EOS(false)
+ , Die(false)
+ , NotifyDrain(StateLock)
+{  Stat.AllocTime = Buffer->getAllocTime();
+   Stat.PrefaultTime = Buffer->getPrefaultTime();
+   Stat.ResidentSize = Stat.PeakResidentSize = BufferSize;
+}
+
+TeeFIFO::~TeeFIFO()
+{  Die = true;
+   for (size_t i = 0; i < Readers.size(); ++i)
+      delete Readers[i];
+}
+
+unsigned TeeFIFO::AddReader(LagPolicy policy, size_t maxlag)
+{  Lock lc(StateLock);
+   if (policy == Detach)
+   {  if (maxlag == 0)
+         throw std::invalid_argument("The lag limit of a TeeFIFO reader must be positive.");
+      // The lag can never exceed the buffer size.
+      if (maxlag > BufferSize)
+         maxlag = BufferSize;
+   }
+   Readers.push_back(new Reader(*this, policy, maxlag));
+   ++ActiveReaders;
+   return Readers.size() - 1;
+}
+
+Source& TeeFIFO::getSource(unsigned i)
+{  if (i >= Readers.size())
+      throw std::logic_error("The TeeFIFO does not have a reader with this index.");
+   return *Readers[i];
+}
+
+uint64_t TeeFIFO::MinReadCount()
+{  uint64_t min = WrCount;
+   for (size_t i = 0; i < Readers.size(); ++i)
+   {  Reader& rd = *Readers[i];
+      if (rd.Active && rd.Policy == Detach && WrCount - rd.Count >= rd.MaxLag)
+      {  rd.Active = false;
+         rd.Detached = true;
+         --ActiveReaders;
+         rd.NotifySource.NotifyAll();
+      }
+      // A detached reader still owns the data of its outstanding request.
+      if (!rd.Active && !rd.Req)
+         continue;
+      if (rd.Count < min)
+         min = rd.Count;
+   }
+   return min;
+}
+
+void TeeFIFO::CheckDetached(const Reader& rd)
+{  if (rd.Detached)
+      throw std::runtime_error(stringf("The output has been detached because it fell behind by %lu bytes.", (unsigned long)rd.MaxLag));
+}
+
+size_t TeeFIFO::ClipAtEnd(size_t offset, size_t len)
+{  size_t rem = BufferSize - offset;
+   if (len > rem)
+   {  ++Stat.SplitCount;
+      if (!Buffer->isMirrored())
+         len = rem;
+   }
+   return len;
+}
+
+void TeeFIFO::RequestWrite(void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (WrReq)
+      throw std::logic_error("The TeeFIFO supports only one outstanding write request.");
+   do
+   {  size_t rem = BufferSize - (size_t)(WrCount - MinReadCount());
+      if (EOS || ActiveReaders == 0)
+      {  len = 0;
+         return;
+      }
+      if (rem > 0)
+      {  if (len > rem)
+            len = rem;
+         size_t offset = WrCount % BufferSize;
+         len = ClipAtEnd(offset, len);
+         data = BufferBegin + offset;
+         WrReq = len;
+         return;
+      }
+      ++Stat.FullCount;
+   } while (NotifyDrain.Wait());
+   // error
+   len = 0;
+}
+
+void TeeFIFO::CommitWrite(void* data, size_t len)
+{  Lock lc(StateLock);
+   if (!WrReq || data != BufferBegin + WrCount % BufferSize)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > WrReq)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   WrReq = 0;
+   WrCount += len;
+   for (size_t i = 0; i < Readers.size(); ++i)
+   {  Reader& rd = *Readers[i];
+      if (rd.Active && WrCount - rd.Count >= HighWaterMark)
+         rd.NotifySource.NotifyAll();
+   }
+}
+
+void TeeFIFO::EndWrite()
+{  Lock lc(StateLock);
+   EOS = true; // end of stream marker
+   WrReq = 0; // cancel outstanding requests
+   // notify the other side regardless of the high water mark.
+   for (size_t i = 0; i < Readers.size(); ++i)
+      Readers[i]->NotifySource.NotifyAll();
+}
+
+void TeeFIFO::RequestRead(Reader& rd, void*& data, size_t& len)
+{  Lock lc(StateLock);
+   if (rd.Req)
+      throw std::logic_error("The TeeFIFO supports only one outstanding read request per reader.");
+   do
+   {  CheckDetached(rd);
+      if (!rd.Active)
+      {  len = 0;
+         return;
+      }
+      size_t rem = (size_t)(WrCount - rd.Count);
+      if (rem > 0)
+      {  if (len > rem)
+            len = rem;
+         size_t offset = rd.Count % BufferSize;
+         len = ClipAtEnd(offset, len);
+         data = BufferBegin + offset;
+         rd.Req = len;
+         return;
+      }
+      if (EOS)
+      {  len = 0;
+         return;
+      }
+      ++Stat.EmptyCount;
+   } while (rd.NotifySource.Wait());
+   // error
+   len = 0;
+}
+
+void TeeFIFO::CommitRead(Reader& rd, void* data, size_t len)
+{  Lock lc(StateLock);
+   if (rd.Detached)
+   {  // The request is complete, the writer may reuse its space now.
+      rd.Req = 0;
+      NotifyDrain.NotifyAll();
+      CheckDetached(rd);
+   }
+   if (!rd.Req || data != BufferBegin + rd.Count % BufferSize)
+      throw std::logic_error("Cannot commit a buffer that is not requested before.");
+   if (len > rd.Req)
+      throw std::logic_error("Cannot commit a larger buffer than requested.");
+   rd.Req = 0;
+   rd.Count += len;
+   if (WrCount - MinReadCount() <= LowWaterMark)
+      NotifyDrain.NotifyAll();
+}
+
+void TeeFIFO::EndRead(Reader& rd)
+{  Lock lc(StateLock);
+   rd.Req = 0; // cancel outstanding requests
+   if (rd.Active)
+   {  rd.Active = false;
+      --ActiveReaders;
+   }
+   // The slowest reader might be gone.
+   NotifyDrain.NotifyAll();
+}
+
+size_t TeeFIFO::Part2Bytes(double part)
+{  if (part < 0.0 || part > 1.0)
+      throw std::invalid_argument("The fractional part of the fifo buffer is not in the range [0,1].");
+   return (size_t)(BufferSize * part +.5);
+}
+
+}} // end namespace
@@ -0,0 +1,124 @@
+#ifndef __teefifo_h
+#define __teefifo_h
+
+#include <vector>
+
+#include "fifo.h"
+
+/*****************************************************************************
+*
+*  teefifo.cpp - fifo buffer with one writer and several readers
+*
+*  The TeeFIFO passes the same stream to several readers without copying
+*  it. Each reader has its own read position. The space in the ring is
+*  reclaimed when the slowest reader has committed it. A reader either
+*  blocks the writer when it falls behind or it is detached when the data
+*  that waits for it reaches a limit. A detached reader gets an exception
+*  at its next call. The writer and the other readers continue.
+*  A request of a reader that is outstanding while the reader is detached
+*  may be overwritten by the writer.
+*
+*****************************************************************************/
+
+namespace MM {
+namespace FIFO {
+
+class TeeFIFO
+ : public FIFO
+ , private Drain
+{public:
+   // Behaviour when a reader falls behind.
+   enum LagPolicy
+   {  Block,        // The writer waits for the reader.
+      Detach        // The reader is detached.
+   };
+ private:   // internal types
+   // One reader of the fifo.
+   class Reader : public Source
+   {  friend class TeeFIFO;
+    private:
+      TeeFIFO& Fifo;
+      const LagPolicy Policy;
+      const size_t MaxLag;     // detach the reader at this lag
+      uint64_t Count;          // committed read position
+      size_t Req;              // size of the outstanding request
+      bool Active;             // the reader takes part in the stream
+      bool Detached;           // the reader has been detached by the writer
+      IPC::Notification NotifySource;
+    public:
+      Reader(TeeFIFO& fifo, LagPolicy policy, size_t maxlag);
+      virtual ~Reader() {}
+      void RequestRead(void*& data, size_t& len) { Fifo.RequestRead(*this, data, len); }
+      void CommitRead(void* data, size_t len)    { Fifo.CommitRead(*this, data, len); }
+      void EndRead()                             { Fifo.EndRead(*this); }
+   };
+ private:   // internal quasi-constant objects
+   const std::auto_ptr<Storage> Buffer;
+   char* BufferBegin;
+   size_t BufferSize;
+   const size_t LowWaterMark;
+   const size_t HighWaterMark;
+ private:   // internal state
+   std::vector<Reader*> Readers;
+   unsigned ActiveReaders;  // readers that are neither ended nor detached
+   uint64_t WrCount;        // committed write position
+   size_t WrReq;            // size of the outstanding write request
+   bool volatile EOS; // end of stream flag
+   bool volatile Die; // destroy-flag
+ private:   // internal semaphores
+   IPC::Mutex StateLock;
+   IPC::Notification NotifyDrain;
+ private:   // statistics
+   Statistics Stat;
+
+ public:    // public interface
+   // Constructor for a fifo in storage without readers. The fifo takes the
+   // ownership of the storage object.
+   TeeFIFO(Storage* storage, double highwater, double lowwater);
+   virtual ~TeeFIFO();
+
+   // Add a reader before the data flows and return its index.
+   // A reader with policy Detach is detached when maxlag bytes wait for it.
+   // The data of its outstanding request is kept until it commits or ends
+   // the request, so the reader never sees overwritten data.
+   unsigned AddReader(LagPolicy policy = Block, size_t maxlag = 0);
+   // Number of readers.
+   unsigned getReaders() const { return Readers.size(); }
+
+   // @see FIFO::getDrain
+   Drain& getDrain()
+   {  return *this;
+   }
+   // @see FIFO::getSource
+   // This is the first reader.
+   Source& getSource()
+   {  return getSource(0);
+   }
+   // Source interface of the i-th reader.
+   Source& getSource(unsigned i);
+
+   virtual volatile const Statistics& getStatistics() const { return Stat; }
+
+ protected: // public interface implementations (indirect)
+   void RequestWrite(void*& data, size_t& len);
+   void CommitWrite(void* data, size_t len);
+   void EndWrite();
+   void RequestRead(Reader& rd, void*& data, size_t& len);
+   void CommitRead(Reader& rd, void* data, size_t len);
+   void EndRead(Reader& rd);
+
+ private:
+   size_t Part2Bytes(double part);
+   // Read position of the slowest active reader. Readers that exceed their
+   // lag limit are detached first. Returns WrCount if there is no reader.
+   uint64_t MinReadCount();
+   // Throw if rd has been detached.
+   void CheckDetached(const Reader& rd);
+   // Clip a request of len bytes at offset to the end of the buffer unless
+   // the storage is mirrored.
+   size_t ClipAtEnd(size_t offset, size_t len);
+};
+
+}} // end namespace
+
+#endif
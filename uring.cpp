@@ -0,0 +1,162 @@
+#include "uring.h"
+
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <MMUtil+.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace MM;
+
+#ifdef __linux__
+
+Uring::Uring(unsigned depth)
+ : SqMap(MAP_FAILED)
+ , CqMap(MAP_FAILED)
+ , SqeMap(MAP_FAILED)
+ , Queued(0)
+ , InFlight(0)
+ , Fixed(NULL)
+ , FixedLen(0)
+{	io_uring_params params;
+	memset(&params, 0, sizeof params);
+	Fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+	if (Fd < 0)
+		throw os_error(errno, "Failed to create the io_uring.");
+	SqMapLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	CqMapLen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	SqeMapLen = params.sq_entries * sizeof(io_uring_sqe);
+	// Newer kernels map both rings at once.
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		SqMapLen = CqMapLen = max(SqMapLen, CqMapLen);
+	SqMap = mmap(NULL, SqMapLen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+	if (SqMap != MAP_FAILED)
+		CqMap = params.features & IORING_FEAT_SINGLE_MMAP ? SqMap
+			: mmap(NULL, CqMapLen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+	if (CqMap != MAP_FAILED)
+		SqeMap = mmap(NULL, SqeMapLen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, Fd, IORING_OFF_SQES);
+	if (SqeMap == MAP_FAILED)
+	{	int rc = errno;
+		Unmap();
+		throw os_error(rc, "Failed to map the io_uring.");
+	}
+	char* sq = (char*)SqMap;
+	SqTail = (unsigned*)(sq + params.sq_off.tail);
+	SqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+	SqArray = (unsigned*)(sq + params.sq_off.array);
+	char* cq = (char*)CqMap;
+	CqHead = (unsigned*)(cq + params.cq_off.head);
+	CqTail = (unsigned*)(cq + params.cq_off.tail);
+	CqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+	Cqes = cq + params.cq_off.cqes;
+}
+
+Uring::~Uring()
+{	// The kernel must not access the buffers after they are freed.
+	try
+	{	uint64_t tag;
+		while (InFlight)
+			Wait(tag);
+	} catch (...)
+	{}
+	Unmap();
+}
+
+void Uring::Unmap()
+{	if (SqeMap != MAP_FAILED)
+		munmap(SqeMap, SqeMapLen);
+	if (CqMap != MAP_FAILED && CqMap != SqMap)
+		munmap(CqMap, CqMapLen);
+	if (SqMap != MAP_FAILED)
+		munmap(SqMap, SqMapLen);
+	close(Fd);
+}
+
+bool Uring::Register(void* mem, size_t len)
+{	iovec iov;
+	iov.iov_base = mem;
+	iov.iov_len = len;
+	if (syscall(__NR_io_uring_register, Fd, IORING_REGISTER_BUFFERS, &iov, 1) != 0)
+		return false;
+	Fixed = (char*)mem;
+	FixedLen = len;
+	return true;
+}
+
+void Uring::Queue(bool write, int fd, void* data, size_t len, uint64_t pos, uint64_t tag)
+{	const unsigned tail = *SqTail; // only written by us
+	const unsigned index = tail & SqMask;
+	io_uring_sqe& sqe = ((io_uring_sqe*)SqeMap)[index];
+	memset(&sqe, 0, sizeof sqe);
+	const bool fixed = (char*)data >= Fixed && (char*)data + len <= Fixed + FixedLen;
+	sqe.opcode = fixed ? (write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED)
+		: (write ? IORING_OP_WRITE : IORING_OP_READ);
+	sqe.fd = fd;
+	sqe.off = pos;
+	sqe.addr = (uintptr_t)data;
+	sqe.len = (uint32_t)len;
+	sqe.buf_index = 0;
+	sqe.user_data = tag;
+	SqArray[index] = index;
+	__atomic_store_n(SqTail, tail + 1, __ATOMIC_RELEASE);
+	++Queued;
+	++InFlight;
+}
+
+int Uring::Wait(uint64_t& tag)
+{	if (InFlight == 0)
+		throw logic_error("Cannot wait for an io_uring completion without transfers in flight.");
+	for (;;)
+	{	const unsigned head = *CqHead; // only written by us
+		const bool ready = head != __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+		if (Queued || !ready)
+		{	// submit, and wait only if nothing is completed yet
+			int rc = (int)syscall(__NR_io_uring_enter, Fd, Queued, ready ? 0 : 1, ready ? 0 : IORING_ENTER_GETEVENTS, NULL, 0);
+			if (rc >= 0)
+				Queued -= rc;
+			 else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				throw os_error(errno, "Failed to submit to the io_uring.");
+			if (!ready)
+				continue;
+		}
+		const io_uring_cqe& cqe = ((io_uring_cqe*)Cqes)[head & CqMask];
+		tag = cqe.user_data;
+		int res = cqe.res;
+		__atomic_store_n(CqHead, head + 1, __ATOMIC_RELEASE);
+		--InFlight;
+		return res;
+	}
+}
+
+#else
+
+Uring::Uring(unsigned)
+{	throw runtime_error("io_uring is not supported on this platform.");
+}
+
+Uring::~Uring()
+{}
+
+void Uring::Unmap()
+{}
+
+bool Uring::Register(void*, size_t)
+{	return false;
+}
+
+void Uring::Queue(bool, int, void*, size_t, uint64_t, uint64_t)
+{}
+
+int Uring::Wait(uint64_t&)
+{	return -1;
+}
+
+#endif
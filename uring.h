@@ -0,0 +1,58 @@
+#ifndef __uring_h
+#define __uring_h
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*****************************************************************************
+*
+*  uring.cpp - minimal io_uring interface
+*
+*  The ring is set up with the raw system calls, so there is no dependency
+*  on liburing. It provides just what the asynchronous file endpoints need:
+*  reads and writes at explicit file positions, one registered buffer and
+*  waiting for completions. Transfers within the registered buffer use the
+*  fixed buffer operations. Only available on Linux.
+*
+*****************************************************************************/
+
+class Uring
+{	int Fd;
+	void* SqMap;
+	size_t SqMapLen;
+	void* CqMap;
+	size_t CqMapLen;
+	void* SqeMap;
+	size_t SqeMapLen;
+	unsigned* SqTail;
+	unsigned SqMask;
+	unsigned* SqArray;
+	unsigned* CqHead;
+	unsigned* CqTail;
+	unsigned CqMask;
+	void* Cqes;
+	unsigned Queued;      // queued, but not yet submitted
+	unsigned InFlight;    // queued or submitted, but not yet completed
+	char* Fixed;          // registered buffer or NULL
+	size_t FixedLen;
+ public:
+	// Create a ring for up to depth transfers.
+	// Throws os_error if the kernel does not support io_uring.
+	explicit Uring(unsigned depth);
+	// Waits for the transfers in flight.
+	~Uring();
+	unsigned getInFlight() const { return InFlight; }
+	// Register mem as fixed buffer. Returns false if the kernel refuses it.
+	bool Register(void* mem, size_t len);
+	// Queue the transfer of len bytes at data to or from position pos of fd.
+	// No more than depth transfers may be in flight.
+	void Queue(bool write, int fd, void* data, size_t len, uint64_t pos, uint64_t tag);
+	// Submit the queued transfers and wait for the next completion.
+	// Returns the number of bytes transferred or a negative errno value.
+	int Wait(uint64_t& tag);
+ private:
+	// Release the ring.
+	void Unmap();
+};
+
+#endif